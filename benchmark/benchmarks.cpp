@@ -0,0 +1,313 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "benchmarks.h"
+#include "blobcache.h"
+#include "bupvfs.h"
+#include "mergedvfs.h"
+#include "vfshelpers.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <algorithm>
+#include <sys/stat.h>
+
+// Same as the kio_bup defaults.
+static const quint64 cNodeCacheBudget = 256 * 1024 * 1024;
+static const qint64 cBlobCacheBudget = 64 * 1024 * 1024;
+// Operations in each run of the benchmarks that pick at random.
+static const int cRandomOperations = 2000;
+
+Benchmarks::Benchmarks(const QString &pRepositoryPath, int pIterations, quint32 pSeed)
+   : mRepositoryPath(pRepositoryPath), mIterations(qMax(1, pIterations)), mRandom(pSeed), mRepository(nullptr)
+{
+	if(!mRepositoryPath.endsWith(QLatin1Char('/'))) {
+		mRepositoryPath.append(QLatin1Char('/'));
+	}
+}
+
+Benchmarks::~Benchmarks() {
+	delete mRepository;
+}
+
+QStringList Benchmarks::names() {
+	return {QStringLiteral("listDir"), QStringLiteral("listDirWarm"), QStringLiteral("stat"),
+	        QStringLiteral("sequentialRead"), QStringLiteral("smallFileRead"), QStringLiteral("randomRead"),
+	        QStringLiteral("seek"), QStringLiteral("mergedTree"), QStringLiteral("metadataDecoding")};
+}
+
+QJsonArray Benchmarks::run(const QStringList &pNames) {
+	QJsonArray lResults;
+	if(!prepare()) {
+		return lResults;
+	}
+	auto lWanted = [&pNames](const QString &pName) {
+		return pNames.isEmpty() || pNames.contains(pName);
+	};
+
+	// a whole save, as a file manager would show it folder by folder
+	auto lListDir = [this](Repository *pRepository, qint64 &pOperations, qint64 &pBytes) {
+		Q_UNUSED(pBytes)
+		auto lCommit = qobject_cast<ArchivedDirectory *>(pRepository->resolve(mNewestCommit));
+		return lCommit != nullptr && listTree(lCommit, mNewestCommit, pOperations, nullptr);
+	};
+	if(lWanted(QStringLiteral("listDir"))) {
+		lResults.append(measure(QStringLiteral("listDir"), QStringLiteral("entries"), [&](qint64 &pOperations, qint64 &pBytes) {
+			Repository lRepository(nullptr, mRepositoryPath, cNodeCacheBudget);
+			return lListDir(&lRepository, pOperations, pBytes);
+		}));
+	}
+	if(lWanted(QStringLiteral("listDirWarm"))) {
+		lResults.append(measure(QStringLiteral("listDirWarm"), QStringLiteral("entries"), [&](qint64 &pOperations, qint64 &pBytes) {
+			return lListDir(mRepository, pOperations, pBytes);
+		}));
+	}
+	if(lWanted(QStringLiteral("stat"))) {
+		lResults.append(measure(QStringLiteral("stat"), QStringLiteral("files"), [this](qint64 &pOperations, qint64 &pBytes) {
+			Q_UNUSED(pBytes)
+			Repository lRepository(nullptr, mRepositoryPath, cNodeCacheBudget);
+			std::uniform_int_distribution<int> lPick(0, mFiles.count() - 1);
+			for(int i = 0; i < cRandomOperations; ++i) {
+				auto lFile = qobject_cast<File *>(lRepository.resolve(mFiles.at(lPick(mRandom)), true));
+				if(lFile == nullptr) {
+					return false;
+				}
+				lFile->loadMetadata();
+				lFile->size();
+				lRepository.trimNodeCache(lFile);
+				++pOperations;
+			}
+			return true;
+		}));
+	}
+	if(lWanted(QStringLiteral("sequentialRead"))) {
+		lResults.append(measure(QStringLiteral("sequentialRead"), QStringLiteral("reads"), [this](qint64 &pOperations, qint64 &pBytes) {
+			return readFiles(mChunkedFiles, -1, pOperations, pBytes);
+		}));
+	}
+	if(lWanted(QStringLiteral("smallFileRead"))) {
+		lResults.append(measure(QStringLiteral("smallFileRead"), QStringLiteral("reads"), [this](qint64 &pOperations, qint64 &pBytes) {
+			return readFiles(mSmallFiles, -1, pOperations, pBytes);
+		}));
+	}
+	if(lWanted(QStringLiteral("randomRead"))) {
+		lResults.append(measure(QStringLiteral("randomRead"), QStringLiteral("reads"), [this](qint64 &pOperations, qint64 &pBytes) {
+			return readAtRandom(64 * 1024, pOperations, pBytes);
+		}));
+	}
+	if(lWanted(QStringLiteral("seek"))) {
+		lResults.append(measure(QStringLiteral("seek"), QStringLiteral("seeks"), [this](qint64 &pOperations, qint64 &pBytes) {
+			return readAtRandom(1, pOperations, pBytes);
+		}));
+	}
+	if(lWanted(QStringLiteral("mergedTree"))) {
+		lResults.append(measure(QStringLiteral("mergedTree"), QStringLiteral("nodes"), [this](qint64 &pOperations, qint64 &pBytes) {
+			Q_UNUSED(pBytes)
+			auto lRepository = new MergedRepository(mRepositoryPath, QStringLiteral("kup"));
+			if(!lRepository->open() || !lRepository->readBranch()) {
+				delete lRepository;
+				return false;
+			}
+			// everything File Digger would show when every folder is opened
+			QList<MergedNode *> lNodes;
+			lNodes << lRepository;
+			while(!lNodes.isEmpty()) {
+				MergedNode *lNode = lNodes.takeLast();
+				++pOperations;
+				if(lNode->isDirectory()) {
+					lNodes << lNode->subNodes();
+				}
+			}
+			delete lRepository;
+			return true;
+		}));
+	}
+	if(lWanted(QStringLiteral("metadataDecoding"))) {
+		// the .bupm blobs of all folders of the newest save, read once.
+		QVector<QByteArray> lBlobs;
+		git_repository *lRepository;
+		if(0 == git_repository_open(&lRepository, QFile::encodeName(mRepositoryPath).constData())) {
+			git_object *lTree;
+			if(0 == git_revparse_single(&lTree, lRepository, "refs/heads/kup^{tree}")) {
+				QVector<git_oid> lTrees{*git_object_id(lTree)};
+				while(!lTrees.isEmpty()) {
+					git_oid lOid = lTrees.takeLast();
+					git_tree *lFolder;
+					if(0 != git_tree_lookup(&lFolder, lRepository, &lOid)) {
+						continue;
+					}
+					for(size_t i = 0; i < git_tree_entrycount(lFolder); ++i) {
+						const git_tree_entry *lEntry = git_tree_entry_byindex(lFolder, i);
+						QByteArray lName(git_tree_entry_name(lEntry));
+						if(lName == ".bupm") {
+							lBlobs.append(QByteArray());
+							readBlob(lRepository, git_tree_entry_id(lEntry), lBlobs.last());
+						} else if(git_tree_entry_type(lEntry) == GIT_OBJECT_TREE && !lName.endsWith(".bup")) {
+							lTrees.append(*git_tree_entry_id(lEntry));
+						}
+					}
+					git_tree_free(lFolder);
+				}
+				git_object_free(lTree);
+			}
+			git_repository_free(lRepository);
+		}
+		lResults.append(measure(QStringLiteral("metadataDecoding"), QStringLiteral("records"), [&lBlobs](qint64 &pOperations, qint64 &pBytes) {
+			QVector<Metadata> lMetadataList;
+			for(int lRepeat = 0; lRepeat < 100; ++lRepeat) {
+				foreach(const QByteArray &lBlob, lBlobs) {
+					if(0 != readMetadataList(lBlob.constData(), static_cast<size_t>(lBlob.size()), lMetadataList)) {
+						return false;
+					}
+					pOperations += lMetadataList.count();
+					pBytes += lBlob.size();
+				}
+			}
+			return !lBlobs.isEmpty();
+		}));
+	}
+	return lResults;
+}
+
+QJsonObject Benchmarks::measure(const QString &pName, const QString &pUnit, const Function &pFunction) {
+	QVector<qint64> lTimes;
+	qint64 lOperations = 0, lBytes = 0;
+	bool lOk = true;
+	for(int i = 0; i < mIterations && lOk; ++i) {
+		emptyCaches();
+		lOperations = 0;
+		lBytes = 0;
+		QElapsedTimer lTimer;
+		lTimer.start();
+		lOk = pFunction(lOperations, lBytes);
+		lTimes.append(lTimer.nsecsElapsed());
+	}
+	std::sort(lTimes.begin(), lTimes.end());
+	QJsonObject lResult;
+	lResult[QStringLiteral("name")] = pName;
+	lResult[QStringLiteral("ok")] = lOk;
+	lResult[QStringLiteral("unit")] = pUnit;
+	lResult[QStringLiteral("iterations")] = lTimes.count();
+	lResult[QStringLiteral("operations")] = lOperations;
+	lResult[QStringLiteral("bytes")] = lBytes;
+	lResult[QStringLiteral("bestSeconds")] = lTimes.first() / 1e9;
+	lResult[QStringLiteral("medianSeconds")] = lTimes.at(lTimes.count() / 2) / 1e9;
+	double lBest = qMax<qint64>(1, lTimes.first()) / 1e9;
+	lResult[QStringLiteral("operationsPerSecond")] = lOperations / lBest;
+	if(lBytes > 0) {
+		lResult[QStringLiteral("megabytesPerSecond")] = lBytes / lBest / (1024 * 1024);
+	}
+	return lResult;
+}
+
+bool Benchmarks::prepare() {
+	mRepository = new Repository(nullptr, mRepositoryPath, cNodeCacheBudget);
+	if(!mRepository->isValid()) {
+		return false;
+	}
+	auto lBranch = qobject_cast<Branch *>(mRepository->subNode(QStringLiteral("kup")));
+	if(lBranch == nullptr || lBranch->commits().isEmpty()) {
+		return false;
+	}
+	mNewestCommit = QStringLiteral("kup/") + vfsTimeToString(lBranch->commits().first().mTime);
+	auto lCommit = qobject_cast<ArchivedDirectory *>(mRepository->resolve(mNewestCommit));
+	qint64 lEntries = 0;
+	if(lCommit == nullptr || !listTree(lCommit, mNewestCommit, lEntries, &mFiles) || mFiles.isEmpty()) {
+		return false;
+	}
+	foreach(const QString &lPath, mFiles) {
+		auto lFile = mRepository->resolve(lPath);
+		if(qobject_cast<ChunkFile *>(lFile) != nullptr) {
+			mChunkedFiles.append(lPath);
+		} else if(mSmallFiles.count() < cRandomOperations) {
+			mSmallFiles.append(lPath);
+		}
+	}
+	return true;
+}
+
+void Benchmarks::emptyCaches() {
+	BlobCache::setBudget(0);
+	BlobCache::setBudget(cBlobCacheBudget);
+}
+
+bool Benchmarks::listTree(ArchivedDirectory *pDirectory, const QString &pPath, qint64 &pEntries, QStringList *pFiles) {
+	NodeRange lChildren = pDirectory->children();
+	QStringList lFolders;
+	for(quint32 i = lChildren.mFirst; i < lChildren.mFirst + lChildren.mCount; ++i) {
+		NodeRecord &lRecord = pDirectory->record(i);
+		const QString lPath = pPath + QLatin1Char('/') + pDirectory->string(lRecord.mName);
+		// what listDir() sends for each entry
+		pDirectory->fileSize(lRecord);
+		pDirectory->string(lRecord.mMimeType);
+		++pEntries;
+		if(S_ISDIR(lRecord.mMode)) {
+			lFolders.append(lPath);
+		} else if(pFiles != nullptr) {
+			pFiles->append(lPath);
+		}
+	}
+	foreach(const QString &lPath, lFolders) {
+		auto lFolder = qobject_cast<ArchivedDirectory *>(pDirectory->subNode(lPath.mid(lPath.lastIndexOf(QLatin1Char('/')) + 1)));
+		if(lFolder == nullptr || !listTree(lFolder, lPath, pEntries, pFiles)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Benchmarks::readFiles(const QStringList &pPaths, qint64 pReadSize, qint64 &pOperations, qint64 &pBytes) {
+	foreach(const QString &lPath, pPaths) {
+		auto lFile = qobject_cast<File *>(mRepository->resolve(lPath));
+		if(lFile == nullptr) {
+			return false;
+		}
+		if(lFile->size() == 0) {
+			continue;
+		}
+		if(0 != lFile->seek(0)) {
+			return false;
+		}
+		QByteArray lData;
+		int lResult;
+		while(0 == (lResult = lFile->read(lData, pReadSize))) {
+			pBytes += lData.size();
+			++pOperations;
+		}
+		lFile->stopReading();
+		if(lResult != KIO::ERR_NO_CONTENT) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Reads pReadSize bytes from random places in the chunked files, the way a
+// video player or an archive viewer jumps around in a file.
+bool Benchmarks::readAtRandom(qint64 pReadSize, qint64 &pOperations, qint64 &pBytes) {
+	if(mChunkedFiles.isEmpty()) {
+		return false;
+	}
+	std::uniform_int_distribution<int> lPickFile(0, mChunkedFiles.count() - 1);
+	for(int i = 0; i < cRandomOperations; ++i) {
+		auto lFile = qobject_cast<File *>(mRepository->resolve(mChunkedFiles.at(lPickFile(mRandom))));
+		if(lFile == nullptr || lFile->size() == 0) {
+			return false;
+		}
+		std::uniform_int_distribution<quint64> lPickOffset(0, lFile->size() - 1);
+		if(0 != lFile->seek(lPickOffset(mRandom))) {
+			return false;
+		}
+		qint64 lRemaining = pReadSize;
+		QByteArray lData;
+		while(lRemaining > 0 && 0 == lFile->read(lData, lRemaining)) {
+			lRemaining -= lData.size();
+			pBytes += lData.size();
+		}
+		lFile->stopReading();
+		++pOperations;
+	}
+	return true;
+}
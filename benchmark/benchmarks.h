@@ -0,0 +1,51 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+#include <random>
+
+class ArchivedDirectory;
+class Repository;
+
+// Runs the reading code of kio_bup and File Digger against a repository, in
+// process, with the settings kio_bup uses by default. Each benchmark runs a
+// number of times with the caches emptied in between, the fastest and the
+// median run are reported.
+class Benchmarks {
+public:
+	Benchmarks(const QString &pRepositoryPath, int pIterations, quint32 pSeed);
+	~Benchmarks();
+	static QStringList names();
+	// all of them if pNames is empty
+	QJsonArray run(const QStringList &pNames);
+
+protected:
+	// Returns how many operations and bytes one run handled.
+	typedef std::function<bool(qint64 &pOperations, qint64 &pBytes)> Function;
+	QJsonObject measure(const QString &pName, const QString &pUnit, const Function &pFunction);
+	bool prepare();
+	void emptyCaches();
+	bool listTree(ArchivedDirectory *pDirectory, const QString &pPath, qint64 &pEntries, QStringList *pFiles);
+	bool readFiles(const QStringList &pPaths, qint64 pReadSize, qint64 &pOperations, qint64 &pBytes);
+	bool readAtRandom(qint64 pReadSize, qint64 &pOperations, qint64 &pBytes);
+
+	QString mRepositoryPath;
+	int mIterations;
+	std::mt19937 mRandom;
+	Repository *mRepository; // for the benchmarks that run with warm node caches
+	QString mNewestCommit; // path of the newest commit folder
+	QStringList mFiles; // paths of all files in the newest commit
+	QStringList mChunkedFiles;
+	QStringList mSmallFiles;
+};
+
+#endif // BENCHMARKS_H
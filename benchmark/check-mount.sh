@@ -0,0 +1,24 @@
+#!/bin/sh
+# SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+# Generates a small repository, mounts it with kup-mount and compares the
+# files read through the mount with the content in the repository.
+# Usage: check-mount.sh <kup-benchmark> <kup-mount> <work folder>
+
+set -e
+BENCHMARK=$1
+MOUNT=$2
+WORK=$3
+
+rm -rf "$WORK"
+mkdir -p "$WORK/mount"
+# small, but with chunked files and chunk trees more than one level deep
+"$BENCHMARK" --generate-only --saves 3 --depth 1 --folders 2 --files 10 \
+	--chunked-share 0.3 --chunked-size 1048576 --chunk-size 4096 --fanout 4 \
+	"$WORK/repository"
+"$MOUNT" "$WORK/repository" "$WORK/mount"
+trap 'fusermount3 -u "$WORK/mount"' EXIT
+"$BENCHMARK" --check-mount "$WORK/mount" "$WORK/repository"
+echo "kup-mount check passed"
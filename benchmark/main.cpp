@@ -0,0 +1,179 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "benchmarks.h"
+#include "blobcache.h"
+#include "bupvfs.h"
+#include "mountcheck.h"
+#include "repositorygenerator.h"
+#include "sha1.h"
+
+#include <git2/global.h>
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTextStream>
+
+// Written into the generated repository, so that results from an existing
+// one can say how it was made.
+static const char cParametersFile[] = "kup-benchmark.json";
+
+struct GeneratorOption {
+	const char *mName;
+	const char *mDescription;
+	double RepositoryGenerator::Parameters::*mDouble;
+	int RepositoryGenerator::Parameters::*mInt;
+	qint64 RepositoryGenerator::Parameters::*mInt64;
+};
+
+static const GeneratorOption cGeneratorOptions[] = {
+	{"saves", "Number of saves.", nullptr, &RepositoryGenerator::Parameters::mSaves, nullptr},
+	{"depth", "Levels of folders below the root.", nullptr, &RepositoryGenerator::Parameters::mDepth, nullptr},
+	{"folders", "Folders in each folder.", nullptr, &RepositoryGenerator::Parameters::mFoldersPerFolder, nullptr},
+	{"files", "Files in each folder.", nullptr, &RepositoryGenerator::Parameters::mFilesPerFolder, nullptr},
+	{"file-size", "Average size of files that are not chunked, in bytes.", nullptr, nullptr,
+	 &RepositoryGenerator::Parameters::mFileSize},
+	{"chunked-share", "Share of the files that are big enough to be chunked, 0 to 1.",
+	 &RepositoryGenerator::Parameters::mChunkedShare, nullptr, nullptr},
+	{"chunked-size", "Size of chunked files, in bytes.", nullptr, nullptr, &RepositoryGenerator::Parameters::mChunkedFileSize},
+	{"chunk-size", "Average size of chunks, in bytes.", nullptr, &RepositoryGenerator::Parameters::mChunkSize, nullptr},
+	{"fanout", "Entries in each tree of chunks.", nullptr, &RepositoryGenerator::Parameters::mFanout, nullptr},
+	{"churn", "Share of the files changed between saves, 0 to 1.", &RepositoryGenerator::Parameters::mChurn, nullptr, nullptr},
+	{"metadata-version", "Version of the common metadata records in .bupm, 1 to 3.", nullptr,
+	 &RepositoryGenerator::Parameters::mMetadataVersion, nullptr},
+};
+
+int main(int pArgCount, char **pArgArray) {
+	QCoreApplication lApp(pArgCount, pArgArray);
+	QCoreApplication::setApplicationName(QStringLiteral("kup-benchmark"));
+
+	QCommandLineParser lParser;
+	lParser.setApplicationDescription(QStringLiteral(
+	   "Measures how fast bup repositories are read by kio_bup and File Digger. A repository with made up "
+	   "content is generated first if the given path does not exist. Results are written as JSON."));
+	lParser.addHelpOption();
+	RepositoryGenerator::Parameters lParameters;
+	for(const GeneratorOption &lOption: cGeneratorOptions) {
+		QString lDefault = lOption.mDouble != nullptr ? QString::number(lParameters.*lOption.mDouble)
+		                 : lOption.mInt != nullptr ? QString::number(lParameters.*lOption.mInt)
+		                                           : QString::number(lParameters.*lOption.mInt64);
+		lParser.addOption(QCommandLineOption(QLatin1String(lOption.mName), QLatin1String(lOption.mDescription),
+		                                     QStringLiteral("value"), lDefault));
+	}
+	lParser.addOption(QCommandLineOption(QStringLiteral("seed"), QStringLiteral("Seed for everything made up or picked at random."),
+	                                     QStringLiteral("value"), QStringLiteral("1")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("generate-only"), QStringLiteral("Only generate the repository.")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("check-mount"),
+	                                     QStringLiteral("Instead of measuring, check that kup-mount serves the newest save of the "
+	                                                    "repository correctly at this mount point."),
+	                                     QStringLiteral("mount point")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("benchmark"),
+	                                     QStringLiteral("Run only this benchmark, can be given more than once. One of %1.")
+	                                     .arg(Benchmarks::names().join(QStringLiteral(", "))),
+	                                     QStringLiteral("name")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("iterations"), QStringLiteral("Runs of each benchmark."),
+	                                     QStringLiteral("count"), QStringLiteral("5")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("read-ahead"), QStringLiteral("Chunks to read ahead, as ReadAheadChunks in kio_buprc."),
+	                                     QStringLiteral("count"), QStringLiteral("8")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("no-verify"), QStringLiteral("Leave checking content against the blob ids to libgit2, as VerifyContent=false in kio_buprc.")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("output"), QStringLiteral("File to write the results to, instead of standard output."),
+	                                     QStringLiteral("file")));
+	lParser.addPositionalArgument(QStringLiteral("<repository path>"), QStringLiteral("The bup repository to measure."));
+	lParser.process(lApp);
+	if(lParser.positionalArguments().count() != 1) {
+		lParser.showHelp(1);
+	}
+
+	for(const GeneratorOption &lOption: cGeneratorOptions) {
+		const QString lValue = lParser.value(QLatin1String(lOption.mName));
+		if(lOption.mDouble != nullptr) {
+			lParameters.*lOption.mDouble = lValue.toDouble();
+		} else if(lOption.mInt != nullptr) {
+			lParameters.*lOption.mInt = lValue.toInt();
+		} else {
+			lParameters.*lOption.mInt64 = lValue.toLongLong();
+		}
+	}
+	lParameters.mSeed = lParser.value(QStringLiteral("seed")).toUInt();
+	const QString lRepositoryPath = QDir(lParser.positionalArguments().first()).absolutePath();
+	QTextStream lErrors(stderr);
+
+	// This needs to be called first thing, before any other calls to libgit2.
+	git_libgit2_init();
+	int lRetVal = 0;
+	QJsonObject lOutput;
+	lOutput[QStringLiteral("format")] = 1;
+	lOutput[QStringLiteral("repository")] = lRepositoryPath;
+	if(!QFile::exists(lRepositoryPath)) {
+		lErrors << "generating " << lRepositoryPath << endl;
+		RepositoryGenerator lGenerator(lParameters);
+		if(!lGenerator.generate(lRepositoryPath)) {
+			lErrors << lGenerator.errorString() << endl;
+			lRetVal = 1;
+		} else {
+			QFile lFile(QDir(lRepositoryPath).filePath(QLatin1String(cParametersFile)));
+			if(lFile.open(QIODevice::WriteOnly)) {
+				lFile.write(QJsonDocument(lParameters.toJson()).toJson());
+			}
+		}
+	}
+	if(lRetVal == 0 && lParser.isSet(QStringLiteral("check-mount"))) {
+		MountCheck lCheck(lRepositoryPath, QDir(lParser.value(QStringLiteral("check-mount"))).absolutePath(),
+		                  lParameters.mSeed, lErrors);
+		if(!lCheck.run()) {
+			lRetVal = 1;
+		}
+	} else if(lRetVal == 0 && !lParser.isSet(QStringLiteral("generate-only"))) {
+		QFile lFile(QDir(lRepositoryPath).filePath(QLatin1String(cParametersFile)));
+		if(lFile.open(QIODevice::ReadOnly)) {
+			lOutput[QStringLiteral("generator")] = QJsonDocument::fromJson(lFile.readAll()).object();
+		}
+		int lMajor, lMinor, lRevision;
+		git_libgit2_version(&lMajor, &lMinor, &lRevision);
+		QJsonObject lSettings;
+		lSettings[QStringLiteral("libgit2")] = QStringLiteral("%1.%2.%3").arg(lMajor).arg(lMinor).arg(lRevision);
+		lSettings[QStringLiteral("sha1Extensions")] = Sha1::hardwareAccelerated();
+		lSettings[QStringLiteral("readAhead")] = lParser.value(QStringLiteral("read-ahead")).toInt();
+		lSettings[QStringLiteral("verify")] = !lParser.isSet(QStringLiteral("no-verify"));
+		lSettings[QStringLiteral("time")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+		lOutput[QStringLiteral("settings")] = lSettings;
+
+		// as set up in kio_bup
+		ChunkFile::mReadAheadWindow = lParser.value(QStringLiteral("read-ahead")).toInt();
+		BlobCache::mVerify = !lParser.isSet(QStringLiteral("no-verify"));
+
+		{
+			Benchmarks lBenchmarks(lRepositoryPath, lParser.value(QStringLiteral("iterations")).toInt(), lParameters.mSeed);
+			QJsonArray lResults = lBenchmarks.run(lParser.values(QStringLiteral("benchmark")));
+			if(lResults.isEmpty()) {
+				lErrors << lRepositoryPath << " is not a bup repository with a kup branch" << endl;
+				lRetVal = 1;
+			}
+			foreach(const QJsonValue &lResult, lResults) {
+				if(!lResult.toObject().value(QStringLiteral("ok")).toBool()) {
+					lRetVal = 1;
+				}
+			}
+			lOutput[QStringLiteral("results")] = lResults;
+		}
+
+		const QByteArray lJson = QJsonDocument(lOutput).toJson();
+		if(lParser.isSet(QStringLiteral("output"))) {
+			QFile lFile(lParser.value(QStringLiteral("output")));
+			if(!lFile.open(QIODevice::WriteOnly) || lFile.write(lJson) != lJson.size()) {
+				lErrors << "could not write " << lFile.fileName() << endl;
+				lRetVal = 1;
+			}
+		} else {
+			QTextStream(stdout) << lJson;
+		}
+	}
+	git_libgit2_shutdown();
+	return lRetVal;
+}
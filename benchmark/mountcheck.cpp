@@ -0,0 +1,166 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "mountcheck.h"
+#include "vfshelpers.h"
+
+#include <QFile>
+#include <QPair>
+#include <QVector>
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Reads done in the order a copy would, then at random places.
+static const int cSequentialReadSize = 64 * 1024;
+static const int cRandomReads = 16;
+static const int cMaxRandomReadSize = 200 * 1024;
+
+MountCheck::MountCheck(const QString &pRepositoryPath, const QString &pMountPath, quint32 pSeed, QTextStream &pErrors)
+   : mRepositoryPath(pRepositoryPath), mMountPath(pMountPath), mRandom(pSeed), mErrors(pErrors),
+     mRepository(nullptr), mFileCount(0)
+{}
+
+bool MountCheck::run() {
+	if(0 != git_repository_open(&mRepository, QFile::encodeName(mRepositoryPath).constData())) {
+		mErrors << mRepositoryPath << " is not a bup repository" << endl;
+		return false;
+	}
+	bool lOk = false;
+	git_commit *lCommit;
+	git_oid lHead;
+	if(0 != git_reference_name_to_id(&lHead, mRepository, "refs/heads/kup") ||
+	      0 != git_commit_lookup(&lCommit, mRepository, &lHead)) {
+		mErrors << mRepositoryPath << " has no kup branch" << endl;
+	} else {
+		// laid out like kio_bup shows it
+		const QString lCommitPath = mMountPath + QStringLiteral("/kup/") + vfsTimeToString(git_commit_time(lCommit));
+		lOk = checkFolder(git_commit_tree_id(lCommit), lCommitPath);
+		git_commit_free(lCommit);
+	}
+	if(lOk && mFileCount == 0) {
+		mErrors << "no files found in the newest save" << endl;
+		lOk = false;
+	}
+	if(QFile::exists(repositoryCachePath(mRepository))) {
+		mErrors << repositoryCachePath(mRepository) << " was written while mounted" << endl;
+		lOk = false;
+	}
+	git_repository_free(mRepository);
+	mRepository = nullptr;
+	return lOk;
+}
+
+bool MountCheck::checkFolder(const git_oid *pTree, const QString &pPath) {
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, mRepository, pTree)) {
+		mErrors << "could not read the folder for " << pPath << endl;
+		return false;
+	}
+	bool lOk = true;
+	for(size_t i = 0; i < git_tree_entrycount(lTree) && lOk; ++i) {
+		uint lMode;
+		bool lChunked;
+		const git_oid *lOid;
+		QString lName;
+		getEntryAttributes(git_tree_entry_byindex(lTree, i), lMode, lChunked, lOid, lName);
+		if(lName == QStringLiteral(".bupm")) {
+			continue;
+		}
+		const QString lPath = pPath + QLatin1Char('/') + lName;
+		if(S_ISDIR(lMode)) {
+			lOk = checkFolder(lOid, lPath);
+			continue;
+		}
+		QByteArray lContent;
+		if(lChunked ? !readChunkTree(lOid, lContent) : !readBlob(mRepository, lOid, lContent)) {
+			mErrors << "could not read the content of " << lPath << " from the repository" << endl;
+			lOk = false;
+		} else {
+			lOk = checkFile(lPath, lContent);
+			++mFileCount;
+		}
+	}
+	git_tree_free(lTree);
+	return lOk;
+}
+
+bool MountCheck::checkFile(const QString &pPath, const QByteArray &pContent) {
+	int lFd = open(QFile::encodeName(pPath).constData(), O_RDONLY);
+	if(lFd < 0) {
+		mErrors << "could not open " << pPath << endl;
+		return false;
+	}
+	// whole ranges, plus one past the end that must read nothing
+	QVector<QPair<qint64, qint64>> lReads;
+	for(qint64 lOffset = 0; lOffset < pContent.size(); lOffset += cSequentialReadSize) {
+		lReads.append(qMakePair(lOffset, static_cast<qint64>(cSequentialReadSize)));
+	}
+	if(pContent.size() > 0) {
+		std::uniform_int_distribution<qint64> lPickOffset(0, pContent.size() - 1);
+		std::uniform_int_distribution<qint64> lPickSize(1, cMaxRandomReadSize);
+		for(int i = 0; i < cRandomReads; ++i) {
+			lReads.append(qMakePair(lPickOffset(mRandom), lPickSize(mRandom)));
+		}
+	}
+	lReads.append(qMakePair(static_cast<qint64>(pContent.size()), static_cast<qint64>(cSequentialReadSize)));
+
+	bool lOk = true;
+	QByteArray lBuffer;
+	foreach(const auto &lRead, lReads) {
+		lBuffer.resize(static_cast<int>(lRead.second));
+		const qint64 lExpected = qMin(lRead.second, pContent.size() - lRead.first);
+		qint64 lDone = 0;
+		ssize_t lResult;
+		// a short read is allowed, the rest comes with the next one
+		while(lDone < lExpected && (lResult = pread(lFd, lBuffer.data() + lDone, static_cast<size_t>(lRead.second - lDone),
+		                                            lRead.first + lDone)) > 0) {
+			lDone += lResult;
+		}
+		if(lDone != lExpected || 0 != memcmp(lBuffer.constData(), pContent.constData() + lRead.first, static_cast<size_t>(lDone))) {
+			mErrors << pPath << ": wrong content read at offset " << lRead.first << ", " << lDone << " of "
+			        << lExpected << " bytes" << endl;
+			lOk = false;
+			break;
+		}
+	}
+	close(lFd);
+	return lOk;
+}
+
+// The blobs of a chunk tree in the order of their offsets, independent of how
+// kup itself finds them.
+bool MountCheck::readChunkTree(const git_oid *pTree, QByteArray &pContent) {
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, mRepository, pTree)) {
+		return false;
+	}
+	QVector<QPair<quint64, const git_tree_entry *>> lEntries;
+	bool lOk = true;
+	for(size_t i = 0; i < git_tree_entrycount(lTree) && lOk; ++i) {
+		const git_tree_entry *lEntry = git_tree_entry_byindex(lTree, i);
+		quint64 lOffset = 0;
+		lOk = offsetFromName(lEntry, lOffset);
+		lEntries.append(qMakePair(lOffset, lEntry));
+	}
+	std::sort(lEntries.begin(), lEntries.end(), [](const QPair<quint64, const git_tree_entry *> &a,
+	                                               const QPair<quint64, const git_tree_entry *> &b) {
+		return a.first < b.first;
+	});
+	for(int i = 0; i < lEntries.count() && lOk; ++i) {
+		const git_tree_entry *lEntry = lEntries.at(i).second;
+		if(S_ISDIR(git_tree_entry_filemode(lEntry))) {
+			lOk = readChunkTree(git_tree_entry_id(lEntry), pContent);
+		} else {
+			QByteArray lBlob;
+			lOk = readBlob(mRepository, git_tree_entry_id(lEntry), lBlob);
+			pContent.append(lBlob);
+		}
+	}
+	git_tree_free(lTree);
+	return lOk;
+}
@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef MOUNTCHECK_H
+#define MOUNTCHECK_H
+
+#include <QString>
+#include <QTextStream>
+
+#include <git2.h>
+
+#include <random>
+
+// Compares what kup-mount serves for the newest save with the content put
+// together straight from the objects in the repository. Every file is read
+// from start to end and at random places with pread(), and the repository
+// must not have a kup-cache folder afterwards.
+class MountCheck {
+public:
+	MountCheck(const QString &pRepositoryPath, const QString &pMountPath, quint32 pSeed, QTextStream &pErrors);
+	bool run();
+
+protected:
+	bool checkFolder(const git_oid *pTree, const QString &pPath);
+	bool checkFile(const QString &pPath, const QByteArray &pContent);
+	bool readChunkTree(const git_oid *pTree, QByteArray &pContent);
+
+	QString mRepositoryPath;
+	QString mMountPath;
+	std::mt19937 mRandom;
+	QTextStream &mErrors;
+	git_repository *mRepository;
+	int mFileCount;
+};
+
+#endif // MOUNTCHECK_H
@@ -0,0 +1,404 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "repositorygenerator.h"
+#include "vfshelpers.h"
+
+#include <QFile>
+#include <QHash>
+#include <QtEndian>
+
+#include <git2/sys/mempack.h>
+
+#include <sys/stat.h>
+
+static const qint64 cFirstSaveTime = 1577836800; // 2020-01-01
+static const qint64 cTimeBetweenSaves = 24 * 60 * 60;
+static const int cRecordEnd = 0;
+static const int cRecordCommonV1 = 2;
+static const int cRecordCommonV2 = 9;
+static const int cRecordCommonV3 = 10;
+
+namespace {
+
+void appendVuint(QByteArray &pData, quint64 pValue) {
+	do {
+		uchar c = pValue & 0x7F;
+		pValue >>= 7;
+		if(pValue != 0) {
+			c |= 0x80;
+		}
+		pData.append(static_cast<char>(c));
+	} while(pValue != 0);
+}
+
+void appendVint(QByteArray &pData, qint64 pValue) {
+	quint64 lValue = pValue < 0 ? static_cast<quint64>(-pValue) : static_cast<quint64>(pValue);
+	uchar c = lValue & 0x3F;
+	if(pValue < 0) {
+		c |= 0x40;
+	}
+	lValue >>= 6;
+	if(lValue != 0) {
+		c |= 0x80;
+	}
+	pData.append(static_cast<char>(c));
+	if(lValue != 0) {
+		appendVuint(pData, lValue);
+	}
+}
+
+void appendBytes(QByteArray &pData, const QByteArray &pBytes) {
+	appendVuint(pData, static_cast<quint64>(pBytes.size()));
+	pData.append(pBytes);
+}
+
+QByteArray offsetName(qint64 pOffset) {
+	return QByteArray::number(pOffset, 16).rightJustified(16, '0');
+}
+
+} // namespace
+
+QJsonObject RepositoryGenerator::Parameters::toJson() const {
+	QJsonObject lObject;
+	lObject[QStringLiteral("saves")] = mSaves;
+	lObject[QStringLiteral("depth")] = mDepth;
+	lObject[QStringLiteral("foldersPerFolder")] = mFoldersPerFolder;
+	lObject[QStringLiteral("filesPerFolder")] = mFilesPerFolder;
+	lObject[QStringLiteral("fileSize")] = mFileSize;
+	lObject[QStringLiteral("chunkedShare")] = mChunkedShare;
+	lObject[QStringLiteral("chunkedFileSize")] = mChunkedFileSize;
+	lObject[QStringLiteral("chunkSize")] = mChunkSize;
+	lObject[QStringLiteral("fanout")] = mFanout;
+	lObject[QStringLiteral("churn")] = mChurn;
+	lObject[QStringLiteral("metadataVersion")] = mMetadataVersion;
+	lObject[QStringLiteral("seed")] = static_cast<qint64>(mSeed);
+	return lObject;
+}
+
+RepositoryGenerator::RepositoryGenerator(const Parameters &pParameters)
+   : mParameters(pParameters), mRandom(pParameters.mSeed), mRepository(nullptr), mOdb(nullptr),
+     mMemoryBackend(nullptr)
+{
+	mParameters.mFanout = qMax(2, mParameters.mFanout);
+	mParameters.mChunkSize = qMax(64, mParameters.mChunkSize);
+	mParameters.mChunkedFileSize = qMax<qint64>(1, mParameters.mChunkedFileSize);
+	mParameters.mMetadataVersion = qBound(1, mParameters.mMetadataVersion, 3);
+	// Content is cut from here at random offsets, every blob gets a serial
+	// number in front to keep them all distinct.
+	auto lLargest = static_cast<int>(2 * qMax<qint64>(mParameters.mFileSize, mParameters.mChunkSize));
+	mContent.resize(1024 * 1024 + lLargest);
+	for(int i = 0; i < mContent.size(); ++i) {
+		mContent[i] = static_cast<char>(mRandom() & 0xFF);
+	}
+}
+
+RepositoryGenerator::~RepositoryGenerator() {
+	git_odb_free(mOdb);
+	git_repository_free(mRepository);
+}
+
+bool RepositoryGenerator::generate(const QString &pPath) {
+	if(QFile::exists(pPath)) {
+		return fail(QStringLiteral("%1 exists already").arg(pPath));
+	}
+	if(0 != git_repository_init(&mRepository, QFile::encodeName(pPath).constData(), 1) ||
+	      0 != git_repository_odb(&mOdb, mRepository) ||
+	      0 != git_mempack_new(&mMemoryBackend) ||
+	      0 != git_odb_add_backend(mOdb, mMemoryBackend, 1000)) {
+		return fail(QStringLiteral("could not create repository"));
+	}
+	// nothing written refers to anything missing, no need to look.
+	git_libgit2_opts(GIT_OPT_ENABLE_STRICT_OBJECT_CREATION, 0);
+
+	FolderModel lRoot;
+	if(!createFolder(lRoot, QString(), 0, cFirstSaveTime)) {
+		return false;
+	}
+	git_oid lParent;
+	for(int i = 0; i < mParameters.mSaves; ++i) {
+		qint64 lTime = cFirstSaveTime + i * cTimeBetweenSaves;
+		if(i > 0 && !changeFiles(lRoot, lTime)) {
+			return false;
+		}
+		if(!writeFolder(lRoot)) {
+			return false;
+		}
+		git_tree *lTree;
+		git_signature *lSignature;
+		git_commit *lParentCommit = nullptr;
+		if(0 != git_tree_lookup(&lTree, mRepository, &lRoot.mTree)) {
+			return fail(QStringLiteral("could not read back root tree"));
+		}
+		if(i > 0 && 0 != git_commit_lookup(&lParentCommit, mRepository, &lParent)) {
+			git_tree_free(lTree);
+			return fail(QStringLiteral("could not read back commit"));
+		}
+		git_signature_new(&lSignature, "kup-benchmark", "kup-benchmark@localhost", lTime, 0);
+		const git_commit *lParents[] = {lParentCommit};
+		int lResult = git_commit_create(&lParent, mRepository, "refs/heads/kup", lSignature, lSignature, nullptr,
+		                                "bup save\n", lTree, i > 0 ? 1 : 0, lParents);
+		git_signature_free(lSignature);
+		git_commit_free(lParentCommit);
+		git_tree_free(lTree);
+		if(lResult != 0) {
+			return fail(QStringLiteral("could not create commit"));
+		}
+		if(!writePack()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool RepositoryGenerator::createFolder(FolderModel &pFolder, const QString &pName, int pLevel, qint64 pTime) {
+	pFolder.mName = pName;
+	pFolder.mMtime = pTime;
+	pFolder.mChanged = true;
+	std::bernoulli_distribution lChunked(mParameters.mChunkedShare);
+	pFolder.mFiles.resize(mParameters.mFilesPerFolder);
+	for(int i = 0; i < pFolder.mFiles.count(); ++i) {
+		FileModel &lFile = pFolder.mFiles[i];
+		lFile.mChunked = lChunked(mRandom);
+		lFile.mName = QStringLiteral("file%1.%2").arg(i).arg(lFile.mChunked ? QStringLiteral("img") : QStringLiteral("txt"));
+		if(!createFile(lFile, pTime)) {
+			return false;
+		}
+	}
+	if(pLevel < mParameters.mDepth) {
+		pFolder.mFolders.resize(mParameters.mFoldersPerFolder);
+		for(int i = 0; i < pFolder.mFolders.count(); ++i) {
+			if(!createFolder(pFolder.mFolders[i], QStringLiteral("folder%1").arg(i), pLevel + 1, pTime)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool RepositoryGenerator::createFile(FileModel &pFile, qint64 pTime) {
+	pFile.mMtime = pTime;
+	if(!pFile.mChunked) {
+		std::uniform_int_distribution<qint64> lSize(0, 2 * mParameters.mFileSize);
+		pFile.mSize = lSize(mRandom);
+		return writeBlob(pFile.mSize, pFile.mOid);
+	}
+	std::uniform_int_distribution<qint64> lChunkSize(mParameters.mChunkSize / 2, mParameters.mChunkSize * 3 / 2);
+	pFile.mChunks.clear();
+	pFile.mChunkSizes.clear();
+	pFile.mSize = 0;
+	while(pFile.mSize < mParameters.mChunkedFileSize) {
+		qint64 lSize = qMin(lChunkSize(mRandom), mParameters.mChunkedFileSize - pFile.mSize);
+		git_oid lOid;
+		if(!writeBlob(lSize, lOid)) {
+			return false;
+		}
+		pFile.mChunks.append(lOid);
+		pFile.mChunkSizes.append(lSize);
+		pFile.mSize += lSize;
+	}
+	return writeChunkTree(pFile);
+}
+
+bool RepositoryGenerator::changeFile(FileModel &pFile, qint64 pTime) {
+	if(!pFile.mChunked || pFile.mChunks.isEmpty()) {
+		return createFile(pFile, pTime);
+	}
+	// like an edit in the middle of a big file, the other chunks stay the same.
+	std::uniform_int_distribution<int> lChunk(0, pFile.mChunks.count() - 1);
+	int lIndex = lChunk(mRandom);
+	pFile.mMtime = pTime;
+	return writeBlob(pFile.mChunkSizes.at(lIndex), pFile.mChunks[lIndex]) && writeChunkTree(pFile);
+}
+
+bool RepositoryGenerator::changeFiles(FolderModel &pFolder, qint64 pTime) {
+	std::bernoulli_distribution lChange(mParameters.mChurn);
+	for(int i = 0; i < pFolder.mFiles.count(); ++i) {
+		if(lChange(mRandom)) {
+			if(!changeFile(pFolder.mFiles[i], pTime)) {
+				return false;
+			}
+			pFolder.mChanged = true;
+			pFolder.mMtime = pTime;
+		}
+	}
+	for(int i = 0; i < pFolder.mFolders.count(); ++i) {
+		if(!changeFiles(pFolder.mFolders[i], pTime)) {
+			return false;
+		}
+		pFolder.mChanged |= pFolder.mFolders.at(i).mChanged;
+	}
+	return true;
+}
+
+bool RepositoryGenerator::writeBlob(qint64 pSize, git_oid &pOid) {
+	static quint64 sSerial = 0;
+	std::uniform_int_distribution<int> lOffset(0, mContent.size() - static_cast<int>(pSize) - 1);
+	QByteArray lData(8, Qt::Uninitialized);
+	qToLittleEndian<quint64>(++sSerial, lData.data());
+	lData.append(mContent.constData() + lOffset(mRandom), static_cast<int>(qMax<qint64>(0, pSize - 8)));
+	lData.truncate(static_cast<int>(pSize));
+	if(0 != git_blob_create_frombuffer(&pOid, mRepository, lData.constData(), static_cast<size_t>(lData.size()))) {
+		return fail(QStringLiteral("could not write blob"));
+	}
+	return true;
+}
+
+bool RepositoryGenerator::writeChunkTree(FileModel &pFile) {
+	QVector<git_oid> lOids = pFile.mChunks;
+	QVector<qint64> lSizes = pFile.mChunkSizes;
+	bool lTrees = false;
+	do {
+		QVector<git_oid> lParentOids;
+		QVector<qint64> lParentSizes;
+		if(!writeChunkLevel(lOids, lSizes, lTrees, lParentOids, lParentSizes)) {
+			return false;
+		}
+		lOids = lParentOids;
+		lSizes = lParentSizes;
+		lTrees = true;
+	} while(lOids.count() > 1);
+	pFile.mOid = lOids.first();
+	return true;
+}
+
+// Groups the chunks, or chunk trees, into trees of mFanout entries. Entries
+// are named by their offset from the start of the tree, in hex.
+bool RepositoryGenerator::writeChunkLevel(const QVector<git_oid> &pOids, const QVector<qint64> &pSizes, bool pTrees,
+                                          QVector<git_oid> &pParentOids, QVector<qint64> &pParentSizes) {
+	for(int lFirst = 0; lFirst < pOids.count(); lFirst += mParameters.mFanout) {
+		git_treebuilder *lBuilder;
+		if(0 != git_treebuilder_new(&lBuilder, mRepository, nullptr)) {
+			return fail(QStringLiteral("could not create tree builder"));
+		}
+		qint64 lOffset = 0;
+		for(int i = lFirst; i < qMin(pOids.count(), lFirst + mParameters.mFanout); ++i) {
+			git_treebuilder_insert(nullptr, lBuilder, offsetName(lOffset).constData(), &pOids.at(i),
+			                       pTrees ? GIT_FILEMODE_TREE : GIT_FILEMODE_BLOB);
+			lOffset += pSizes.at(i);
+		}
+		git_oid lOid;
+		int lResult = git_treebuilder_write(&lOid, lBuilder);
+		git_treebuilder_free(lBuilder);
+		if(lResult != 0) {
+			return fail(QStringLiteral("could not write chunk tree"));
+		}
+		pParentOids.append(lOid);
+		pParentSizes.append(lOffset);
+	}
+	return true;
+}
+
+bool RepositoryGenerator::writeFolder(FolderModel &pFolder) {
+	if(!pFolder.mChanged) {
+		return true;
+	}
+	for(int i = 0; i < pFolder.mFolders.count(); ++i) {
+		if(!writeFolder(pFolder.mFolders[i])) {
+			return false;
+		}
+	}
+
+	git_treebuilder *lBuilder;
+	if(0 != git_treebuilder_new(&lBuilder, mRepository, nullptr)) {
+		return fail(QStringLiteral("could not create tree builder"));
+	}
+	QHash<QString, const FileModel *> lFiles;
+	foreach(const FolderModel &lFolder, pFolder.mFolders) {
+		git_treebuilder_insert(nullptr, lBuilder, lFolder.mName.toUtf8().constData(), &lFolder.mTree, GIT_FILEMODE_TREE);
+	}
+	foreach(const FileModel &lFile, pFolder.mFiles) {
+		QString lName = lFile.mChunked ? lFile.mName + QStringLiteral(".bup") : lFile.mName;
+		git_treebuilder_insert(nullptr, lBuilder, lName.toUtf8().constData(), &lFile.mOid,
+		                       lFile.mChunked ? GIT_FILEMODE_TREE : GIT_FILEMODE_BLOB);
+		lFiles.insert(lName, &lFile);
+	}
+	// .bupm has one entry for the folder, then one for each file in the
+	// order of the tree, which the tree builder knows.
+	git_oid lOid;
+	git_tree *lTree;
+	if(0 != git_treebuilder_write(&lOid, lBuilder) || 0 != git_tree_lookup(&lTree, mRepository, &lOid)) {
+		git_treebuilder_free(lBuilder);
+		return fail(QStringLiteral("could not write folder tree"));
+	}
+	QByteArray lMetadata = metadataRecord(DEFAULT_MODE_DIRECTORY, 0, pFolder.mMtime);
+	for(size_t i = 0; i < git_tree_entrycount(lTree); ++i) {
+		const FileModel *lFile = lFiles.value(QString::fromUtf8(git_tree_entry_name(git_tree_entry_byindex(lTree, i))));
+		if(lFile != nullptr) {
+			lMetadata.append(metadataRecord(DEFAULT_MODE_FILE, lFile->mSize, lFile->mMtime));
+		}
+	}
+	git_tree_free(lTree);
+	if(0 != git_blob_create_frombuffer(&lOid, mRepository, lMetadata.constData(), static_cast<size_t>(lMetadata.size()))) {
+		git_treebuilder_free(lBuilder);
+		return fail(QStringLiteral("could not write .bupm"));
+	}
+	git_treebuilder_insert(nullptr, lBuilder, ".bupm", &lOid, GIT_FILEMODE_BLOB);
+	int lResult = git_treebuilder_write(&pFolder.mTree, lBuilder);
+	git_treebuilder_free(lBuilder);
+	if(lResult != 0) {
+		return fail(QStringLiteral("could not write folder tree"));
+	}
+	pFolder.mChanged = false;
+	return true;
+}
+
+QByteArray RepositoryGenerator::metadataRecord(qint64 pMode, qint64 pSize, qint64 pMtime) const {
+	QByteArray lRecord;
+	const QByteArray lUser("user"), lGroup("users");
+	if(mParameters.mMetadataVersion == 1) {
+		appendVuint(lRecord, static_cast<quint64>(pMode));
+		appendVuint(lRecord, 1000);
+		appendBytes(lRecord, lUser);
+		appendVuint(lRecord, 100);
+		appendBytes(lRecord, lGroup);
+	} else {
+		appendVint(lRecord, pMode);
+		appendVint(lRecord, 1000);
+		appendBytes(lRecord, lUser);
+		appendVint(lRecord, 100);
+		appendBytes(lRecord, lGroup);
+	}
+	appendVint(lRecord, 0); // device
+	for(int i = 0; i < 3; ++i) { // access, modification and status change time
+		appendVint(lRecord, pMtime);
+		appendVint(lRecord, 0); // nanoseconds
+	}
+	if(mParameters.mMetadataVersion == 3) {
+		appendVint(lRecord, pSize);
+	}
+
+	QByteArray lEntry;
+	const int lTags[] = {cRecordCommonV1, cRecordCommonV2, cRecordCommonV3};
+	appendVuint(lEntry, static_cast<quint64>(lTags[mParameters.mMetadataVersion - 1]));
+	appendBytes(lEntry, lRecord);
+	appendVuint(lEntry, cRecordEnd);
+	return lEntry;
+}
+
+// Moves the objects of the save from memory into a pack file.
+bool RepositoryGenerator::writePack() {
+	git_buf lPack = GIT_BUF_INIT;
+	git_indexer *lIndexer = nullptr;
+	git_indexer_progress lProgress;
+	const QByteArray lPackPath = QByteArray(git_repository_path(mRepository)) + "objects/pack";
+	bool lOk = 0 == git_mempack_dump(&lPack, mRepository, mMemoryBackend) &&
+	           0 == git_indexer_new(&lIndexer, lPackPath.constData(), 0, mOdb, nullptr) &&
+	           0 == git_indexer_append(lIndexer, lPack.ptr, lPack.size, &lProgress) &&
+	           0 == git_indexer_commit(lIndexer, &lProgress);
+	git_indexer_free(lIndexer);
+	git_buf_dispose(&lPack);
+	if(!lOk) {
+		return fail(QStringLiteral("could not write pack file"));
+	}
+	git_mempack_reset(mMemoryBackend);
+	git_odb_refresh(mOdb);
+	return true;
+}
+
+bool RepositoryGenerator::fail(const QString &pWhat) {
+	const git_error *lError = git_error_last();
+	mErrorString = lError != nullptr ? QStringLiteral("%1: %2").arg(pWhat, QString::fromUtf8(lError->message)) : pWhat;
+	return false;
+}
@@ -0,0 +1,89 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef REPOSITORYGENERATOR_H
+#define REPOSITORYGENERATOR_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+#include <git2.h>
+
+#include <random>
+
+// Writes a bup repository with made up content, the same for the same
+// parameters. Every save is a commit on refs/heads/kup with its objects in a
+// pack file of its own, like bup does it. Between saves a share of the files
+// is changed, a changed chunked file only gets one of its chunks replaced.
+class RepositoryGenerator {
+public:
+	struct Parameters {
+		int mSaves = 20;
+		int mDepth = 3; // levels of folders below the root
+		int mFoldersPerFolder = 4;
+		int mFilesPerFolder = 20;
+		qint64 mFileSize = 4096; // average, for files that are not chunked
+		double mChunkedShare = 0.05; // of the files
+		qint64 mChunkedFileSize = 4 * 1024 * 1024;
+		int mChunkSize = 8192; // average
+		int mFanout = 16; // chunks or chunk trees in each chunk tree
+		double mChurn = 0.05; // share of files changed in each save
+		int mMetadataVersion = 3; // of the common records in .bupm, 1 to 3
+		quint32 mSeed = 1;
+
+		QJsonObject toJson() const;
+	};
+
+	explicit RepositoryGenerator(const Parameters &pParameters);
+	~RepositoryGenerator();
+	// pPath must not exist yet.
+	bool generate(const QString &pPath);
+	QString errorString() const {
+		return mErrorString;
+	}
+
+protected:
+	struct FileModel {
+		QString mName;
+		bool mChunked;
+		git_oid mOid; // blob, or the chunk tree
+		QVector<git_oid> mChunks;
+		QVector<qint64> mChunkSizes;
+		qint64 mSize;
+		qint64 mMtime;
+	};
+	struct FolderModel {
+		QString mName;
+		QVector<FileModel> mFiles;
+		QVector<FolderModel> mFolders;
+		git_oid mTree;
+		qint64 mMtime;
+		bool mChanged;
+	};
+
+	bool createFolder(FolderModel &pFolder, const QString &pName, int pLevel, qint64 pTime);
+	bool createFile(FileModel &pFile, qint64 pTime);
+	bool changeFile(FileModel &pFile, qint64 pTime);
+	bool changeFiles(FolderModel &pFolder, qint64 pTime);
+	bool writeBlob(qint64 pSize, git_oid &pOid);
+	bool writeChunkTree(FileModel &pFile);
+	bool writeChunkLevel(const QVector<git_oid> &pOids, const QVector<qint64> &pSizes, bool pTrees,
+	                     QVector<git_oid> &pParentOids, QVector<qint64> &pParentSizes);
+	bool writeFolder(FolderModel &pFolder);
+	QByteArray metadataRecord(qint64 pMode, qint64 pSize, qint64 pMtime) const;
+	bool writePack();
+	bool fail(const QString &pWhat);
+
+	Parameters mParameters;
+	std::mt19937 mRandom;
+	git_repository *mRepository;
+	git_odb *mOdb;
+	git_odb_backend *mMemoryBackend; // objects of the save being written
+	QByteArray mContent; // random bytes that file content is cut from
+	QString mErrorString;
+};
+
+#endif // REPOSITORYGENERATOR_H
@@ -188,6 +188,7 @@ void BupJob::slotSavingDone(int pExitCode, QProcess::ExitStatus pExitStatus) {
 	} else {
 		mLogStream << QStringLiteral("Kup successfully completed the bup backup job at ")
 		           << QLocale().toString(QDateTime::currentDateTime()) << endl;
+		startFilenameIndexUpdate();
 		jobFinishedSuccess();
 	}
 }
@@ -210,10 +211,18 @@ void BupJob::slotRecoveryInfoDone(int pExitCode, QProcess::ExitStatus pExitStatu
 		                                                            "See log file for more details."));
 	} else {
 		mLogStream << QStringLiteral("Kup successfully completed the bup backup job.") << endl;
+		startFilenameIndexUpdate();
 		jobFinishedSuccess();
 	}
 }
 
+// Adds the new save to the index of file names used by File Digger and
+// kio_bup, so that the next search does not have to. Nothing depends on it
+// finishing, whatever is not done now is done on the next search.
+void BupJob::startFilenameIndexUpdate() {
+	KProcess::startDetached(QStringLiteral("kup-search"), {QStringLiteral("--update-index"), mDestinationPath});
+}
+
 void BupJob::slotReadBupErrors() {
 	bool lValidInfo = false, lValidFileName = false;
 	qulonglong lCopiedKBytes = 0, lTotalKBytes = 0, lCopiedFiles = 0, lTotalFiles = 0;
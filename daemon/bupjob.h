@@ -34,6 +34,7 @@ protected slots:
 protected:
 	bool doSuspend() override;
 	bool doResume() override;
+	void startFilenameIndexUpdate();
 
 	KProcess mFsckProcess;
 	KProcess mIndexProcess;
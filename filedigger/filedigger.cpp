@@ -3,12 +3,16 @@
 // SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
 
 #include "filedigger.h"
+#include "filenameindex.h"
+#include "kupfiledigger_debug.h"
 #include "mergedvfsmodel.h"
 #include "restoredialog.h"
+#include "threadrepository.h"
 #include "versionlistmodel.h"
 #include "versionlistdelegate.h"
 
 #include <KDirOperator>
+#include <KFormat>
 #include <KFilePlacesView>
 #include <KFilePlacesModel>
 #include <KGuiItem>
@@ -18,16 +22,31 @@
 #include <KStandardAction>
 #include <KToolBar>
 
+#include <QFileInfo>
 #include <QGuiApplication>
 #include <QLabel>
+#include <QLineEdit>
 #include <QListView>
+#include <QMenu>
+#include <QProcess>
 #include <QPushButton>
 #include <QSplitter>
+#include <QThread>
 #include <QTimer>
 #include <QTreeView>
 #include <QVBoxLayout>
+#include <limits>
 #include <utility>
 
+// The find menu shows at most this many paths, more than fit on the screen
+// means the name was not specific enough anyway.
+static const int cFindMaxPaths = 50;
+
+void IndexWorker::update(const QByteArray &pRepositoryPath) {
+	git_repository *lRepository = threadRepository(pRepositoryPath);
+	emit updated(lRepository != nullptr && mIndex->update(lRepository));
+}
+
 FileDigger::FileDigger(QString pRepoPath, QString pBranchName, QWidget *pParent)
     : KMainWindow(pParent), mRepoPath(std::move(pRepoPath)), mBranchName(std::move(pBranchName)), mDirOperator(nullptr)
 {
@@ -37,12 +56,24 @@ FileDigger::FileDigger(QString pRepoPath, QString pBranchName, QWidget *pParent)
     QTimer::singleShot(0, this, [this]{repoPathAvailable();});
 }
 
+FileDigger::~FileDigger() {
+	if(mIndexThread != nullptr) {
+		mIndexThread->quit();
+		mIndexThread->wait();
+	}
+	delete mFilenameIndex;
+}
+
 QSize FileDigger::sizeHint() const {
     return {800, 600};
 }
 
 void FileDigger::updateVersionModel(const QModelIndex &pCurrent, const QModelIndex &pPrevious) {
 	Q_UNUSED(pPrevious)
+	if(!pCurrent.isValid()) {
+		mVersionModel->setNode(nullptr);
+		return;
+	}
 	mVersionModel->setNode(MergedVfsModel::node(pCurrent));
 	mVersionView->selectionModel()->setCurrentIndex(mVersionModel->index(0,0),
 	                                                QItemSelectionModel::Select);
@@ -88,8 +119,57 @@ void FileDigger::enterUrl(const QUrl &pUrl) {
 	mDirOperator->setUrl(pUrl, true);
 }
 
+void FileDigger::findFile() {
+	const QString lName = mFindEdit->text().trimmed();
+	if(lName.isEmpty() || !mFindName.isEmpty()) {
+		return;
+	}
+	// new saves are added to the index first, the whole history if there is no index yet.
+	mFindName = lName;
+	mFindEdit->setReadOnly(true);
+	QGuiApplication::setOverrideCursor(QCursor(Qt::BusyCursor));
+	emit indexUpdateRequested(mRepository->name().toLocal8Bit());
+}
+
+void FileDigger::showFound(bool pIndexOk) {
+	const QString lName = mFindName;
+	mFindName.clear();
+	mFindEdit->setReadOnly(false);
+	QGuiApplication::restoreOverrideCursor();
+	if(!pIndexOk) {
+		qCWarning(KUPFILEDIGGER) << "could not update the index of file names in repository " << mRepository->name();
+		KMessageBox::sorry(this, i18n("Could not read the file names in this backup archive."));
+		return;
+	}
+	QStringList lPaths;
+	// one entry per version, the tree only has one node per path.
+	foreach(int lEntryIndex, mFilenameIndex->find(lName, std::numeric_limits<int>::max())) {
+		const QString &lPath = mFilenameIndex->path(mFilenameIndex->mEntries.at(lEntryIndex));
+		if(!lPaths.contains(lPath)) {
+			lPaths.append(lPath);
+			if(lPaths.count() == cFindMaxPaths) {
+				break;
+			}
+		}
+	}
+	if(lPaths.isEmpty()) {
+		KMessageBox::information(this, xi18nc("@info messagebox, %1 is part of a file name",
+		                                      "No file or folder with <filename>%1</filename> in the name "
+		                                      "has been saved.", lName));
+		return;
+	}
+	QMenu lMenu;
+	foreach(const QString &lPath, lPaths) {
+		lMenu.addAction(lPath)->setData(lPath);
+	}
+	QAction *lAction = lMenu.exec(mFindEdit->mapToGlobal(QPoint(0, mFindEdit->height())));
+	if(lAction != nullptr) {
+		startExpanding(lAction->data().toString());
+	}
+}
+
 MergedRepository *FileDigger::createRepo() {
-    auto lRepository = new MergedRepository(nullptr, mRepoPath, mBranchName);
+    auto lRepository = new MergedRepository(mRepoPath, mBranchName);
     if(!lRepository->open()) {
         KMessageBox::sorry(nullptr, xi18nc("@info messagebox, %1 is a folder path",
                                        "The backup archive <filename>%1</filename> could not be opened. "
@@ -106,10 +186,33 @@ MergedRepository *FileDigger::createRepo() {
         }
         return nullptr;
     }
+    // Made in the background for the next time. Not if it can not be saved,
+    // it would be made all over again each time.
+    if(!lRepository->usesHistory() && QFileInfo(mRepoPath).isWritable()) {
+        QProcess::startDetached(QStringLiteral("kup-search"), {QStringLiteral("--update-index"), QStringLiteral("--branch"),
+                                                               mBranchName, mRepoPath});
+    }
     return lRepository;
 }
 
 void FileDigger::createRepoView(MergedRepository *pRepository) {
+    mRepository = pRepository;
+    mFindEdit = new QLineEdit(this);
+    mFindEdit->setPlaceholderText(i18n("Find file"));
+    mFindEdit->setClearButtonEnabled(true);
+    mFindEdit->setMaximumWidth(300);
+    toolBar()->addWidget(mFindEdit);
+    connect(mFindEdit, &QLineEdit::returnPressed, this, &FileDigger::findFile);
+
+	mFilenameIndex = new FilenameIndex(QByteArray("refs/heads/") + mBranchName.toLocal8Bit());
+	mIndexThread = new QThread(this);
+	mIndexWorker = new IndexWorker(mFilenameIndex);
+	mIndexWorker->moveToThread(mIndexThread);
+	connect(mIndexThread, &QThread::finished, mIndexWorker, &QObject::deleteLater);
+	connect(this, &FileDigger::indexUpdateRequested, mIndexWorker, &IndexWorker::update);
+	connect(mIndexWorker, &IndexWorker::updated, this, &FileDigger::showFound);
+	mIndexThread->start();
+
     auto lSplitter = new QSplitter();
     mMergedVfsModel = new MergedVfsModel(pRepository, this);
     mMergedVfsView = new QTreeView();
@@ -130,18 +233,23 @@ void FileDigger::createRepoView(MergedRepository *pRepository) {
 	connect(lVersionDelegate, SIGNAL(openRequested(QModelIndex)), SLOT(open(QModelIndex)));
 	connect(lVersionDelegate, SIGNAL(restoreRequested(QModelIndex)), SLOT(restore(QModelIndex)));
 	mMergedVfsView->setFocus();
+	connect(mMergedVfsModel, &MergedVfsModel::merged, this, &FileDigger::expandPending);
+	connect(mMergedVfsModel, &MergedVfsModel::dataChanged, this, &FileDigger::updateVersions);
+	connect(mMergedVfsView, &QTreeView::collapsed, this, &FileDigger::cancelExpansion);
 
-	//expand all levels from the top until the node has more than one child
-	QModelIndex lIndex;
-	forever {
-		mMergedVfsView->expand(lIndex);
-		if(mMergedVfsModel->rowCount(lIndex) == 1) {
-			lIndex = mMergedVfsModel->index(0, 0, lIndex);
-		} else {
-			break;
-		}
+	if(KUPFILEDIGGER().isDebugEnabled()) {
+		mMemoryLabel = new QLabel(mMergedVfsView->viewport());
+		mMemoryLabel->setAttribute(Qt::WA_TransparentForMouseEvents);
+		mMemoryLabel->setAutoFillBackground(true);
+		mMemoryLabel->show();
+		auto lTimer = new QTimer(this);
+		connect(lTimer, &QTimer::timeout, this, &FileDigger::updateMemoryUse);
+		lTimer->start(1000);
+		updateMemoryUse();
 	}
-	mMergedVfsView->selectionModel()->setCurrentIndex(mMergedVfsModel->index(0, 0, lIndex), QItemSelectionModel::Select);
+
+	//expand all levels from the top until the node has more than one child
+	startExpanding(QString());
 	setCentralWidget(lSplitter);
 }
 
@@ -179,3 +287,95 @@ void FileDigger::createSelectionView() {
 	lSelectionView->setLayout(lVLayout1);
 	setCentralWidget(lSelectionView);
 }
+
+void FileDigger::startExpanding(const QString &pPath) {
+	mExpanding = true;
+	mExpandPath = pPath.split(QLatin1Char('/'), QString::SkipEmptyParts);
+	mExpandIndex = QModelIndex();
+	expandPending();
+}
+
+void FileDigger::expandPending() {
+	while(mExpanding) {
+		QModelIndex lIndex = mExpandIndex;
+		mMergedVfsView->expand(lIndex);
+		if(!mMergedVfsModel->isMerged(lIndex)) {
+			mMergedVfsModel->fetchMore(lIndex);
+			if(!mMergedVfsModel->isMerged(lIndex)) {
+				return; // continues when merged
+			}
+		}
+		QModelIndex lChild;
+		if(mExpandPath.isEmpty()) {
+			if(mMergedVfsModel->rowCount(lIndex) == 1) {
+				lChild = mMergedVfsModel->index(0, 0, lIndex);
+				if(!MergedVfsModel::node(lChild)->isDirectory()) {
+					lIndex = lChild;
+					lChild = QModelIndex();
+				}
+			} else {
+				lIndex = mMergedVfsModel->index(0, 0, lIndex);
+			}
+		} else {
+			const QString lName = mExpandPath.takeFirst();
+			for(int i = 0; i < mMergedVfsModel->rowCount(lIndex); ++i) {
+				QModelIndex lCandidate = mMergedVfsModel->index(i, 0, lIndex);
+				if(lCandidate.data(Qt::DisplayRole).toString() == lName) {
+					lChild = lCandidate;
+					break;
+				}
+			}
+			if(lChild.isValid() && mExpandPath.isEmpty()) {
+				lIndex = lChild;
+				lChild = QModelIndex();
+			}
+		}
+		if(lChild.isValid()) {
+			mExpandIndex = lChild;
+			continue;
+		}
+		mExpanding = false;
+		if(lIndex.isValid()) {
+			mMergedVfsView->selectionModel()->setCurrentIndex(lIndex, QItemSelectionModel::ClearAndSelect);
+			mMergedVfsView->scrollTo(lIndex);
+			mMergedVfsView->setFocus();
+		}
+	}
+}
+
+void FileDigger::cancelExpansion(const QModelIndex &pIndex) {
+	mExpanding = false;
+	mMergedVfsModel->cancelMerge(pIndex);
+}
+
+void FileDigger::updateVersions(const QModelIndex &pTopLeft, const QModelIndex &pBottomRight) {
+	// versions of a sub node can still be added while its folder is merged
+	QModelIndex lCurrent = mMergedVfsView->currentIndex();
+	if(lCurrent.isValid() && lCurrent.parent() == pTopLeft.parent() &&
+	      lCurrent.row() >= pTopLeft.row() && lCurrent.row() <= pBottomRight.row()) {
+		// keep the version that was selected, newer ones may come before it
+		const QVariant lSelected = mVersionView->currentIndex().data(VersionBupUrlRole);
+		mVersionModel->setNode(MergedVfsModel::node(lCurrent));
+		int lRow = 0;
+		for(int i = 0; lSelected.isValid() && i < mVersionModel->rowCount(QModelIndex()); ++i) {
+			if(mVersionModel->index(i, 0).data(VersionBupUrlRole) == lSelected) {
+				lRow = i;
+				break;
+			}
+		}
+		mVersionView->selectionModel()->setCurrentIndex(mVersionModel->index(lRow, 0),
+		                                                QItemSelectionModel::ClearAndSelect);
+	}
+}
+
+void FileDigger::updateMemoryUse() {
+	MergedNode::MemoryUse lUse{0, 0, 0};
+	mRepository->addMemoryUse(lUse);
+	mMemoryLabel->setText(QStringLiteral("%1 nodes, %2 versions, %3")
+	                      .arg(lUse.mNodes).arg(lUse.mVersions)
+	                      .arg(KFormat().formatByteSize(static_cast<double>(lUse.mBytes))));
+	mMemoryLabel->adjustSize();
+	// in the lower right corner, follows resizing within a second
+	QWidget *lViewport = mMergedVfsView->viewport();
+	mMemoryLabel->move(lViewport->width() - mMemoryLabel->width(), lViewport->height() - mMemoryLabel->height());
+}
@@ -6,23 +6,50 @@
 #define FILEDIGGER_H
 
 #include <KMainWindow>
+#include <QPersistentModelIndex>
+#include <QStringList>
 #include <QUrl>
 
+class FilenameIndex;
 class KDirOperator;
 class MergedVfsModel;
 class MergedRepository;
 class VersionListModel;
+class QLabel;
+class QLineEdit;
 class QListView;
 class QModelIndex;
+class QThread;
 class QTreeView;
 
+// Brings the index of file names up to date in a thread of its own. The first
+// time, that reads the whole history of the branch.
+class IndexWorker : public QObject {
+	Q_OBJECT
+public:
+	explicit IndexWorker(FilenameIndex *pIndex) : mIndex(pIndex) {}
+
+public slots:
+	void update(const QByteArray &pRepositoryPath);
+
+signals:
+	void updated(bool pOk);
+
+protected:
+	FilenameIndex *mIndex;
+};
+
 class FileDigger : public KMainWindow
 {
 	Q_OBJECT
 public:
 	explicit FileDigger(QString pRepoPath, QString pBranchName, QWidget *pParent = nullptr);
+	~FileDigger() override;
 	QSize sizeHint() const override;
 
+signals:
+	void indexUpdateRequested(const QByteArray &pRepositoryPath);
+
 protected slots:
 	void updateVersionModel(const QModelIndex &pCurrent, const QModelIndex &pPrevious);
 	void open(const QModelIndex &pIndex);
@@ -30,13 +57,33 @@ protected slots:
 	void repoPathAvailable();
 	void checkFileWidgetPath();
 	void enterUrl(const QUrl &pUrl);
+	void findFile();
+	void showFound(bool pIndexOk);
+	void expandPending();
+	void cancelExpansion(const QModelIndex &pIndex);
+	void updateVersions(const QModelIndex &pTopLeft, const QModelIndex &pBottomRight);
+	void updateMemoryUse();
 
 protected:
 	MergedRepository *createRepo();
 	void createRepoView(MergedRepository *pRepository);
 	void createSelectionView();
+	// Expands to the path, or while there is only one sub node if empty and
+	// starting, as the folders on the way are merged.
+	void startExpanding(const QString &pPath);
+	MergedRepository *mRepository{};
+	QLineEdit *mFindEdit{};
+	QString mFindName; // searched for when the index is up to date
+	// Only used by mIndexWorker while an update is running.
+	FilenameIndex *mFilenameIndex{};
+	QThread *mIndexThread{};
+	IndexWorker *mIndexWorker{};
 	MergedVfsModel *mMergedVfsModel{};
 	QTreeView *mMergedVfsView{};
+	bool mExpanding{};
+	QStringList mExpandPath;
+	QPersistentModelIndex mExpandIndex;
+	QLabel *mMemoryLabel{}; // only with debug output enabled
 
 	VersionListModel *mVersionModel{};
 	QListView *mVersionView{};
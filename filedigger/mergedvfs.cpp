@@ -3,7 +3,9 @@
 // SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
 
 #include "mergedvfs.h"
+#include "bupodb.h"
 #include "kupdaemon.h"
+#include "mergedhistory.h"
 #include "vfshelpers.h"
 #include "kupfiledigger_debug.h"
 
@@ -12,35 +14,148 @@
 
 #include <QDBusInterface>
 #include <QDir>
-#include <QGuiApplication>
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <numeric>
 #include <utility>
 #include <git2/branch.h>
 #include <sys/stat.h>
 
-using NameMap = QMap<QString, MergedNode *>;
-using NameMapIterator = QMapIterator<QString, MergedNode *>;
-
 git_repository *MergedNode::mRepository = nullptr;
+MergedHistory *MergedNode::mHistory = nullptr;
+
+// For a name used by different kinds of nodes in the history of a folder.
+static void appendTypeSuffix(QString &pName, uint pMode) {
+	if(S_ISDIR(pMode)) {
+		pName.append(xi18nc("added after folder name in some cases", " (folder)"));
+	} else if(S_ISLNK(pMode)) {
+		pName.append(xi18nc("added after file name in some cases", " (symlink)"));
+	} else {
+		pName.append(xi18nc("added after file name in some cases", " (file)"));
+	}
+}
 
 bool mergedNodeLessThan(const MergedNode *a, const MergedNode *b) {
 	if(a->isDirectory() != b->isDirectory()) {
 		return a->isDirectory();
 	}
-	return a->objectName() < b->objectName();
+	return a->name() < b->name();
 }
 
-bool versionGreaterThan(const VersionData *a, const VersionData *b) {
-	return a->mModifiedDate > b->mModifiedDate;
+VersionList::VersionList(const VersionList &pOther) {
+	append(pOther);
 }
 
+VersionList::VersionList(VersionList &&pOther) noexcept {
+	swap(pOther);
+}
 
-MergedNode::MergedNode(QObject *pParent, const QString &pName, uint pMode)
-   :QObject(pParent)
+VersionList &VersionList::operator=(VersionList pOther) {
+	swap(pOther);
+	return *this;
+}
+
+void VersionList::swap(VersionList &pOther) noexcept {
+	std::swap(mData, pOther.mData);
+	std::swap(mCount, pOther.mCount);
+	std::swap(mCapacity, pOther.mCapacity);
+}
+
+quint64 VersionList::bytesFor(int pCapacity) {
+	return static_cast<quint64>(pCapacity) * (3 * sizeof(qint64) + sizeof(git_oid) + sizeof(quint8));
+}
+
+void VersionList::reserve(int pCapacity) {
+	if(pCapacity <= mCapacity) {
+		return;
+	}
+	VersionList lNew;
+	lNew.mData = new char[bytesFor(pCapacity)];
+	lNew.mCapacity = pCapacity;
+	lNew.mCount = mCount;
+	if(mCount > 0) {
+		const auto lCount = static_cast<size_t>(mCount);
+		memcpy(lNew.modifiedDates(), modifiedDates(), lCount * sizeof(qint64));
+		memcpy(lNew.commitTimes(), commitTimes(), lCount * sizeof(qint64));
+		memcpy(lNew.sizes(), sizes(), lCount * sizeof(qint64));
+		memcpy(lNew.oids(), oids(), lCount * sizeof(git_oid));
+		memcpy(lNew.chunked(), chunked(), lCount * sizeof(quint8));
+	}
+	swap(lNew);
+}
+
+void VersionList::append(const git_oid &pOid, qint64 pCommitTime, qint64 pModifiedDate, qint64 pSize, bool pChunked) {
+	if(mCount == mCapacity) {
+		reserve(qMax(1, 2 * mCapacity));
+	}
+	modifiedDates()[mCount] = pModifiedDate;
+	commitTimes()[mCount] = pCommitTime;
+	sizes()[mCount] = pSize;
+	oids()[mCount] = pOid;
+	chunked()[mCount] = pChunked ? 1 : 0;
+	++mCount;
+}
+
+void VersionList::append(const VersionList &pOther) {
+	reserve(mCount + pOther.mCount);
+	for(int i = 0; i < pOther.mCount; ++i) {
+		append(pOther.oid(i), pOther.commitTime(i), pOther.modifiedDate(i), pOther.sizes()[i], pOther.isChunked(i));
+	}
+}
+
+void VersionList::sortByModifiedDate() {
+	const qint64 *lDates = modifiedDates();
+	if(std::is_sorted(lDates, lDates + mCount, std::greater<qint64>())) {
+		return;
+	}
+	QVector<int> lOrder(mCount);
+	std::iota(lOrder.begin(), lOrder.end(), 0);
+	std::stable_sort(lOrder.begin(), lOrder.end(), [lDates](int a, int b) {
+		return lDates[a] > lDates[b];
+	});
+	VersionList lSorted;
+	lSorted.reserve(mCount);
+	foreach(int i, lOrder) {
+		lSorted.append(oid(i), commitTime(i), modifiedDate(i), sizes()[i], isChunked(i));
+	}
+	swap(lSorted);
+}
+
+quint64 VersionList::size(int pIndex) const {
+	if(!isSizeKnown(pIndex)) {
+		cacheSize(pIndex, readSize(MergedNode::mRepository, oid(pIndex), isChunked(pIndex)));
+	}
+	return static_cast<quint64>(sizes()[pIndex]);
+}
+
+quint64 VersionList::readSize(git_repository *pRepository, const git_oid &pOid, bool pChunked) {
+	if(pChunked) {
+		return calculateChunkFileSize(&pOid, pRepository);
+	}
+	// only the object header is needed, no need to inflate the blob.
+	git_odb *lOdb;
+	if(0 != git_repository_odb(&lOdb, pRepository)) {
+		return 0;
+	}
+	size_t lSize;
+	git_object_t lType;
+	int lResult = git_odb_read_header(&lSize, &lType, lOdb, &pOid);
+	git_odb_free(lOdb);
+	return lResult == 0 ? lSize : 0;
+}
+
+MergedNode::MergedNode(MergedNode *pParent, QString pName, uint pMode)
+   : mParent(pParent), mName(std::move(pName)), mMode(pMode), mSubNodes(nullptr), mHistoryNode(-1)
 {
-	mSubNodes = nullptr;
-	setObjectName(pName);
-	mMode = pMode;
+}
+
+MergedNode::~MergedNode() {
+	if(mSubNodes != nullptr) {
+		qDeleteAll(*mSubNodes);
+		delete mSubNodes;
+	}
 }
 
 void MergedNode::getBupUrl(int pVersionIndex, QUrl *pComplete, QString *pRepoPath,
@@ -49,27 +164,27 @@ void MergedNode::getBupUrl(int pVersionIndex, QUrl *pComplete, QString *pRepoPat
 	const MergedNode *lNode = this;
 	while(lNode != nullptr) {
 		lStack.append(lNode);
-		lNode = qobject_cast<const MergedNode *>(lNode->parent());
+		lNode = lNode->mParent;
 	}
-	const auto lRepo = qobject_cast<const MergedRepository *>(lStack.takeLast());
+	const auto lRepo = static_cast<const MergedRepository *>(lStack.takeLast());
 	if(pComplete) {
-		pComplete->setUrl("bup://" + lRepo->objectName() + lRepo->mBranchName + '/' +
-		                  vfsTimeToString(static_cast<git_time_t>(mVersionList.at(pVersionIndex)->mCommitTime)));
+		pComplete->setUrl("bup://" + lRepo->mName + lRepo->mBranchName + '/' +
+		                  vfsTimeToString(static_cast<git_time_t>(mVersionList.commitTime(pVersionIndex))));
 	}
 	if(pRepoPath) {
-		*pRepoPath = lRepo->objectName();
+		*pRepoPath = lRepo->mName;
 	}
 	if(pBranchName) {
 		*pBranchName = lRepo->mBranchName;
 	}
 	if(pCommitTime) {
-		*pCommitTime = mVersionList.at(pVersionIndex)->mCommitTime;
+		*pCommitTime = mVersionList.commitTime(pVersionIndex);
 	}
 	if(pPathInRepo) {
 		pPathInRepo->clear();
 	}
 	while(!lStack.isEmpty()) {
-		QString lPathComponent = lStack.takeLast()->objectName();
+		QString lPathComponent = lStack.takeLast()->mName;
 		if(pComplete) {
 			pComplete->setPath(pComplete->path() + '/' + lPathComponent);
 		}
@@ -80,13 +195,23 @@ void MergedNode::getBupUrl(int pVersionIndex, QUrl *pComplete, QString *pRepoPat
 	}
 }
 
+void MergedNode::addMemoryUse(MemoryUse &pUse) const {
+	pUse.mNodes += 1;
+	pUse.mVersions += mVersionList.count();
+	pUse.mBytes += sizeof(*this) + mVersionList.memoryUsed() + static_cast<quint64>(mName.capacity()) * sizeof(QChar);
+	if(mSubNodes != nullptr) {
+		pUse.mBytes += sizeof(MergedNodeList) + static_cast<quint64>(mSubNodes->count()) * sizeof(MergedNode *);
+		foreach(const MergedNode *lNode, *mSubNodes) {
+			lNode->addMemoryUse(pUse);
+		}
+	}
+}
+
 MergedNodeList &MergedNode::subNodes() {
 	if(mSubNodes == nullptr) {
 		mSubNodes = new MergedNodeList();
 		if(S_ISDIR(mMode)) {
-			QGuiApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
 			generateSubNodes();
-			QGuiApplication::restoreOverrideCursor();
 		}
 	}
 	return *mSubNodes;
@@ -107,117 +232,183 @@ void MergedNode::askForIntegrityCheck() {
 }
 
 void MergedNode::generateSubNodes() {
-	NameMap lSubNodeMap;
-	foreach(VersionData *lCurrentVersion, mVersionList) {
-		git_tree *lTree;
-		if(0 != git_tree_lookup(&lTree, mRepository, &lCurrentVersion->mOid)) {
+	if(mHistoryNode >= 0) {
+		readSubNodesFromHistory();
+		return;
+	}
+	TreeMerger lMerger(mRepository, TreeMerger::versions(mVersionList));
+	while(!lMerger.atEnd()) {
+		if(!lMerger.mergeNext()) {
 			askForIntegrityCheck();
-			continue; // try to be fault tolerant by not aborting...
+			// try to be fault tolerant by not aborting...
 		}
-		git_blob *lMetadataBlob = nullptr;
-		VintStream *lMetadataStream = nullptr;
-		const git_tree_entry *lTreeEntry = git_tree_entry_byname(lTree, ".bupm");
-		if(lTreeEntry != nullptr && 0 == git_blob_lookup(&lMetadataBlob, mRepository, git_tree_entry_id(lTreeEntry))) {
-			lMetadataStream = new VintStream(git_blob_rawcontent(lMetadataBlob), static_cast<int>(git_blob_rawsize(lMetadataBlob)), this);
-			Metadata lMetadata;
-			readMetadata(*lMetadataStream, lMetadata); // the first entry is metadata for the directory itself, discard it.
+	}
+	foreach(const TreeMerger::Update &lUpdate, lMerger.takeUpdates()) {
+		auto lSubNode = new MergedNode(this, lUpdate.mName, lUpdate.mMode);
+		lSubNode->mVersionList = lUpdate.mVersions;
+		mSubNodes->append(lSubNode);
+	}
+	std::sort(mSubNodes->begin(), mSubNodes->end(), mergedNodeLessThan);
+	foreach(MergedNode *lNode, *mSubNodes) {
+		lNode->mVersionList.sortByModifiedDate();
+	}
+}
+
+void MergedNode::readSubNodesFromHistory() {
+	const MergedHistory::Node lNode = mHistory->node(static_cast<quint32>(mHistoryNode));
+	QString lPreviousName;
+	for(quint32 i = lNode.mFirstChild; i < lNode.mFirstChild + lNode.mChildCount; ++i) {
+		const MergedHistory::Node lChild = mHistory->node(i);
+		QString lName = mHistory->name(i);
+		// the newest of the nodes with the same name comes first and keeps it
+		if(lName == lPreviousName) {
+			appendTypeSuffix(lName, lChild.mMode);
+		} else {
+			lPreviousName = lName;
 		}
+		auto lSubNode = new MergedNode(this, lName, lChild.mMode);
+		lSubNode->mHistoryNode = i;
+		lSubNode->mVersionList.reserve(static_cast<int>(lChild.mVersionCount));
+		for(quint32 j = lChild.mFirstVersion; j < lChild.mFirstVersion + lChild.mVersionCount; ++j) {
+			const MergedHistory::Version lVersion = mHistory->version(j);
+			lSubNode->mVersionList.append(lVersion.mOid, lVersion.mCommitTime, lVersion.mModifiedDate,
+			                              S_ISDIR(lChild.mMode) ? qMax<qint64>(0, lVersion.mSize) : lVersion.mSize,
+			                              lVersion.mChunked);
+		}
+		mSubNodes->append(lSubNode);
+	}
+	std::sort(mSubNodes->begin(), mSubNodes->end(), mergedNodeLessThan);
+}
 
-		ulong lEntryCount = git_tree_entrycount(lTree);
-		for(uint i = 0; i < lEntryCount; ++i) {
-			uint lMode;
-			const git_oid *lOid;
-			QString lName;
-			bool lChunked;
-			const git_tree_entry *lTreeEntry = git_tree_entry_byindex(lTree, i);
-			getEntryAttributes(lTreeEntry, lMode, lChunked, lOid, lName);
-			if(lName == QStringLiteral(".bupm")) {
-				continue;
-			}
+TreeMerger::TreeMerger(git_repository *pRepository, QVector<Version> pVersions)
+   : mRepository(pRepository), mVersions(std::move(pVersions)), mNext(0)
+{
+}
+
+QVector<TreeMerger::Version> TreeMerger::versions(const VersionList &pVersionList) {
+	QVector<Version> lVersions;
+	lVersions.reserve(pVersionList.count());
+	for(int i = 0; i < pVersionList.count(); ++i) {
+		lVersions.append({pVersionList.oid(i), pVersionList.commitTime(i), pVersionList.modifiedDate(i)});
+	}
+	return lVersions;
+}
+
+bool TreeMerger::mergeNext() {
+	const Version &lCurrentVersion = mVersions.at(mNext++);
+	// Most saves don't change most folders. A tree seen in a newer version
+	// already gave all its entries to the sub nodes, with newer times.
+	if(mSeenTrees.contains(lCurrentVersion.mOid)) {
+		return true;
+	}
+	mSeenTrees.insert(lCurrentVersion.mOid);
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, mRepository, &lCurrentVersion.mOid)) {
+		return false;
+	}
+	ulong lEntryCount = git_tree_entrycount(lTree);
+	int lMetadataIndex = 1; // the first entry is metadata for the directory itself, discard it.
+	git_blob *lMetadataBlob;
+	const git_tree_entry *lTreeEntry = git_tree_entry_byname(lTree, ".bupm");
+	if(lTreeEntry != nullptr && 0 == git_blob_lookup(&lMetadataBlob, mRepository, git_tree_entry_id(lTreeEntry))) {
+		mMetadataList.reserve(static_cast<int>(lEntryCount));
+		readMetadataList(git_blob_rawcontent(lMetadataBlob), static_cast<size_t>(git_blob_rawsize(lMetadataBlob)), mMetadataList);
+		git_blob_free(lMetadataBlob);
+	} else {
+		mMetadataList.resize(0);
+	}
 
-			MergedNode *lSubNode = lSubNodeMap.value(lName, nullptr);
-			if(lSubNode == nullptr) {
-				lSubNode = new MergedNode(this, lName, lMode);
-				lSubNodeMap.insert(lName, lSubNode);
-				mSubNodes->append(lSubNode);
-			} else if((S_IFMT & lMode) != (S_IFMT & lSubNode->mMode)) {
-				if(S_ISDIR(lMode)) {
-					lName.append(xi18nc("added after folder name in some cases", " (folder)"));
-				} else if(S_ISLNK(lMode)) {
-					lName.append(xi18nc("added after file name in some cases", " (symlink)"));
-				} else {
-					lName.append(xi18nc("added after file name in some cases", " (file)"));
-				}
-				lSubNode = lSubNodeMap.value(lName, nullptr);
-				if(lSubNode == nullptr) {
-					lSubNode = new MergedNode(this, lName, lMode);
-					lSubNodeMap.insert(lName, lSubNode);
-					mSubNodes->append(lSubNode);
-				}
+	for(uint i = 0; i < lEntryCount; ++i) {
+		uint lMode;
+		const git_oid *lOid;
+		QString lName;
+		bool lChunked;
+		lTreeEntry = git_tree_entry_byindex(lTree, i);
+		getEntryAttributes(lTreeEntry, lMode, lChunked, lOid, lName);
+		if(lName == QStringLiteral(".bupm")) {
+			continue;
+		}
+		int lEntry = entry(lName, lMode);
+		bool lAlreadySeen = mEntries.at(lEntry).mSeenOids.contains(*lOid);
+		if(!lAlreadySeen) {
+			mEntries[lEntry].mSeenOids.insert(*lOid);
+		}
+		if(S_ISDIR(lMode)) {
+			if(!lAlreadySeen) {
+				update(lEntry).mVersions.append(*lOid, lCurrentVersion.mCommitTime, lCurrentVersion.mModifiedDate, 0);
 			}
-			bool lAlreadySeen = false;
-			foreach(VersionData *lVersion, lSubNode->mVersionList) {
-				if(lVersion->mOid == *lOid) {
-					lAlreadySeen = true;
-					break;
-				}
+		} else {
+			qint64 lModifiedDate = lCurrentVersion.mModifiedDate;
+			qint64 lSize = -1;
+			if(lMetadataIndex < mMetadataList.count()) {
+				const Metadata &lMetadata = mMetadataList.at(lMetadataIndex++);
+				lModifiedDate = lMetadata.mMtime;
+				lSize = lMetadata.mSize;
 			}
-			if(S_ISDIR(lMode)) {
-				if(!lAlreadySeen) {
-					lSubNode->mVersionList.append(new VersionData(lOid, lCurrentVersion->mCommitTime,
-					                                              lCurrentVersion->mModifiedDate, 0));
-				}
-			} else {
-				qint64 lModifiedDate = lCurrentVersion->mModifiedDate;
-				qint64 lSize = -1;
-				Metadata lMetadata;
-				if(lMetadataStream != nullptr && 0 == readMetadata(*lMetadataStream, lMetadata)) {
-					lModifiedDate = lMetadata.mMtime;
-					lSize = lMetadata.mSize;
-				}
-				if(!lAlreadySeen) {
-					VersionData *lVersionData;
-					if(lSize >= 0) {
-						lVersionData = new VersionData(lOid, lCurrentVersion->mCommitTime, lModifiedDate, static_cast<quint64>(lSize));
-					} else {
-						lVersionData = new VersionData(lChunked, lOid, lCurrentVersion->mCommitTime, lModifiedDate);
-					}
-					lSubNode->mVersionList.append(lVersionData);
-				}
+			if(!lAlreadySeen) {
+				update(lEntry).mVersions.append(*lOid, lCurrentVersion.mCommitTime, lModifiedDate, lSize, lChunked);
 			}
 		}
-		if(lMetadataStream != nullptr) {
-			delete lMetadataStream;
-			git_blob_free(lMetadataBlob);
-		}
-		git_tree_free(lTree);
 	}
-	std::sort(mSubNodes->begin(), mSubNodes->end(), mergedNodeLessThan);
-	foreach(MergedNode *lNode, *mSubNodes) {
-		std::sort(lNode->mVersionList.begin(), lNode->mVersionList.end(), versionGreaterThan);
+	git_tree_free(lTree);
+	return true;
+}
+
+QVector<TreeMerger::Update> TreeMerger::takeUpdates() {
+	QVector<Update> lUpdates;
+	lUpdates.swap(mUpdates);
+	mUpdateIndexes.clear();
+	return lUpdates;
+}
+
+int TreeMerger::entry(QString pName, uint pMode) {
+	int lEntry = mEntryIndexes.value(pName, -1);
+	if(lEntry >= 0 && (S_IFMT & pMode) != (S_IFMT & mEntries.at(lEntry).mMode)) {
+		appendTypeSuffix(pName, pMode);
+		lEntry = mEntryIndexes.value(pName, -1);
+	}
+	if(lEntry < 0) {
+		lEntry = mEntries.count();
+		mEntries.append({pName, pMode, QSet<git_oid>()});
+		mEntryIndexes.insert(pName, lEntry);
+		update(lEntry);
+	}
+	return lEntry;
+}
+
+TreeMerger::Update &TreeMerger::update(int pEntry) {
+	int lIndex = mUpdateIndexes.value(pEntry, -1);
+	if(lIndex < 0) {
+		lIndex = mUpdates.count();
+		mUpdates.append({pEntry, mEntries.at(pEntry).mName, mEntries.at(pEntry).mMode, VersionList()});
+		mUpdateIndexes.insert(pEntry, lIndex);
 	}
+	return mUpdates[lIndex];
 }
 
-MergedRepository::MergedRepository(QObject *pParent, const QString &pRepositoryPath, QString pBranchName)
-   : MergedNode(pParent, pRepositoryPath, DEFAULT_MODE_DIRECTORY), mBranchName(std::move(pBranchName))
+MergedRepository::MergedRepository(const QString &pRepositoryPath, QString pBranchName)
+   : MergedNode(nullptr, pRepositoryPath, DEFAULT_MODE_DIRECTORY), mBranchName(std::move(pBranchName))
 {
-	if(!objectName().endsWith(QLatin1Char('/'))) {
-		setObjectName(objectName() + QLatin1Char('/'));
+	if(!mName.endsWith(QLatin1Char('/'))) {
+		mName.append(QLatin1Char('/'));
 	}
 }
 
 MergedRepository::~MergedRepository() {
+	delete mHistory;
+	mHistory = nullptr;
 	if(mRepository != nullptr) {
 		git_repository_free(mRepository);
 	}
 }
 
 bool MergedRepository::open() {
-	if(0 != git_repository_open(&mRepository, objectName().toLocal8Bit())) {
-		qCWarning(KUPFILEDIGGER) << "could not open repository " << objectName();
+	if(0 != git_repository_open(&mRepository, mName.toLocal8Bit())) {
+		qCWarning(KUPFILEDIGGER) << "could not open repository " << mName;
 		mRepository = nullptr;
 		return false;
 	}
+	addBupOdbBackend(mRepository);
 	return true;
 }
 
@@ -225,16 +416,33 @@ bool MergedRepository::readBranch() {
 	if(mRepository == nullptr) {
 		return false;
 	}
+	if(mHistory == nullptr) {
+		mHistory = new MergedHistory(QByteArray("refs/heads/") + mBranchName.toLocal8Bit());
+	}
+	// kup-search brings the history up to date after each save. Making it here
+	// would read the whole history of the branch the first time, so until it
+	// is there all commits are read and folders are merged as they are opened.
+	// A history of an older head is not used at all.
+	if(mHistory->open(mRepository)) {
+		const MergedHistory::Node lRoot = mHistory->node(0);
+		for(quint32 i = lRoot.mFirstVersion; i < lRoot.mFirstVersion + lRoot.mVersionCount; ++i) {
+			const MergedHistory::Version lVersion = mHistory->version(i);
+			mVersionList.append(lVersion.mOid, lVersion.mCommitTime, lVersion.mCommitTime, 0);
+		}
+		mHistoryNode = 0;
+		return !mVersionList.isEmpty();
+	}
+	qCWarning(KUPFILEDIGGER) << "no merged history of the current saves in repository " << mName;
 	git_revwalk *lRevisionWalker;
 	if(0 != git_revwalk_new(&lRevisionWalker, mRepository)) {
-		qCWarning(KUPFILEDIGGER) << "could not create a revision walker in repository " << objectName();
+		qCWarning(KUPFILEDIGGER) << "could not create a revision walker in repository " << mName;
 		return false;
 	}
 
 	QString lCompleteBranchName = QStringLiteral("refs/heads/");
 	lCompleteBranchName.append(mBranchName);
 	if(0 != git_revwalk_push_ref(lRevisionWalker, lCompleteBranchName.toLocal8Bit())) {
-		qCWarning(KUPFILEDIGGER) << "Unable to read branch " << mBranchName << " in repository " << objectName();
+		qCWarning(KUPFILEDIGGER) << "Unable to read branch " << mBranchName << " in repository " << mName;
 		git_revwalk_free(lRevisionWalker);
 		return false;
 	}
@@ -246,7 +454,7 @@ bool MergedRepository::readBranch() {
 			continue;
 		}
 		git_time_t lTime = git_commit_time(lCommit);
-		mVersionList.append(new VersionData(git_commit_tree_id(lCommit), lTime, lTime, 0));
+		mVersionList.append(*git_commit_tree_id(lCommit), lTime, lTime, 0);
 		lEmptyList = false;
 		git_commit_free(lCommit);
 	}
@@ -258,7 +466,7 @@ bool MergedRepository::permissionsOk() {
 	if(mRepository == nullptr) {
 		return false;
 	}
-	QDir lRepoDir(objectName());
+	QDir lRepoDir(mName);
 	if(!lRepoDir.exists()) {
 		return false;
 	}
@@ -277,34 +485,3 @@ bool MergedRepository::permissionsOk() {
 	}
 	return true;
 }
-
-uint qHash(git_oid pOid) {
-	return qHash(QByteArray::fromRawData(reinterpret_cast<const char *>(pOid.id), GIT_OID_RAWSZ));
-}
-
-
-bool operator ==(const git_oid &pOidA, const git_oid &pOidB) {
-	QByteArray a = QByteArray::fromRawData(reinterpret_cast<const char *>(pOidA.id), GIT_OID_RAWSZ);
-	QByteArray b = QByteArray::fromRawData(reinterpret_cast<const char *>(pOidB.id), GIT_OID_RAWSZ);
-	return a == b;
-}
-
-
-quint64 VersionData::size() {
-	if(mSizeIsValid) {
-		return mSize;
-	}
-	if(mChunkedFile) {
-		mSize = calculateChunkFileSize(&mOid, MergedNode::mRepository);
-	} else {
-		git_blob *lBlob;
-		if(0 == git_blob_lookup(&lBlob, MergedNode::mRepository, &mOid)) {
-			mSize = static_cast<quint64>(git_blob_rawsize(lBlob));
-			git_blob_free(lBlob);
-		} else {
-			mSize = 0;
-		}
-	}
-	mSizeIsValid = true;
-	return mSize;
-}
@@ -5,80 +5,175 @@
 #ifndef MERGEDVFS_H
 #define MERGEDVFS_H
 
-#include <git2.h>
-uint qHash(git_oid pOid);
-bool operator ==(const git_oid &pOidA, const git_oid &pOidB);
+#include "vfshelpers.h"
+
 #include <QHash>
-#include <QObject>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QVector>
 
 #include <QUrl>
 
 #include <sys/stat.h>
 
-struct VersionData {
-	VersionData(bool pChunkedFile, const git_oid *pOid, qint64 pCommitTime, qint64 pModifiedDate)
-	   :mChunkedFile(pChunkedFile), mOid(*pOid), mCommitTime(pCommitTime), mModifiedDate(pModifiedDate)
-	{
-		mSizeIsValid = false;
-	}
-
-	VersionData(const git_oid *pOid, qint64 pCommitTime, qint64 pModifiedDate, quint64 pSize)
-	   :mOid(*pOid), mCommitTime(pCommitTime), mModifiedDate(pModifiedDate), mSize(pSize)
-	{
-		mSizeIsValid = true;
-	}
+class MergedHistory;
+class MergedNode;
+typedef QList<MergedNode*> MergedNodeList;
+typedef QListIterator<MergedNode*> MergedNodeListIterator;
 
-	quint64 size();
-	bool mSizeIsValid;
-	bool mChunkedFile;
-	git_oid mOid;
-	qint64 mCommitTime;
-	qint64 mModifiedDate;
+// The versions of one node. Each field has an array of its own, all of them
+// in one allocation, since there are many nodes with only one version and
+// sorting needs nothing but the modification dates.
+class VersionList {
+public:
+	VersionList() = default;
+	VersionList(const VersionList &pOther);
+	VersionList(VersionList &&pOther) noexcept;
+	VersionList &operator=(VersionList pOther);
+	~VersionList() { delete[] mData; }
+	void swap(VersionList &pOther) noexcept;
+
+	int count() const { return mCount; }
+	bool isEmpty() const { return mCount == 0; }
+	void reserve(int pCapacity);
+	// pSize is -1 if not known, it is then read from the repository when asked for.
+	void append(const git_oid &pOid, qint64 pCommitTime, qint64 pModifiedDate, qint64 pSize, bool pChunked = false);
+	void append(const VersionList &pOther);
+	// Newest first, versions with the same date keep their order.
+	void sortByModifiedDate();
+
+	const git_oid &oid(int pIndex) const { return oids()[pIndex]; }
+	qint64 commitTime(int pIndex) const { return commitTimes()[pIndex]; }
+	qint64 modifiedDate(int pIndex) const { return modifiedDates()[pIndex]; }
+	bool isChunked(int pIndex) const { return chunked()[pIndex] != 0; }
+	// Sizes are a cache, read from the repository when first asked for.
+	bool isSizeKnown(int pIndex) const { return sizes()[pIndex] >= 0; }
+	quint64 size(int pIndex) const;
+	void cacheSize(int pIndex, quint64 pSize) const { sizes()[pIndex] = static_cast<qint64>(pSize); }
+	// Reads only object headers, can be used from any thread with a repository of its own.
+	static quint64 readSize(git_repository *pRepository, const git_oid &pOid, bool pChunked);
+	quint64 memoryUsed() const { return bytesFor(mCapacity); }
 
 protected:
-	quint64 mSize;
+	static quint64 bytesFor(int pCapacity);
+	qint64 *modifiedDates() const { return reinterpret_cast<qint64 *>(mData); }
+	qint64 *commitTimes() const { return modifiedDates() + mCapacity; }
+	qint64 *sizes() const { return commitTimes() + mCapacity; }
+	git_oid *oids() const { return reinterpret_cast<git_oid *>(sizes() + mCapacity); }
+	quint8 *chunked() const { return reinterpret_cast<quint8 *>(oids() + mCapacity); }
+
+	char *mData{};
+	int mCount{};
+	int mCapacity{};
 };
 
-class MergedNode;
-typedef QList<MergedNode*> MergedNodeList;
-typedef QListIterator<MergedNode*> MergedNodeListIterator;
-typedef QList<VersionData *> VersionList;
-typedef QListIterator<VersionData *> VersionListIterator;
-
-class MergedNode: public QObject {
-	Q_OBJECT
-	friend struct VersionData;
+// Not a QObject, there is one of these for every file and folder ever saved.
+class MergedNode {
+	friend class VersionList;
+	friend class MergedVfsModel;
 public:
-	MergedNode(QObject *pParent, const QString &pName, uint pMode);
-	~MergedNode() override {
-		delete mSubNodes;
-		while (!mVersionList.isEmpty()) delete mVersionList.takeFirst();
-	}
+	struct MemoryUse {
+		qint64 mNodes;
+		qint64 mVersions;
+		quint64 mBytes;
+	};
+
+	MergedNode(MergedNode *pParent, QString pName, uint pMode);
+	virtual ~MergedNode();
+	MergedNode *parent() const { return mParent; }
+	const QString &name() const { return mName; }
 	bool isDirectory() const { return S_ISDIR(mMode); }
 	void getBupUrl(int pVersionIndex, QUrl *pComplete, QString *pRepoPath = nullptr, QString *pBranchName = nullptr,
 	               qint64 *pCommitTime = nullptr, QString *pPathInRepo = nullptr) const;
+	// Merges the sub nodes first if that has not been done yet.
 	virtual MergedNodeList &subNodes();
 	const VersionList *versionList() const { return &mVersionList; }
 	uint mode() const { return mMode; }
+	// Adds this node and the sub nodes it has so far, estimated.
+	void addMemoryUse(MemoryUse &pUse) const;
 	static void askForIntegrityCheck();
 
 protected:
+	Q_DISABLE_COPY(MergedNode)
 	virtual void generateSubNodes();
+	void readSubNodesFromHistory();
 
 	static git_repository *mRepository;
+	static MergedHistory *mHistory;
+	MergedNode *mParent;
+	QString mName;
 	uint mMode;
 	VersionList mVersionList;
 	MergedNodeList *mSubNodes;
+	qint64 mHistoryNode; // -1 if not in the merged history
+};
+
+bool mergedNodeLessThan(const MergedNode *a, const MergedNode *b);
+
+// Merges the trees of all versions of a folder into its sub nodes, one tree
+// at a time, skipping trees already merged. Uses only the repository handle
+// it is given, so that it can run in a worker thread.
+class TreeMerger {
+public:
+	struct Version {
+		git_oid mOid;
+		qint64 mCommitTime;
+		qint64 mModifiedDate;
+	};
+	// A sub node with the versions of it found since the last takeUpdates().
+	struct Update {
+		int mEntry; // sub nodes are numbered in the order they are found
+		QString mName;
+		uint mMode;
+		VersionList mVersions;
+	};
+
+	TreeMerger(git_repository *pRepository, QVector<Version> pVersions);
+	static QVector<Version> versions(const VersionList &pVersionList);
+	bool atEnd() const { return mNext >= mVersions.count(); }
+	int position() const { return mNext; }
+	int count() const { return mVersions.count(); }
+	// Returns false if the tree of the next version could not be read.
+	bool mergeNext();
+	// New sub nodes come in the order they were found.
+	QVector<Update> takeUpdates();
+
+protected:
+	struct Entry {
+		QString mName;
+		uint mMode;
+		QSet<git_oid> mSeenOids; // to skip versions already added
+	};
+	int entry(QString pName, uint pMode);
+	Update &update(int pEntry);
+
+	git_repository *mRepository;
+	QVector<Version> mVersions;
+	int mNext;
+	QSet<git_oid> mSeenTrees;
+	QVector<Entry> mEntries;
+	QHash<QString, int> mEntryIndexes;
+	QVector<Update> mUpdates;
+	QHash<int, int> mUpdateIndexes; // of entries in mUpdates
+	QVector<Metadata> mMetadataList; // reused for all versions
 };
 
+typedef QVector<TreeMerger::Version> MergeVersions;
+typedef QVector<TreeMerger::Update> MergeUpdates;
+
 class MergedRepository: public MergedNode {
-	Q_OBJECT
 public:
-	MergedRepository(QObject *pParent, const QString &pRepositoryPath, QString pBranchName);
+	MergedRepository(const QString &pRepositoryPath, QString pBranchName);
 	~MergedRepository() override;
 
 	bool open();
+	// Uses the saved merged history of the branch if it is of the current
+	// head, otherwise all commits are read.
 	bool readBranch();
+	bool usesHistory() const {
+		return mHistoryNode >= 0;
+	}
 	bool permissionsOk();
 
 	QString mBranchName;
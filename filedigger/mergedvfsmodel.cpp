@@ -4,21 +4,92 @@
 
 #include "mergedvfsmodel.h"
 #include "mergedvfs.h"
+#include "threadrepository.h"
 #include "vfshelpers.h"
 
 #include <KIO/Global>
+#include <KLocalizedString>
 
+#include <QElapsedTimer>
+#include <QFont>
 #include <QIcon>
 #include <QMimeDatabase>
 #include <QMimeType>
 #include <QPixmap>
+#include <QThread>
+
+#include <algorithm>
+
+// How often the sub nodes found so far are shown while merging a folder.
+static const int cProgressInterval = 200; // milliseconds
+
+void MergeWorker::cancel(quint32 pJob) {
+	QMutexLocker lLocker(&mMutex);
+	mCanceledJobs.insert(pJob);
+}
+
+void MergeWorker::forget(quint32 pJob) {
+	QMutexLocker lLocker(&mMutex);
+	mCanceledJobs.remove(pJob);
+}
+
+void MergeWorker::merge(quint32 pJob, const QByteArray &pRepositoryPath, const MergeVersions &pVersions) {
+	if(takeCanceled(pJob)) {
+		return;
+	}
+	git_repository *lRepository = threadRepository(pRepositoryPath);
+	if(lRepository == nullptr) {
+		emit finished(pJob, MergeUpdates(), true);
+		return;
+	}
+	TreeMerger lMerger(lRepository, pVersions);
+	bool lReadError = false;
+	QElapsedTimer lTimer;
+	lTimer.start();
+	while(!lMerger.atEnd()) {
+		if(takeCanceled(pJob)) {
+			return;
+		}
+		if(!lMerger.mergeNext()) {
+			lReadError = true;
+		}
+		if(lTimer.hasExpired(cProgressInterval)) {
+			emit progress(pJob, lMerger.takeUpdates(), lMerger.position(), lMerger.count());
+			lTimer.restart();
+		}
+	}
+	emit finished(pJob, lMerger.takeUpdates(), lReadError);
+}
+
+bool MergeWorker::takeCanceled(quint32 pJob) {
+	QMutexLocker lLocker(&mMutex);
+	return mCanceledJobs.remove(pJob);
+}
+
 
 MergedVfsModel::MergedVfsModel(MergedRepository *pRoot, QObject *pParent) :
-   QAbstractItemModel(pParent), mRoot(pRoot)
+   QAbstractItemModel(pParent), mRoot(pRoot), mNextJob(0)
 {
+	qRegisterMetaType<MergeVersions>("MergeVersions");
+	qRegisterMetaType<MergeUpdates>("MergeUpdates");
+
+	mWorkerThread = new QThread(this);
+	mWorker = new MergeWorker;
+	mWorker->moveToThread(mWorkerThread);
+	connect(mWorkerThread, &QThread::finished, mWorker, &QObject::deleteLater);
+	connect(this, &MergedVfsModel::mergeRequested, mWorker, &MergeWorker::merge);
+	connect(mWorker, &MergeWorker::progress, this, &MergedVfsModel::addMerged);
+	connect(mWorker, &MergeWorker::finished, this, &MergedVfsModel::finishMerge);
+	mWorkerThread->start();
 }
 
 MergedVfsModel::~MergedVfsModel() {
+	foreach(quint32 lJob, mMerges.keys()) {
+		mWorker->cancel(lJob);
+	}
+	mWorkerThread->quit();
+	mWorkerThread->wait();
+	qDeleteAll(mMerges);
 	delete mRoot;
 }
 
@@ -32,11 +103,29 @@ QVariant MergedVfsModel::data(const QModelIndex &pIndex, int pRole) const {
 		return QVariant();
 	}
 	auto *lNode = static_cast<MergedNode *>(pIndex.internalPointer());
+	if(lNode->mMode == 0) { // placeholder
+		const Merge *lMerge = mMerges.value(mMergeJobs.value(lNode->parent()));
+		switch (pRole) {
+		case Qt::DisplayRole:
+			if(lMerge == nullptr || lMerge->mCount == 0) {
+				return i18nc("@item:inlistbox shown while reading a folder", "Reading all versions…");
+			}
+			return i18nc("@item:inlistbox shown while reading a folder, %1 is percent done",
+			             "Reading all versions, %1% done…", 100 * lMerge->mPosition / lMerge->mCount);
+		case Qt::FontRole: {
+			QFont lFont;
+			lFont.setItalic(true);
+			return lFont;
+		}
+		default:
+			return QVariant();
+		}
+	}
 	switch (pRole) {
 	case Qt::DisplayRole:
-		return lNode->objectName();
+		return lNode->name();
 	case Qt::DecorationRole: {
-		QString lIconName = KIO::iconNameForUrl(QUrl::fromLocalFile(lNode->objectName()));
+		QString lIconName = KIO::iconNameForUrl(QUrl::fromLocalFile(lNode->name()));
 		if(lNode->isDirectory()) {
 			QMimeDatabase db;
 			lIconName = db.mimeTypeForName(QStringLiteral("inode/directory")).iconName();
@@ -48,21 +137,28 @@ QVariant MergedVfsModel::data(const QModelIndex &pIndex, int pRole) const {
 	}
 }
 
+Qt::ItemFlags MergedVfsModel::flags(const QModelIndex &pIndex) const {
+	if(pIndex.isValid() && static_cast<MergedNode *>(pIndex.internalPointer())->mMode == 0) {
+		return Qt::ItemIsEnabled;
+	}
+	return QAbstractItemModel::flags(pIndex);
+}
+
 QModelIndex MergedVfsModel::index(int pRow, int pColumn, const QModelIndex &pParent) const {
 	if(pColumn != 0 || pRow < 0) {
 		return {}; // invalid
 	}
-	if(!pParent.isValid()) {
-		if(pRow >= mRoot->subNodes().count()) {
-			return {}; // invalid
-		}
-		return createIndex(pRow, 0, mRoot->subNodes().at(pRow));
-	}
-	auto lParentNode = static_cast<MergedNode *>(pParent.internalPointer());
-	if(pRow >= lParentNode->subNodes().count()) {
+	MergedNode *lParentNode = nodeOrRoot(pParent);
+	if(lParentNode->mSubNodes == nullptr) {
 		return {}; // invalid
 	}
-	return createIndex(pRow, 0, lParentNode->subNodes().at(pRow));
+	if(pRow < lParentNode->mSubNodes->count()) {
+		return createIndex(pRow, 0, lParentNode->mSubNodes->at(pRow));
+	}
+	if(pRow == lParentNode->mSubNodes->count() && mMergeJobs.contains(lParentNode)) {
+		return createIndex(pRow, 0, mMerges.value(mMergeJobs.value(lParentNode))->mPlaceholder);
+	}
+	return {}; // invalid
 }
 
 QModelIndex MergedVfsModel::parent(const QModelIndex &pChild) const {
@@ -70,26 +166,61 @@ QModelIndex MergedVfsModel::parent(const QModelIndex &pChild) const {
 		return {};
 	}
 	auto lChild = static_cast<MergedNode *>(pChild.internalPointer());
-	auto lParent = qobject_cast<MergedNode *>(lChild->parent());
+	MergedNode *lParent = lChild->parent();
 	if(lParent == nullptr || lParent == mRoot) {
 		return {}; //invalid
 	}
-	auto lGrandParent = qobject_cast<MergedNode *>(lParent->parent());
-	if(lGrandParent == nullptr) {
-		return {}; //invalid
-	}
-	return createIndex(lGrandParent->subNodes().indexOf(lParent), 0, lParent);
+	return indexOf(lParent);
 }
 
 int MergedVfsModel::rowCount(const QModelIndex &pParent) const {
-	if(!pParent.isValid()) {
-		return mRoot->subNodes().count();
-	}
-	auto lParent = static_cast<MergedNode *>(pParent.internalPointer());
-	if(lParent == nullptr) {
+	const MergedNode *lParent = nodeOrRoot(pParent);
+	if(lParent->mSubNodes == nullptr) {
 		return 0;
 	}
-	return lParent->subNodes().count();
+	return lParent->mSubNodes->count() + (mMergeJobs.contains(lParent) ? 1 : 0);
+}
+
+bool MergedVfsModel::hasChildren(const QModelIndex &pParent) const {
+	return rowCount(pParent) > 0 || canFetchMore(pParent);
+}
+
+bool MergedVfsModel::canFetchMore(const QModelIndex &pParent) const {
+	const MergedNode *lParent = nodeOrRoot(pParent);
+	return lParent->isDirectory() && lParent->mSubNodes == nullptr;
+}
+
+void MergedVfsModel::fetchMore(const QModelIndex &pParent) {
+	if(!canFetchMore(pParent)) {
+		return;
+	}
+	MergedNode *lNode = nodeOrRoot(pParent);
+	if(lNode->mHistoryNode >= 0) {
+		// all in the merged history already, nothing to wait for
+		int lCount = static_cast<int>(MergedNode::mHistory->node(static_cast<quint32>(lNode->mHistoryNode)).mChildCount);
+		if(lCount > 0) {
+			beginInsertRows(pParent, 0, lCount - 1);
+		}
+		lNode->subNodes();
+		if(lCount > 0) {
+			endInsertRows();
+		}
+		return;
+	}
+	quint32 lJob = mNextJob++;
+	beginInsertRows(pParent, 0, 0);
+	lNode->mSubNodes = new MergedNodeList();
+	mMerges.insert(lJob, new Merge{lNode, new MergedNode(lNode, QString(), 0), {}, 0, 0, false});
+	mMergeJobs.insert(lNode, lJob);
+	endInsertRows();
+	if(!mMergeJobs.contains(lNode->parent())) {
+		startMerge(lJob);
+	}
+}
+
+bool MergedVfsModel::isMerged(const QModelIndex &pIndex) const {
+	const MergedNode *lNode = nodeOrRoot(pIndex);
+	return !lNode->isDirectory() || (lNode->mSubNodes != nullptr && !mMergeJobs.contains(lNode));
 }
 
 const VersionList *MergedVfsModel::versionList(const QModelIndex &pIndex) {
@@ -101,3 +232,148 @@ const MergedNode *MergedVfsModel::node(const QModelIndex &pIndex) {
 	return static_cast<MergedNode *>(pIndex.internalPointer());
 }
 
+void MergedVfsModel::cancelMerge(const QModelIndex &pIndex) {
+	MergedNode *lNode = nodeOrRoot(pIndex);
+	if(!mMergeJobs.contains(lNode)) {
+		return;
+	}
+	quint32 lJob = mMergeJobs.value(lNode);
+	Merge *lMerge = mMerges.value(lJob);
+	if(lMerge->mStarted) {
+		mWorker->cancel(lJob);
+	}
+	MergedNodeList *lSubNodes = lNode->mSubNodes;
+	beginRemoveRows(pIndex, 0, lSubNodes->count());
+	// sub nodes waiting for this one go away with it
+	foreach(MergedNode *lSubNode, *lSubNodes) {
+		if(mMergeJobs.contains(lSubNode)) {
+			delete mMerges.take(mMergeJobs.take(lSubNode));
+		}
+	}
+	mMerges.remove(lJob);
+	mMergeJobs.remove(lNode);
+	lNode->mSubNodes = nullptr;
+	endRemoveRows();
+	qDeleteAll(*lSubNodes);
+	delete lSubNodes;
+	delete lMerge;
+}
+
+void MergedVfsModel::addMerged(quint32 pJob, const MergeUpdates &pUpdates, int pPosition, int pCount) {
+	Merge *lMerge = mMerges.value(pJob);
+	if(lMerge == nullptr) { // canceled
+		return;
+	}
+	lMerge->mPosition = pPosition;
+	lMerge->mCount = pCount;
+	addUpdates(*lMerge, pUpdates);
+	QModelIndex lPlaceholder = index(lMerge->mNode->mSubNodes->count(), 0, indexOf(lMerge->mNode));
+	emit dataChanged(lPlaceholder, lPlaceholder);
+}
+
+void MergedVfsModel::finishMerge(quint32 pJob, const MergeUpdates &pUpdates, bool pReadError) {
+	Merge *lMerge = mMerges.value(pJob);
+	if(lMerge == nullptr) { // canceled after the worker was done with it
+		mWorker->forget(pJob);
+		return;
+	}
+	addUpdates(*lMerge, pUpdates);
+	MergedNode *lNode = lMerge->mNode;
+	QModelIndex lIndex = indexOf(lNode);
+	int lPlaceholderRow = lNode->mSubNodes->count();
+	beginRemoveRows(lIndex, lPlaceholderRow, lPlaceholderRow);
+	mMerges.remove(pJob);
+	mMergeJobs.remove(lNode);
+	endRemoveRows();
+	delete lMerge;
+
+	// the versions of the sub nodes are all known now
+	QList<quint32> lJobs = mMerges.keys();
+	std::sort(lJobs.begin(), lJobs.end());
+	foreach(quint32 lJob, lJobs) {
+		if(!mMerges.value(lJob)->mStarted && mMerges.value(lJob)->mNode->parent() == lNode) {
+			startMerge(lJob);
+		}
+	}
+	emit merged(lIndex);
+	if(pReadError) {
+		MergedNode::askForIntegrityCheck();
+	}
+}
+
+MergedNode *MergedVfsModel::nodeOrRoot(const QModelIndex &pIndex) const {
+	if(!pIndex.isValid()) {
+		return mRoot;
+	}
+	return static_cast<MergedNode *>(pIndex.internalPointer());
+}
+
+QModelIndex MergedVfsModel::indexOf(MergedNode *pNode) const {
+	MergedNode *lParent = pNode->parent();
+	if(pNode == mRoot || lParent == nullptr || lParent->mSubNodes == nullptr) {
+		return {}; //invalid
+	}
+	// sub nodes are kept sorted, each name is there only once
+	const MergedNodeList &lSubNodes = *lParent->mSubNodes;
+	auto lFound = std::lower_bound(lSubNodes.begin(), lSubNodes.end(), pNode, mergedNodeLessThan);
+	if(lFound == lSubNodes.end() || *lFound != pNode) {
+		return {}; //invalid
+	}
+	return createIndex(static_cast<int>(lFound - lSubNodes.begin()), 0, pNode);
+}
+
+void MergedVfsModel::startMerge(quint32 pJob) {
+	Merge *lMerge = mMerges.value(pJob);
+	lMerge->mStarted = true;
+	emit mergeRequested(pJob, mRoot->name().toLocal8Bit(), TreeMerger::versions(lMerge->mNode->mVersionList));
+}
+
+void MergedVfsModel::addUpdates(Merge &pMerge, const MergeUpdates &pUpdates) {
+	MergedNode *lNode = pMerge.mNode;
+	const QModelIndex lParentIndex = indexOf(lNode);
+	MergedNodeList &lSubNodes = *lNode->mSubNodes;
+	QVector<MergedNode *> lNewNodes;
+	int lFirstChanged = lSubNodes.count();
+	int lLastChanged = -1;
+	foreach(const TreeMerger::Update &lUpdate, pUpdates) {
+		MergedNode *lSubNode;
+		bool lNew = lUpdate.mEntry >= pMerge.mEntries.count();
+		if(lNew) {
+			// new sub nodes come in the order they were found
+			lSubNode = new MergedNode(lNode, lUpdate.mName, lUpdate.mMode);
+			pMerge.mEntries.append(lSubNode);
+			lNewNodes.append(lSubNode);
+		} else {
+			lSubNode = pMerge.mEntries.at(lUpdate.mEntry);
+		}
+		lSubNode->mVersionList.append(lUpdate.mVersions);
+		lSubNode->mVersionList.sortByModifiedDate();
+		if(!lNew) {
+			int lRow = indexOf(lSubNode).row();
+			lFirstChanged = qMin(lFirstChanged, lRow);
+			lLastChanged = qMax(lLastChanged, lRow);
+		}
+	}
+	if(lLastChanged >= 0) {
+		emit dataChanged(index(lFirstChanged, 0, lParentIndex), index(lLastChanged, 0, lParentIndex));
+	}
+
+	// Insert the new ones in sorted order, each run of them that goes in
+	// the same place as one range of rows.
+	std::sort(lNewNodes.begin(), lNewNodes.end(), mergedNodeLessThan);
+	int i = 0;
+	while(i < lNewNodes.count()) {
+		auto lRow = static_cast<int>(std::lower_bound(lSubNodes.begin(), lSubNodes.end(), lNewNodes.at(i), mergedNodeLessThan)
+		                             - lSubNodes.begin());
+		int j = i + 1;
+		while(j < lNewNodes.count() && (lRow == lSubNodes.count() || mergedNodeLessThan(lNewNodes.at(j), lSubNodes.at(lRow)))) {
+			++j;
+		}
+		beginInsertRows(lParentIndex, lRow, lRow + j - i - 1);
+		for(int k = i; k < j; ++k) {
+			lSubNodes.insert(lRow + k - i, lNewNodes.at(k));
+		}
+		endInsertRows();
+		i = j;
+	}
+}
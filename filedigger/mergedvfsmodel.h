@@ -6,9 +6,42 @@
 #define MERGEDVFSMODEL_H
 
 #include <QAbstractItemModel>
+#include <QMutex>
 
 #include "mergedvfs.h"
 
+class QThread;
+
+// Merges folders in a thread of its own, one at a time in the order asked
+// for, reporting the sub nodes found so far every now and then.
+class MergeWorker : public QObject {
+	Q_OBJECT
+public:
+	// Can be called from any thread, the merge stops before its next tree.
+	void cancel(quint32 pJob);
+	// For a job that had finished before it was canceled.
+	void forget(quint32 pJob);
+
+public slots:
+	void merge(quint32 pJob, const QByteArray &pRepositoryPath, const MergeVersions &pVersions);
+
+signals:
+	void progress(quint32 pJob, const MergeUpdates &pUpdates, int pPosition, int pCount);
+	void finished(quint32 pJob, const MergeUpdates &pUpdates, bool pReadError);
+
+protected:
+	bool takeCanceled(quint32 pJob);
+
+	QMutex mMutex;
+	QSet<quint32> mCanceledJobs;
+};
+
+// Sub nodes of a folder are read from the merged history of the branch when
+// there is one. Otherwise they are merged when the view fetches them. They are
+// inserted as they are found, with a placeholder row after them that shows
+// progress until all versions of the folder have been merged. Sub nodes of a folder
+// that is still being merged are merged when it is done, their own versions
+// are not all known before that.
 class MergedVfsModel : public QAbstractItemModel
 {
 	Q_OBJECT
@@ -17,16 +50,55 @@ public:
 	~MergedVfsModel() override;
 	int columnCount(const QModelIndex &pParent) const override;
 	QVariant data(const QModelIndex &pIndex, int pRole) const override;
+	Qt::ItemFlags flags(const QModelIndex &pIndex) const override;
 	QModelIndex index(int pRow, int pColumn, const QModelIndex &pParent) const override;
 	QModelIndex parent(const QModelIndex &pChild) const override;
 	int rowCount(const QModelIndex &pParent) const override;
+	bool hasChildren(const QModelIndex &pParent) const override;
+	bool canFetchMore(const QModelIndex &pParent) const override;
+	void fetchMore(const QModelIndex &pParent) override;
 
+	// Whether all sub nodes of pIndex are known. Always true after fetchMore()
+	// for nodes from the merged history.
+	bool isMerged(const QModelIndex &pIndex) const;
 	static const VersionList *versionList(const QModelIndex &pIndex);
 	static const MergedNode *node(const QModelIndex &pIndex);
 
+public slots:
+	// Throws away what has been merged of pIndex so far, it is merged again
+	// when fetched the next time. Nothing happens if merging it is done.
+	void cancelMerge(const QModelIndex &pIndex);
+
+signals:
+	// When merging pIndex in the worker thread is done.
+	void merged(const QModelIndex &pIndex);
+	void mergeRequested(quint32 pJob, const QByteArray &pRepositoryPath, const MergeVersions &pVersions);
+
+protected slots:
+	void addMerged(quint32 pJob, const MergeUpdates &pUpdates, int pPosition, int pCount);
+	void finishMerge(quint32 pJob, const MergeUpdates &pUpdates, bool pReadError);
+
 protected:
-	MergedRepository *mRoot;
+	struct Merge {
+		~Merge() { delete mPlaceholder; }
+		MergedNode *mNode;
+		MergedNode *mPlaceholder; // shown after the sub nodes while merging
+		QVector<MergedNode *> mEntries; // sub nodes in the order they were found
+		int mPosition;
+		int mCount;
+		bool mStarted; // waiting for the parent to be merged otherwise
+	};
+	MergedNode *nodeOrRoot(const QModelIndex &pIndex) const;
+	QModelIndex indexOf(MergedNode *pNode) const;
+	void startMerge(quint32 pJob);
+	void addUpdates(Merge &pMerge, const MergeUpdates &pUpdates);
 
+	MergedRepository *mRoot;
+	QThread *mWorkerThread;
+	MergeWorker *mWorker;
+	QHash<quint32, Merge *> mMerges;
+	QHash<const MergedNode *, quint32> mMergeJobs;
+	quint32 mNextJob;
 };
 
 #endif // MERGEDVFSMODEL_H
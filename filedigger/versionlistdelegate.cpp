@@ -188,8 +188,9 @@ void VersionListDelegate::paint(QPainter *pPainter, const QStyleOptionViewItem &
 	QRect lMarginRect = pOption.rect.adjusted(cMargin, cMargin, -cMargin, -cMargin);
 
 	QRect lSizeDisplayBounds;
-	if(!pIndex.data(VersionIsDirectoryRole).toBool()) {
-		QString lSizeText = KFormat().formatByteSize(static_cast<double>(pIndex.data(VersionSizeRole).toULongLong()));
+	const QVariant lSize = pIndex.data(VersionSizeRole);
+	if(!pIndex.data(VersionIsDirectoryRole).toBool() && lSize.isValid()) {
+		QString lSizeText = KFormat().formatByteSize(static_cast<double>(lSize.toULongLong()));
 		pPainter->drawText(lMarginRect, Qt::AlignRight | Qt::AlignTop, lSizeText, &lSizeDisplayBounds);
 	}
 	QString lDateText = pOption.fontMetrics.elidedText(pIndex.data().toString(), Qt::ElideRight,
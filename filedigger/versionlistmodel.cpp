@@ -3,6 +3,7 @@
 // SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
 
 #include "versionlistmodel.h"
+#include "threadrepository.h"
 #include "vfshelpers.h"
 
 #include <KFormat>
@@ -12,18 +13,64 @@
 #include <QLocale>
 #include <QMimeDatabase>
 #include <QMimeType>
+#include <QThread>
+
+void SizeWorker::read(quint32 pJob, const QByteArray &pRepositoryPath, const SizeRequests &pRequests) {
+	git_repository *lRepository = threadRepository(pRepositoryPath);
+	if(lRepository == nullptr) {
+		return;
+	}
+	foreach(const SizeRequest &lRequest, pRequests) {
+		if(mCurrentJob.loadAcquire() != pJob) {
+			return;
+		}
+		emit sizeRead(pJob, lRequest.mIndex, VersionList::readSize(lRepository, lRequest.mOid, lRequest.mChunked));
+	}
+}
+
 
 VersionListModel::VersionListModel(QObject *parent) :
    QAbstractListModel(parent)
 {
 	mVersionList = nullptr;
+	qRegisterMetaType<SizeRequests>("SizeRequests");
+
+	mWorkerThread = new QThread(this);
+	mWorker = new SizeWorker;
+	mWorker->moveToThread(mWorkerThread);
+	connect(mWorkerThread, &QThread::finished, mWorker, &QObject::deleteLater);
+	connect(this, &VersionListModel::sizesRequested, mWorker, &SizeWorker::read);
+	connect(mWorker, &SizeWorker::sizeRead, this, &VersionListModel::setSize);
+	mWorkerThread->start();
+}
+
+VersionListModel::~VersionListModel() {
+	mWorker->setCurrentJob(mNextJob); // not used by any job
+	mWorkerThread->quit();
+	mWorkerThread->wait();
 }
 
 void VersionListModel::setNode(const MergedNode *pNode) {
 	beginResetModel();
 	mNode = pNode;
-	mVersionList = mNode->versionList();
+	mVersionList = mNode != nullptr ? mNode->versionList() : nullptr;
+	mJob = mNextJob++;
+	mWorker->setCurrentJob(mJob);
 	endResetModel();
+	if(mNode == nullptr || mNode->isDirectory()) {
+		return;
+	}
+	SizeRequests lRequests;
+	for(int i = 0; i < mVersionList->count(); ++i) {
+		if(!mVersionList->isSizeKnown(i)) {
+			lRequests.append({i, mVersionList->oid(i), mVersionList->isChunked(i)});
+		}
+	}
+	if(!lRequests.isEmpty()) {
+		QString lRepoPath;
+		mNode->getBupUrl(0, nullptr, &lRepoPath);
+		emit sizesRequested(mJob, lRepoPath.toLocal8Bit(), lRequests);
+	}
 }
 
 int VersionListModel::rowCount(const QModelIndex &pParent) const {
@@ -40,28 +87,31 @@ QVariant VersionListModel::data(const QModelIndex &pIndex, int pRole) const {
 	}
 	QMimeDatabase db;
 	KFormat lFormat;
-	VersionData *lData = mVersionList->at(pIndex.row());
+	const int lRow = pIndex.row();
 	switch (pRole) {
 	case Qt::DisplayRole:
-		return lFormat.formatRelativeDateTime(QDateTime::fromSecsSinceEpoch(static_cast<qint64>(lData->mModifiedDate)), QLocale::ShortFormat);
+		return lFormat.formatRelativeDateTime(QDateTime::fromSecsSinceEpoch(mVersionList->modifiedDate(lRow)), QLocale::ShortFormat);
 	case VersionBupUrlRole: {
 		QUrl lUrl;
-		mNode->getBupUrl(pIndex.row(), &lUrl);
+		mNode->getBupUrl(lRow, &lUrl);
 		return lUrl;
 	}
 	case VersionMimeTypeRole:
 		if(mNode->isDirectory()) {
 			return QString(QStringLiteral("inode/directory"));
 		}
-		return db.mimeTypeForFile(mNode->objectName(), QMimeDatabase::MatchExtension).name();
+		return db.mimeTypeForFile(mNode->name(), QMimeDatabase::MatchExtension).name();
 	case VersionSizeRole:
-		return lData->size();
+		if(!mVersionList->isSizeKnown(lRow)) {
+			return QVariant();
+		}
+		return mVersionList->size(lRow);
 	case VersionSourceInfoRole: {
 		BupSourceInfo lSourceInfo;
-		mNode->getBupUrl(pIndex.row(), &lSourceInfo.mBupKioPath, &lSourceInfo.mRepoPath, &lSourceInfo.mBranchName,
+		mNode->getBupUrl(lRow, &lSourceInfo.mBupKioPath, &lSourceInfo.mRepoPath, &lSourceInfo.mBranchName,
 		                 &lSourceInfo.mCommitTime, &lSourceInfo.mPathInRepo);
 		lSourceInfo.mIsDirectory = mNode->isDirectory();
-		lSourceInfo.mSize = lData->size();
+		lSourceInfo.mSize = mVersionList->size(lRow);
 		return QVariant::fromValue<BupSourceInfo>(lSourceInfo);
 	}
 	case VersionIsDirectoryRole:
@@ -70,3 +120,12 @@ QVariant VersionListModel::data(const QModelIndex &pIndex, int pRole) const {
 		return QVariant();
 	}
 }
+
+void VersionListModel::setSize(quint32 pJob, int pIndex, quint64 pSize) {
+	if(pJob != mJob || mVersionList == nullptr) { // another node by now
+		return;
+	}
+	mVersionList->cacheSize(pIndex, pSize);
+	const QModelIndex lIndex = index(pIndex, 0);
+	emit dataChanged(lIndex, lIndex);
+}
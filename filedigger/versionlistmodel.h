@@ -6,8 +6,11 @@
 #define VERSIONLISTMODEL_H
 
 #include <QAbstractListModel>
+#include <QAtomicInteger>
 #include "mergedvfs.h"
 
+class QThread;
+
 struct BupSourceInfo {
 	QUrl mBupKioPath;
 	QString mRepoPath;
@@ -20,24 +23,63 @@ struct BupSourceInfo {
 
 Q_DECLARE_METATYPE(BupSourceInfo)
 
+struct SizeRequest {
+	int mIndex;
+	git_oid mOid;
+	bool mChunked;
+};
+typedef QVector<SizeRequest> SizeRequests;
+
+// Reads the sizes of versions in a thread of its own, from object headers
+// only. A version list of a big file can take long to get through.
+class SizeWorker : public QObject {
+	Q_OBJECT
+public:
+	// Can be called from any thread, reading for any other job stops.
+	void setCurrentJob(quint32 pJob) { mCurrentJob.storeRelease(pJob); }
+
+public slots:
+	void read(quint32 pJob, const QByteArray &pRepositoryPath, const SizeRequests &pRequests);
+
+signals:
+	void sizeRead(quint32 pJob, int pIndex, quint64 pSize);
+
+protected:
+	QAtomicInteger<quint32> mCurrentJob;
+};
+
+// Sizes not read yet are read in the background, rows are updated as they
+// come in. Until then the size role has no value.
 class VersionListModel : public QAbstractListModel
 {
 	Q_OBJECT
 public:
 	explicit VersionListModel(QObject *parent = nullptr);
+	~VersionListModel() override;
+	// pNode can be nullptr, for no versions.
 	void setNode(const MergedNode *pNode);
 	int rowCount(const QModelIndex &pParent) const override;
 	QVariant data(const QModelIndex &pIndex, int pRole) const override;
 
+signals:
+	void sizesRequested(quint32 pJob, const QByteArray &pRepositoryPath, const SizeRequests &pRequests);
+
+protected slots:
+	void setSize(quint32 pJob, int pIndex, quint64 pSize);
+
 protected:
 	const VersionList *mVersionList;
 	const MergedNode *mNode{};
+	QThread *mWorkerThread;
+	SizeWorker *mWorker;
+	quint32 mJob{};
+	quint32 mNextJob{};
 };
 
 enum VersionDataRole {
 	VersionBupUrlRole = Qt::UserRole + 1, // QUrl
 	VersionMimeTypeRole, // QString
-	VersionSizeRole, // quint64
+	VersionSizeRole, // quint64, invalid until read
 	VersionSourceInfoRole, // PathInfo
 	VersionIsDirectoryRole // bool
 };
@@ -0,0 +1,70 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "blobcache.h"
+#include "bupodb.h"
+#include "sha1.h"
+#include "vfshelpers.h"
+
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <cstring>
+#include <limits>
+
+// QCache counts cost in an int, so blobs are accounted in KiB.
+static const int cCostUnit = 1024;
+
+static QMutex sCacheMutex;
+static QCache<git_oid, QByteArray> sCache(64 * 1024);
+
+bool BlobCache::mVerify = false;
+
+bool BlobCache::read(git_repository *pRepository, const git_oid *pOid, QByteArray &pData, bool *pCorrupt) {
+	if(pCorrupt != nullptr) {
+		*pCorrupt = false;
+	}
+	{
+		QMutexLocker lLocker(&sCacheMutex);
+		QByteArray *lData = sCache.object(*pOid);
+		if(lData != nullptr) {
+			pData = *lData;
+			return true;
+		}
+	}
+	// Inflate without holding the lock, other threads may be reading too.
+	// libgit2 hashes every object it reads, blobs that are checked here
+	// anyway are read past it.
+	if(!(mVerify && readBlobUnverified(pRepository, pOid, pData)) && !readBlob(pRepository, pOid, pData)) {
+		return false;
+	}
+	if(mVerify && !verify(pOid, pData)) {
+		pData.clear();
+		if(pCorrupt != nullptr) {
+			*pCorrupt = true;
+		}
+		return false;
+	}
+	QMutexLocker lLocker(&sCacheMutex);
+	if(sCache.maxCost() > 0) {
+		sCache.insert(*pOid, new QByteArray(pData), pData.size() / cCostUnit + 1);
+	}
+	return true;
+}
+
+void BlobCache::setBudget(qint64 pBudget) {
+	QMutexLocker lLocker(&sCacheMutex);
+	sCache.setMaxCost(static_cast<int>(qMin<qint64>(pBudget / cCostUnit, std::numeric_limits<int>::max())));
+}
+
+bool BlobCache::verify(const git_oid *pOid, const QByteArray &pData) {
+	const QByteArray lHeader = "blob " + QByteArray::number(pData.size());
+	Sha1 lHash;
+	lHash.update(lHeader.constData(), static_cast<size_t>(lHeader.size()) + 1); // with the terminating zero
+	lHash.update(pData.constData(), static_cast<size_t>(pData.size()));
+	uchar lDigest[GIT_OID_RAWSZ];
+	lHash.final(lDigest);
+	return 0 == memcmp(lDigest, pOid->id, GIT_OID_RAWSZ);
+}
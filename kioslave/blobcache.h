@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef BLOBCACHE_H
+#define BLOBCACHE_H
+
+#include <QByteArray>
+
+#include <git2.h>
+
+// Process wide cache of inflated blobs. bup stores identical chunks only
+// once, so the same blob shows up in many files and in many saves. The data
+// handed out is implicitly shared with the cache, nothing is copied. Safe to
+// use from any thread, with a repository handle owned by that thread.
+class BlobCache {
+public:
+	// pCorrupt, if given, tells whether the blob was read but did not match pOid.
+	static bool read(git_repository *pRepository, const git_oid *pOid, QByteArray &pData, bool *pCorrupt = nullptr);
+	// in bytes, 0 disables the cache.
+	static void setBudget(qint64 pBudget);
+	// Whether the blob id matches the content, hashed like git does.
+	static bool verify(const git_oid *pOid, const QByteArray &pData);
+
+	// Check each blob here as it is inflated, before it goes into the cache,
+	// with a faster SHA-1 than the one libgit2 checks objects with. libgit2
+	// does not check those blobs again, and checks all other objects as usual.
+	static bool mVerify;
+};
+
+#endif // BLOBCACHE_H
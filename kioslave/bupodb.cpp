@@ -0,0 +1,324 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "bupodb.h"
+
+#include <QByteArray>
+#include <QDir>
+#include <QHash>
+#include <QVector>
+#include <QtEndian>
+
+#include <git2/sys/odb_backend.h>
+
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// tried before the loose and packed backends of libgit2, they have priority 1 and 2.
+static const int cBackendPriority = 10;
+static const quint32 cMidxVersion = 4;
+static const quint32 cBloomVersion = 2;
+static const int cBloomHeaderSize = 16;
+
+namespace {
+
+struct MappedFile {
+	const uchar *mData = nullptr;
+	size_t mSize = 0;
+
+	bool map(const QByteArray &pPath) {
+		int lFd = ::open(pPath.constData(), O_RDONLY | O_CLOEXEC);
+		if(lFd < 0) {
+			return false;
+		}
+		struct stat lStat;
+		if(0 == fstat(lFd, &lStat) && lStat.st_size > 0) {
+			void *lMap = mmap(nullptr, static_cast<size_t>(lStat.st_size), PROT_READ, MAP_SHARED, lFd, 0);
+			if(lMap != MAP_FAILED) {
+				mData = static_cast<const uchar *>(lMap);
+				mSize = static_cast<size_t>(lStat.st_size);
+			}
+		}
+		::close(lFd);
+		return mData != nullptr;
+	}
+
+	void unmap() {
+		if(mData != nullptr) {
+			munmap(const_cast<uchar *>(mData), mSize);
+			mData = nullptr;
+		}
+	}
+};
+
+// bup's midx version 4: "MIDX", version and number of fanout bits as big
+// endian uint32, the fanout table, sorted object ids, for each object the
+// index of the .idx file containing it and finally the NUL separated names
+// of the .idx files.
+struct Midx {
+	MappedFile mFile;
+	quint32 mBits = 0;
+	quint32 mCount = 0;
+	const uchar *mFanout = nullptr;
+	const uchar *mShas = nullptr;
+	const uchar *mWhich = nullptr;
+	QVector<QByteArray> mIdxNames;
+
+	bool open(const QByteArray &pPath) {
+		if(!mFile.map(pPath)) {
+			return false;
+		}
+		const uchar *lData = mFile.mData;
+		if(mFile.mSize < 12 || 0 != memcmp(lData, "MIDX", 4) || qFromBigEndian<quint32>(lData + 4) != cMidxVersion) {
+			return false;
+		}
+		mBits = qFromBigEndian<quint32>(lData + 8);
+		if(mBits == 0 || mBits > 24) {
+			return false;
+		}
+		quint64 lFanoutEntries = Q_UINT64_C(1) << mBits;
+		if(mFile.mSize < 12 + lFanoutEntries * 4) {
+			return false;
+		}
+		mFanout = lData + 12;
+		mCount = qFromBigEndian<quint32>(mFanout + (lFanoutEntries - 1) * 4);
+		quint64 lNamesOffset = 12 + lFanoutEntries * 4 + static_cast<quint64>(mCount) * (GIT_OID_RAWSZ + 4);
+		if(mFile.mSize < lNamesOffset) {
+			return false;
+		}
+		mShas = mFanout + lFanoutEntries * 4;
+		mWhich = mShas + static_cast<quint64>(mCount) * GIT_OID_RAWSZ;
+		const char *lNames = reinterpret_cast<const char *>(lData + lNamesOffset);
+		mIdxNames = QByteArray::fromRawData(lNames, static_cast<int>(mFile.mSize - lNamesOffset)).split('\0').toVector();
+		return true;
+	}
+
+	// index into mIdxNames of the .idx file with the object, -1 if not here.
+	int find(const git_oid *pOid) const {
+		quint32 lPrefix = qFromBigEndian<quint32>(pOid->id) >> (32 - mBits);
+		quint32 lLower = lPrefix == 0 ? 0 : qFromBigEndian<quint32>(mFanout + (lPrefix - 1) * 4);
+		quint32 lUpper = qFromBigEndian<quint32>(mFanout + lPrefix * 4);
+		while(lLower < lUpper) {
+			quint32 lMiddle = lLower + (lUpper - lLower) / 2;
+			int lCompare = memcmp(mShas + static_cast<quint64>(lMiddle) * GIT_OID_RAWSZ, pOid->id, GIT_OID_RAWSZ);
+			if(lCompare == 0) {
+				return static_cast<int>(qFromBigEndian<quint32>(mWhich + static_cast<quint64>(lMiddle) * 4));
+			}
+			if(lCompare < 0) {
+				lLower = lMiddle + 1;
+			} else {
+				lUpper = lMiddle;
+			}
+		}
+		return -1;
+	}
+};
+
+// bup.bloom: "BLOM", then version (uint32), bits and k (uint16) and number of
+// entries (uint32), all big endian, followed by a table of 2^bits bytes.
+// With k=5 each object id gives five 4 byte addresses, with k=4 four 5 byte ones.
+struct Bloom {
+	MappedFile mFile;
+	int mBits = 0;
+	int mK = 0;
+
+	bool open(const QByteArray &pPath) {
+		if(!mFile.map(pPath)) {
+			return false;
+		}
+		const uchar *lData = mFile.mData;
+		if(mFile.mSize < cBloomHeaderSize || 0 != memcmp(lData, "BLOM", 4) ||
+		      qFromBigEndian<quint32>(lData + 4) != cBloomVersion) {
+			return false;
+		}
+		mBits = qFromBigEndian<quint16>(lData + 8);
+		mK = qFromBigEndian<quint16>(lData + 10);
+		if((mK != 4 && mK != 5) || mBits < 1 || mBits > (mK == 5 ? 29 : 37) ||
+		      mFile.mSize < cBloomHeaderSize + (Q_UINT64_C(1) << mBits)) {
+			return false;
+		}
+		return true;
+	}
+
+	bool mightContain(const git_oid *pOid) const {
+		const uchar *lTable = mFile.mData + cBloomHeaderSize;
+		for(int i = 0; i < mK; ++i) {
+			quint64 lRaw;
+			int lTotalBits;
+			if(mK == 5) {
+				lRaw = qFromBigEndian<quint32>(pOid->id + i * 4);
+				lTotalBits = 32;
+			} else {
+				lRaw = (static_cast<quint64>(qFromBigEndian<quint32>(pOid->id + i * 5)) << 8) | pOid->id[i * 5 + 4];
+				lTotalBits = 40;
+			}
+			quint64 lByte = (lRaw >> (lTotalBits - mBits)) & ((Q_UINT64_C(1) << mBits) - 1);
+			int lBit = static_cast<int>((lRaw >> (lTotalBits - 3 - mBits)) & 0x7);
+			if(!(lTable[lByte] & (1 << lBit))) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+struct BupOdbBackend {
+	git_odb_backend mParent; // must be first, libgit2 only sees this part
+	QByteArray mPackDirectory;
+	QVector<Midx *> mMidxes;
+	Bloom mBloom;
+	bool mHasBloom = false;
+	QHash<QByteArray, git_odb_backend *> mPacks; // nullptr for packs that could not be opened
+
+	~BupOdbBackend() {
+		foreach(Midx *lMidx, mMidxes) {
+			lMidx->mFile.unmap();
+			delete lMidx;
+		}
+		mBloom.mFile.unmap();
+		foreach(git_odb_backend *lPack, mPacks) {
+			if(lPack != nullptr) {
+				lPack->free(lPack);
+			}
+		}
+	}
+
+	git_odb_backend *packFor(const git_oid *pOid) {
+		if(mHasBloom && !mBloom.mightContain(pOid)) {
+			return nullptr;
+		}
+		foreach(Midx *lMidx, mMidxes) {
+			int lWhich = lMidx->find(pOid);
+			if(lWhich < 0 || lWhich >= lMidx->mIdxNames.count()) {
+				continue;
+			}
+			const QByteArray &lIdxName = lMidx->mIdxNames.at(lWhich);
+			auto lIter = mPacks.constFind(lIdxName);
+			if(lIter != mPacks.constEnd()) {
+				if(lIter.value() != nullptr) {
+					return lIter.value();
+				}
+				continue;
+			}
+			// the midx can be older than a gc and mention packs that are gone.
+			git_odb_backend *lPack = nullptr;
+			if(0 != git_odb_backend_one_pack(&lPack, mPackDirectory + lIdxName)) {
+				lPack = nullptr;
+			} else {
+				lPack->odb = mParent.odb;
+			}
+			mPacks.insert(lIdxName, lPack);
+			if(lPack != nullptr) {
+				return lPack;
+			}
+		}
+		return nullptr;
+	}
+};
+
+BupOdbBackend *bupBackend(git_odb_backend *pBackend) {
+	return reinterpret_cast<BupOdbBackend *>(pBackend);
+}
+
+int bupRead(void **pData, size_t *pSize, git_object_t *pType, git_odb_backend *pBackend, const git_oid *pOid) {
+	git_odb_backend *lPack = bupBackend(pBackend)->packFor(pOid);
+	if(lPack == nullptr) {
+		return GIT_ENOTFOUND;
+	}
+	return lPack->read(pData, pSize, pType, lPack, pOid);
+}
+
+int bupReadHeader(size_t *pSize, git_object_t *pType, git_odb_backend *pBackend, const git_oid *pOid) {
+	git_odb_backend *lPack = bupBackend(pBackend)->packFor(pOid);
+	if(lPack == nullptr) {
+		return GIT_ENOTFOUND;
+	}
+	return lPack->read_header(pSize, pType, lPack, pOid);
+}
+
+int bupExists(git_odb_backend *pBackend, const git_oid *pOid) {
+	git_odb_backend *lPack = bupBackend(pBackend)->packFor(pOid);
+	return lPack != nullptr && lPack->exists(lPack, pOid);
+}
+
+void bupFree(git_odb_backend *pBackend) {
+	delete bupBackend(pBackend);
+}
+
+} // namespace
+
+bool addBupOdbBackend(git_repository *pRepository) {
+	auto lBackend = new BupOdbBackend;
+	lBackend->mPackDirectory = QByteArray(git_repository_path(pRepository)) + "objects/pack/";
+	const QDir lPackDir(QString::fromLocal8Bit(lBackend->mPackDirectory));
+	foreach(const QString &lFileName, lPackDir.entryList(QStringList() << QStringLiteral("*.midx"), QDir::Files)) {
+		auto lMidx = new Midx;
+		if(lMidx->open(lBackend->mPackDirectory + lFileName.toLocal8Bit())) {
+			lBackend->mMidxes.append(lMidx);
+		} else {
+			lMidx->mFile.unmap();
+			delete lMidx;
+		}
+	}
+	if(lBackend->mMidxes.isEmpty()) {
+		delete lBackend;
+		return false;
+	}
+	// the bloom filter covers all packs, so it can rule out objects before searching the midx files.
+	lBackend->mHasBloom = lBackend->mBloom.open(lBackend->mPackDirectory + "bup.bloom");
+	if(!lBackend->mHasBloom) {
+		lBackend->mBloom.mFile.unmap();
+	}
+
+	git_odb_init_backend(&lBackend->mParent, GIT_ODB_BACKEND_VERSION);
+	lBackend->mParent.read = bupRead;
+	lBackend->mParent.read_header = bupReadHeader;
+	lBackend->mParent.exists = bupExists;
+	lBackend->mParent.free = bupFree;
+
+	git_odb *lOdb;
+	if(0 != git_repository_odb(&lOdb, pRepository)) {
+		delete lBackend;
+		return false;
+	}
+	bool lAdded = 0 == git_odb_add_backend(lOdb, &lBackend->mParent, cBackendPriority);
+	if(!lAdded) {
+		delete lBackend;
+	}
+	git_odb_free(lOdb);
+	return lAdded;
+}
+
+bool readBlobUnverified(git_repository *pRepository, const git_oid *pOid, QByteArray &pData) {
+	git_odb *lOdb;
+	if(0 != git_repository_odb(&lOdb, pRepository)) {
+		return false;
+	}
+	bool lFound = false;
+	// in order of priority, like libgit2 asks them
+	const size_t lCount = git_odb_num_backends(lOdb);
+	for(size_t i = 0; i < lCount; ++i) {
+		git_odb_backend *lBackend;
+		if(0 != git_odb_get_backend(&lBackend, lOdb, i) || lBackend->read == nullptr) {
+			continue;
+		}
+		void *lData;
+		size_t lSize;
+		git_object_t lType;
+		if(0 == lBackend->read(&lData, &lSize, &lType, lBackend, pOid)) {
+			lFound = lType == GIT_OBJECT_BLOB && lSize <= INT_MAX;
+			if(lFound) {
+				pData = QByteArray(static_cast<const char *>(lData), static_cast<int>(lSize));
+			}
+			git_odb_backend_data_free(lBackend, lData);
+			break;
+		}
+	}
+	git_odb_free(lOdb);
+	return lFound;
+}
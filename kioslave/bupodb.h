@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef BUPODB_H
+#define BUPODB_H
+
+#include <QByteArray>
+
+#include <git2.h>
+
+// Adds a read only object database backend to the repository which finds
+// objects through the .midx files and bloom filter that bup keeps next to
+// its packs, then reads them from the one pack that has them. The normal
+// backends are still there for anything the midx files don't cover.
+// Returns false if it could not be added, the repository then still works.
+bool addBupOdbBackend(git_repository *pRepository);
+
+// Reads a blob straight from the backends, without libgit2 checking its hash.
+// Only for callers that check the content themselves. Returns false if no
+// backend has it, libgit2 then still has to look for new packs.
+bool readBlobUnverified(git_repository *pRepository, const git_oid *pOid, QByteArray &pData);
+
+#endif // BUPODB_H
@@ -2,19 +2,51 @@
 //
 // SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
 
+#include "blobcache.h"
 #include "bupvfs.h"
+#include "contentsearch.h"
+#include "sizecalculator.h"
+#include "treetotals.h"
 
 #include <QCoreApplication>
+#include <QDataStream>
 #include <QFile>
 #include <QVarLengthArray>
 
 #include <KIO/SlaveBase>
 using namespace KIO;
+#include <KConfigGroup>
 #include <KLocalizedString>
 #include <KProcess>
 
 #include <grp.h>
 #include <pwd.h>
+#include <sys/stat.h>
+
+// listDir() sends entries to the application in batches of this many.
+static const int cListBatchSize = 200;
+
+// branch/.history/path lists the saves in which path was changed, named like
+// the commit folders. branch/.history/path/<commit folder> is that version.
+static const char cHistoryFolder[] = ".history";
+
+// Commands for special(), the first int in the data, then a QUrl.
+// cSpecialTotals replies with "totalsize", "filecount" and "directorycount"
+// in the meta data.
+static const int cSpecialTotals = 1;
+// cSpecialSearch takes the url of a branch, a commit folder or a folder in
+// one, then the QByteArray to look for and the first and last commit time to
+// search as qint64, 0 for no limit. A folder in a commit is searched in that
+// commit only, the times are then not used. Sends back the paths of matching files as lines of
+// UTF-8 in data(), each path starting with a commit folder.
+static const int cSpecialSearch = 2;
+// cSpecialFindName takes the url of a branch, then the QString to look for in
+// file and folder names. Sends back lines of UTF-8 in data(), the commit folder
+// a version was first seen in, the one it was last seen in, or nothing if it
+// is still in the newest save, and its path, separated by tabs.
+static const int cSpecialFindName = 3;
+// cSpecialFindName stops after this many versions.
+static const int cFindNameMaxResults = 1000;
 
 class BupSlave : public SlaveBase
 {
@@ -29,17 +61,32 @@ public:
 	void seek(filesize_t pOffset) override;
 	void stat(const QUrl &pUrl) override;
 	void mimetype(const QUrl &pUrl) override;
+	void special(const QByteArray &pData) override;
 
 private:
 	bool checkCorrectRepository(const QUrl &pUrl, QStringList &pPathInRepository);
 	QString getUserName(uid_t pUid);
 	QString getGroupName(gid_t pGid);
+	quint64 nodeCacheBudget();
+	void closeRepositories();
+	void directoryTotals(const QUrl &pUrl);
+	void searchContent(const QUrl &pUrl, const QByteArray &pPattern, qint64 pFirstTime, qint64 pLastTime);
+	void findName(const QUrl &pUrl, const QString &pName);
+	bool isHistoryPath(const QStringList &pPathInRepository);
+	void mapHistoryVersion(QStringList &pPathInRepository);
+	void listHistory(const QStringList &pPathInRepository, int pDetails);
 	void createUDSEntry(Node *pNode, KIO::UDSEntry & pUDSEntry, int pDetails);
+	void createUDSEntry(ArchivedDirectory *pDirectory, quint32 pIndex, KIO::UDSEntry &pUDSEntry, int pDetails);
+	void addNodeAttributes(Node *pNode, KIO::UDSEntry &pUDSEntry, int pDetails);
+	void emitReadError(int pError, File *pFile, const QString &pPath);
 
 	QHash<uid_t, QString> mUsercache;
 	QHash<gid_t, QString> mGroupcache;
-	Repository *mRepository;
+	QList<Repository *> mRepositories; // open repositories, most recently used first
+	Repository *mRepository; // the one the current command is for
 	File *mOpenFile;
+	SizeCalculator *mSizeCalculator;
+	bool mContentMimeTypes; // sniff file content for the mime types in stat and listDir
 };
 
 BupSlave::BupSlave(const QByteArray &pPoolSocket, const QByteArray &pAppSocket)
@@ -47,15 +94,21 @@ BupSlave::BupSlave(const QByteArray &pPoolSocket, const QByteArray &pAppSocket)
 {
 	mRepository = nullptr;
 	mOpenFile = nullptr;
+	mContentMimeTypes = false;
 	git_libgit2_init();
+	mSizeCalculator = new SizeCalculator();
 }
 
 BupSlave::~BupSlave() {
-	delete mRepository;
+	qDeleteAll(mRepositories);
+	delete mSizeCalculator; // its threads have repositories open until they exit
 	git_libgit2_shutdown();
 }
 
 void BupSlave::close() {
+	if(mOpenFile != nullptr) {
+		mOpenFile->stopReading();
+	}
 	mOpenFile = nullptr;
 	emit finished();
 }
@@ -82,7 +135,7 @@ void BupSlave::get(const QUrl &pUrl) {
 		return;
 	}
 
-	emit mimeType(lFile->mMimeType);
+	emit mimeType(lFile->contentMimeType());
 	// Emit total size AFTER mimetype
 	emit totalSize(lFile->size());
 
@@ -108,12 +161,13 @@ void BupSlave::get(const QUrl &pUrl) {
         lProcessedSize += static_cast<quint64>(lResultArray.length());
 		emit processedSize(lProcessedSize);
 	}
+	lFile->stopReading();
 	if(lRetVal == KIO::ERR_NO_CONTENT) {
 		emit data(QByteArray());
 		emit processedSize(lProcessedSize);
 		emit finished();
 	} else {
-		emit error(lRetVal, lPathInRepo.join(QStringLiteral("/")));
+		emitReadError(lRetVal, lFile, lPathInRepo.join(QStringLiteral("/")));
 	}
 }
 
@@ -123,6 +177,15 @@ void BupSlave::listDir(const QUrl &pUrl) {
 		emit error(KIO::ERR_SLAVE_DEFINED, i18n("No bup repository found.\n%1", pUrl.toDisplayString()));
 		return;
 	}
+	const QString sDetails = metaData(QStringLiteral("details"));
+	const int lDetails = sDetails.isEmpty() ? 2 : sDetails.toInt();
+	// Mime types are only guessed from file names, unless the caller asks for more.
+	mContentMimeTypes = metaData(QStringLiteral("contentmimetypes")) == QStringLiteral("true");
+	if(isHistoryPath(lPathInRepo)) {
+		listHistory(lPathInRepo, lDetails);
+		return;
+	}
+
 	Node *lNode = mRepository->resolve(lPathInRepo, true);
 	if(lNode == nullptr) {
 		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
@@ -137,14 +200,45 @@ void BupSlave::listDir(const QUrl &pUrl) {
 	// give the directory a chance to reload if necessary.
 	lDir->reload();
 
-	const QString sDetails = metaData(QStringLiteral("details"));
-	const int lDetails = sDetails.isEmpty() ? 2 : sDetails.toInt();
-
-	NodeMapIterator i(lDir->subNodes());
+	UDSEntryList lEntries;
 	UDSEntry lEntry;
-	while(i.hasNext()) {
-		createUDSEntry(i.next().value(), lEntry, lDetails);
-		emit listEntry(lEntry);
+	auto lArchivedDir = qobject_cast<ArchivedDirectory *>(lDir);
+	if(lArchivedDir != nullptr) {
+		// list straight from the records, no need to create nodes for every entry.
+		NodeRange lChildren = lArchivedDir->children();
+		if(lDetails > 0) {
+			QVector<NodeRecord *> lUnknownSizes;
+			for(quint32 i = lChildren.mFirst; i < lChildren.mFirst + lChildren.mCount; ++i) {
+				NodeRecord &lRecord = lArchivedDir->record(i);
+				if(!S_ISDIR(lRecord.mMode) && lRecord.mSize < 0) {
+					lUnknownSizes.append(&lRecord);
+				}
+			}
+			if(lUnknownSizes.count() >= SizeCalculator::cMinimumRecords) {
+				mSizeCalculator->calculate(lArchivedDir->repositoryPath(), lUnknownSizes);
+			}
+		}
+		for(quint32 i = lChildren.mFirst; i < lChildren.mFirst + lChildren.mCount; ++i) {
+			createUDSEntry(lArchivedDir, i, lEntry, lDetails);
+			lEntries.append(lEntry);
+			if(lEntries.count() >= cListBatchSize) {
+				emit listEntries(lEntries);
+				lEntries.clear();
+			}
+		}
+	} else {
+		NodeMapIterator i(lDir->subNodes());
+		while(i.hasNext()) {
+			createUDSEntry(i.next().value(), lEntry, lDetails);
+			lEntries.append(lEntry);
+			if(lEntries.count() >= cListBatchSize) {
+				emit listEntries(lEntries);
+				lEntries.clear();
+			}
+		}
+	}
+	if(!lEntries.isEmpty()) {
+		emit listEntries(lEntries);
 	}
 	emit finished();
 }
@@ -179,7 +273,7 @@ void BupSlave::open(const QUrl &pUrl, QIODevice::OpenMode pMode) {
 	}
 
 	mOpenFile = lFile;
-	emit mimeType(lFile->mMimeType);
+	emit mimeType(lFile->contentMimeType());
 	emit totalSize(lFile->size());
 	emit position(0);
 	emit opened();
@@ -200,7 +294,7 @@ void BupSlave::read(filesize_t pSize) {
 		emit data(QByteArray());
 		emit finished();
 	} else {
-		emit error(lRetVal, mOpenFile->completePath());
+		emitReadError(lRetVal, mOpenFile, mOpenFile->completePath());
 	}
 }
 
@@ -224,6 +318,16 @@ void BupSlave::stat(const QUrl &pUrl) {
 		return;
 	}
 
+	UDSEntry lUDSEntry;
+	if(isHistoryPath(lPathInRepo)) {
+		// a folder of versions, looks like the branch it is in.
+		createUDSEntry(mRepository->subNode(lPathInRepo.first()), lUDSEntry, 0);
+		lUDSEntry.replace(KIO::UDSEntry::UDS_NAME, lPathInRepo.last());
+		emit statEntry(lUDSEntry);
+		emit finished();
+		return;
+	}
+
 	Node *lNode = mRepository->resolve(lPathInRepo);
 	if(lNode == nullptr) {
 		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
@@ -232,9 +336,19 @@ void BupSlave::stat(const QUrl &pUrl) {
 
 	const QString sDetails = metaData(QStringLiteral("details"));
 	const int lDetails = sDetails.isEmpty() ? 2 : sDetails.toInt();
+	mContentMimeTypes = metaData(QStringLiteral("contentmimetypes")) == QStringLiteral("true");
+	if(lDetails > 0) {
+		lNode->loadMetadata();
+	}
 
-	UDSEntry lUDSEntry;
 	createUDSEntry(lNode, lUDSEntry, lDetails);
+	// "recursivesize" gives folders the size of all files in them, like du.
+	auto lDirectory = qobject_cast<ArchivedDirectory *>(lNode);
+	TreeTotals lTotals;
+	if(lDirectory != nullptr && lDetails > 0 && metaData(QStringLiteral("recursivesize")) == QStringLiteral("true")
+	      && lDirectory->totals(lTotals)) {
+		lUDSEntry.replace(KIO::UDSEntry::UDS_SIZE, static_cast<qint64>(lTotals.mSize));
+	}
 	emit statEntry(lUDSEntry);
 	emit finished();
 }
@@ -252,7 +366,135 @@ void BupSlave::mimetype(const QUrl &pUrl) {
 		return;
 	}
 
-	emit mimeType(lNode->mMimeType);
+	File *lFile = qobject_cast<File *>(lNode);
+	emit mimeType(lFile != nullptr ? lFile->contentMimeType() : lNode->mMimeType);
+	emit finished();
+}
+
+void BupSlave::special(const QByteArray &pData) {
+	QDataStream lStream(pData);
+	int lCommand;
+	QUrl lUrl;
+	lStream >> lCommand >> lUrl;
+	if(lCommand == cSpecialTotals) {
+		directoryTotals(lUrl);
+	} else if(lCommand == cSpecialSearch) {
+		QByteArray lPattern;
+		qint64 lFirstTime, lLastTime;
+		lStream >> lPattern >> lFirstTime >> lLastTime;
+		searchContent(lUrl, lPattern, lFirstTime, lLastTime);
+	} else if(lCommand == cSpecialFindName) {
+		QString lName;
+		lStream >> lName;
+		findName(lUrl, lName);
+	} else {
+		emit error(KIO::ERR_UNSUPPORTED_ACTION, QString::number(lCommand));
+	}
+}
+
+void BupSlave::directoryTotals(const QUrl &pUrl) {
+	QStringList lPathInRepo;
+	if(!checkCorrectRepository(pUrl, lPathInRepo)) {
+		emit error(KIO::ERR_SLAVE_DEFINED, i18n("No bup repository found.\n%1", pUrl.toDisplayString()));
+		return;
+	}
+	Node *lNode = mRepository->resolve(lPathInRepo, true);
+	if(lNode == nullptr) {
+		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
+		return;
+	}
+	auto lDirectory = qobject_cast<ArchivedDirectory *>(lNode);
+	if(lDirectory == nullptr) {
+		emit error(KIO::ERR_IS_FILE, lPathInRepo.join(QStringLiteral("/")));
+		return;
+	}
+	TreeTotals lTotals;
+	if(!lDirectory->totals(lTotals)) {
+		emit error(KIO::ERR_COULD_NOT_READ, lPathInRepo.join(QStringLiteral("/")));
+		return;
+	}
+	setMetaData(QStringLiteral("totalsize"), QString::number(lTotals.mSize));
+	setMetaData(QStringLiteral("filecount"), QString::number(lTotals.mFileCount));
+	setMetaData(QStringLiteral("directorycount"), QString::number(lTotals.mDirectoryCount));
+	emit finished();
+}
+
+void BupSlave::searchContent(const QUrl &pUrl, const QByteArray &pPattern, qint64 pFirstTime, qint64 pLastTime) {
+	QStringList lPathInRepo;
+	if(!checkCorrectRepository(pUrl, lPathInRepo)) {
+		emit error(KIO::ERR_SLAVE_DEFINED, i18n("No bup repository found.\n%1", pUrl.toDisplayString()));
+		return;
+	}
+	auto lBranch = lPathInRepo.isEmpty() ? nullptr : qobject_cast<Branch *>(mRepository->subNode(lPathInRepo.first()));
+	if(lBranch == nullptr) {
+		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
+		return;
+	}
+	if(pPattern.isEmpty()) {
+		emit error(KIO::ERR_MALFORMED_URL, pUrl.toDisplayString());
+		return;
+	}
+	// A commit folder in the url limits the search to that commit, the time
+	// range is only for searching the whole branch.
+	const QString lCommitName = lPathInRepo.value(1);
+	QVector<ContentSearch::Root> lRoots;
+	foreach(const CommitIndex::Entry &lCommit, lBranch->commits()) {
+		const QString lName = vfsTimeToString(lCommit.mTime);
+		if(lCommitName.isEmpty() ? (pFirstTime <= 0 || lCommit.mTime >= pFirstTime) && (pLastTime <= 0 || lCommit.mTime <= pLastTime)
+		                         : lName == lCommitName) {
+			lRoots.append(ContentSearch::Root{lName, lCommit.mTree});
+		}
+	}
+	if(!lCommitName.isEmpty() && lRoots.isEmpty()) {
+		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
+		return;
+	}
+	ContentSearch lSearch(lBranch->repositoryPath(), pPattern);
+	bool lOk = lSearch.search(lRoots, lPathInRepo.mid(2).join(QLatin1Char('/')), [this](const QStringList &pMatches) {
+		emit data((pMatches.join(QLatin1Char('\n')) + QLatin1Char('\n')).toUtf8());
+	});
+	if(!lOk) {
+		emit error(KIO::ERR_COULD_NOT_READ, pUrl.toDisplayString());
+		return;
+	}
+	emit data(QByteArray());
+	emit finished();
+}
+
+void BupSlave::findName(const QUrl &pUrl, const QString &pName) {
+	QStringList lPathInRepo;
+	if(!checkCorrectRepository(pUrl, lPathInRepo)) {
+		emit error(KIO::ERR_SLAVE_DEFINED, i18n("No bup repository found.\n%1", pUrl.toDisplayString()));
+		return;
+	}
+	auto lBranch = lPathInRepo.isEmpty() ? nullptr : qobject_cast<Branch *>(mRepository->subNode(lPathInRepo.first()));
+	if(lBranch == nullptr) {
+		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
+		return;
+	}
+	const FilenameIndex *lIndex = lBranch->filenameIndex();
+	if(lIndex == nullptr) {
+		emit error(KIO::ERR_COULD_NOT_READ, pUrl.toDisplayString());
+		return;
+	}
+	QByteArray lLines;
+	foreach(int lEntryIndex, lIndex->find(pName, cFindNameMaxResults)) {
+		const FilenameIndex::Entry &lEntry = lIndex->mEntries.at(lEntryIndex);
+		QString lLine = vfsTimeToString(lEntry.mFirstSeen) + QLatin1Char('\t');
+		if(lEntry.mLastSeen != 0) {
+			lLine += vfsTimeToString(lEntry.mLastSeen);
+		}
+		lLine += QLatin1Char('\t') + lIndex->path(lEntry) + QLatin1Char('\n');
+		lLines.append(lLine.toUtf8());
+		if(lLines.size() > 64 * 1024) {
+			emit data(lLines);
+			lLines.clear();
+		}
+	}
+	if(!lLines.isEmpty()) {
+		emit data(lLines);
+	}
+	emit data(QByteArray());
 	emit finished();
 }
 
@@ -269,14 +511,17 @@ bool BupSlave::checkCorrectRepository(const QUrl &pUrl, QStringList &pPathInRepo
 		}
 	}
 
-	if(mRepository && mRepository->isValid()) {
-		if(lPath.startsWith(mRepository->objectName())) {
+	mRepository = nullptr;
+	for(int i = 0; i < mRepositories.count(); ++i) {
+		if(lPath.startsWith(mRepositories.at(i)->objectName())) {
+			mRepositories.move(i, 0);
+			mRepository = mRepositories.first();
 			lPath.remove(0, mRepository->objectName().length());
 			pPathInRepository = lPath.split(QLatin1Char('/'), QString::SkipEmptyParts);
+			mRepository->trimNodeCache(mOpenFile);
+			mapHistoryVersion(pPathInRepository);
 			return true;
 		}
-		delete mRepository;
-		mRepository = nullptr;
 	}
 
 	pPathInRepository = lPath.split(QLatin1Char('/'), QString::SkipEmptyParts);
@@ -289,13 +534,103 @@ bool BupSlave::checkCorrectRepository(const QUrl &pUrl, QStringList &pPathInRepo
 		    QFile::exists(lRepoPath + QStringLiteral("refs"))) ||
 		      (QFile::exists(lRepoPath + QStringLiteral(".git/objects")) &&
 		       QFile::exists(lRepoPath + QStringLiteral(".git/refs")))) {
-			mRepository = new Repository(nullptr, lRepoPath);
-			return mRepository->isValid();
+			// Set "ReadAheadChunks" in kio_buprc to 0 to read chunked files synchronously.
+			ChunkFile::mReadAheadWindow = config()->readEntry("ReadAheadChunks", 8);
+			// Size in MiB of the cache for file content shared by all repositories.
+			BlobCache::setBudget(static_cast<qint64>(config()->readEntry("BlobCacheSize", 64)) * 1024 * 1024);
+			// Set "PersistChunkIndex" to true to save chunk indexes in the repository,
+			// for later processes. There is one file per big file that was read.
+			ChunkIndex::mPersist = config()->readEntry("PersistChunkIndex", false);
+			// File content is checked against the blob ids as it is read, with a
+			// precise error for damaged objects. If "VerifyContent" is false, it
+			// is left to libgit2 like for all other objects.
+			BlobCache::mVerify = config()->readEntry("VerifyContent", true);
+			auto lRepository = new Repository(nullptr, lRepoPath, nodeCacheBudget());
+			if(!lRepository->isValid()) {
+				delete lRepository;
+				return false;
+			}
+			mRepositories.prepend(lRepository);
+			closeRepositories();
+			mRepository = lRepository;
+			mapHistoryVersion(pPathInRepository);
+			return true;
 		}
 	}
 	return false;
 }
 
+void BupSlave::closeRepositories() {
+	// Keep a few repositories open, switching between them is then free. Set
+	// "OpenRepositories" in kio_buprc to change how many.
+	const int lMaxOpen = qMax(1, config()->readEntry("OpenRepositories", 4));
+	for(int i = mRepositories.count() - 1; i > 0 && mRepositories.count() > lMaxOpen; --i) {
+		Repository *lRepository = mRepositories.at(i);
+		bool lHasOpenFile = false;
+		for(QObject *lObject = mOpenFile; lObject != nullptr; lObject = lObject->parent()) {
+			lHasOpenFile |= lObject == lRepository;
+		}
+		if(!lHasOpenFile) {
+			delete mRepositories.takeAt(i);
+		}
+	}
+}
+
+bool BupSlave::isHistoryPath(const QStringList &pPathInRepository) {
+	return pPathInRepository.count() >= 2 && pPathInRepository.at(1) == QLatin1String(cHistoryFolder) &&
+	      qobject_cast<Branch *>(mRepository->subNode(pPathInRepository.first())) != nullptr;
+}
+
+void BupSlave::mapHistoryVersion(QStringList &pPathInRepository) {
+	if(pPathInRepository.count() < 4 || pPathInRepository.at(1) != QLatin1String(cHistoryFolder)) {
+		return;
+	}
+	auto lBranch = qobject_cast<Branch *>(mRepository->subNode(pPathInRepository.first()));
+	if(lBranch == nullptr) {
+		return;
+	}
+	// the version can be followed by a path inside it, if it is a folder.
+	for(int i = pPathInRepository.count() - 1; i >= 3; --i) {
+		if(qobject_cast<CommitDirectory *>(lBranch->subNode(pPathInRepository.at(i))) != nullptr) {
+			QString lVersion = pPathInRepository.takeAt(i);
+			pPathInRepository[1] = lVersion;
+			return;
+		}
+	}
+}
+
+void BupSlave::listHistory(const QStringList &pPathInRepository, int pDetails) {
+	auto lBranch = qobject_cast<Branch *>(mRepository->subNode(pPathInRepository.first()));
+	const QStringList lPath = pPathInRepository.mid(2);
+	QVector<PathHistory::Version> lVersions;
+	if(!lPath.isEmpty() && !lBranch->pathHistory(lPath, lVersions)) {
+		emit error(KIO::ERR_COULD_NOT_READ, pPathInRepository.join(QStringLiteral("/")));
+		return;
+	}
+	UDSEntryList lEntries;
+	UDSEntry lEntry;
+	foreach(const PathHistory::Version &lVersion, lVersions) {
+		if(!lVersion.exists()) {
+			continue; // deleted in these saves
+		}
+		const QString lVersionName = vfsTimeToString(lVersion.mTime);
+		Node *lNode = lBranch->resolve(QStringList(lVersionName) + lPath);
+		if(lNode == nullptr) {
+			continue;
+		}
+		if(pDetails > 0) {
+			lNode->loadMetadata();
+		}
+		createUDSEntry(lNode, lEntry, pDetails);
+		lEntry.replace(KIO::UDSEntry::UDS_NAME, lVersionName);
+		lEntries.append(lEntry);
+	}
+	if(!lEntries.isEmpty()) {
+		emit listEntries(lEntries);
+	}
+	emit finished();
+}
+
 QString BupSlave::getUserName(uid_t pUid) {
 	if(!mUsercache.contains(pUid)) {
 		struct passwd *lUserInfo = getpwuid(pUid);
@@ -322,6 +657,13 @@ QString BupSlave::getGroupName(gid_t pGid) {
 	return mGroupcache.value(pGid);
 }
 
+quint64 BupSlave::nodeCacheBudget() {
+	// Set "NodeCacheSize" in MiB in kio_buprc to tune how much memory a
+	// long lived slave may use for browsed directories, in each open repository.
+	const quint64 lMebiBytes = config()->readEntry("NodeCacheSize", 256);
+	return lMebiBytes * 1024 * 1024;
+}
+
 void BupSlave::createUDSEntry(Node *pNode, UDSEntry &pUDSEntry, int pDetails) {
 	pUDSEntry.clear();
 	pUDSEntry.fastInsert(KIO::UDSEntry::UDS_NAME, pNode->objectName());
@@ -334,6 +676,38 @@ void BupSlave::createUDSEntry(Node *pNode, UDSEntry &pUDSEntry, int pDetails) {
 			}
 		}
 	}
+	addNodeAttributes(pNode, pUDSEntry, pDetails);
+}
+
+void BupSlave::createUDSEntry(ArchivedDirectory *pDirectory, quint32 pIndex, UDSEntry &pUDSEntry, int pDetails) {
+	NodeRecord &lRecord = pDirectory->record(pIndex);
+	pUDSEntry.clear();
+	pUDSEntry.fastInsert(KIO::UDSEntry::UDS_NAME, pDirectory->string(lRecord.mName));
+	if(lRecord.mSymlinkTarget != 0) {
+		const QString &lTarget = pDirectory->string(lRecord.mSymlinkTarget);
+		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_LINK_DEST, lTarget);
+		if(pDetails > 1) {
+			Node *lNode = pDirectory->resolve(lTarget, true);
+			if(lNode != nullptr) { // follow symlink only if details > 1 and it leads to something
+				addNodeAttributes(lNode, pUDSEntry, pDetails);
+				return;
+			}
+		}
+	}
+	pUDSEntry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE, lRecord.mMode & S_IFMT);
+	pUDSEntry.fastInsert(KIO::UDSEntry::UDS_ACCESS, lRecord.mMode & 07777);
+	if(pDetails > 0) {
+		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_SIZE, static_cast<qint64>(pDirectory->fileSize(lRecord)));
+		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_MIME_TYPE, mContentMimeTypes ? pDirectory->contentMimeType(pIndex)
+		                                                                     : pDirectory->string(lRecord.mMimeType));
+		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_ACCESS_TIME, lRecord.mAtime);
+		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_MODIFICATION_TIME, lRecord.mMtime);
+		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_USER, getUserName(lRecord.mUid));
+		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_GROUP, getGroupName(lRecord.mGid));
+	}
+}
+
+void BupSlave::addNodeAttributes(Node *pNode, UDSEntry &pUDSEntry, int pDetails) {
 	pUDSEntry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE, pNode->mMode & S_IFMT);
 	pUDSEntry.fastInsert(KIO::UDSEntry::UDS_ACCESS, pNode->mMode & 07777);
 	if(pDetails > 0) {
@@ -343,7 +717,8 @@ void BupSlave::createUDSEntry(Node *pNode, UDSEntry &pUDSEntry, int pDetails) {
 			lSize = lFile->size();
 		}
 		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_SIZE, static_cast<qint64>(lSize));
-		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_MIME_TYPE, pNode->mMimeType);
+		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_MIME_TYPE, lFile != nullptr && mContentMimeTypes ? lFile->contentMimeType()
+		                                                                                     : pNode->mMimeType);
 		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_ACCESS_TIME, pNode->mAtime);
 		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_MODIFICATION_TIME, pNode->mMtime);
 		pUDSEntry.fastInsert(KIO::UDSEntry::UDS_USER, getUserName(static_cast<uint>(pNode->mUid)));
@@ -351,6 +726,18 @@ void BupSlave::createUDSEntry(Node *pNode, UDSEntry &pUDSEntry, int pDetails) {
 	}
 }
 
+void BupSlave::emitReadError(int pError, File *pFile, const QString &pPath) {
+	const git_oid *lCorruptBlob = pFile->corruptBlob();
+	if(lCorruptBlob == nullptr) {
+		emit error(pError, pPath);
+		return;
+	}
+	char lOidString[GIT_OID_HEXSZ + 1];
+	git_oid_tostr(lOidString, sizeof lOidString, lCorruptBlob);
+	emit error(KIO::ERR_SLAVE_DEFINED, i18n("The saved content of %1 is damaged, object %2 in the backup "
+	                                        "archive does not match its id.", pPath, QLatin1String(lOidString)));
+}
+
 extern "C" int Q_DECL_EXPORT kdemain(int pArgc, char **pArgv) {
 	QCoreApplication lApp(pArgc, pArgv);
 	QCoreApplication::setApplicationName(QStringLiteral("kio_bup"));
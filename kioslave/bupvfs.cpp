@@ -3,6 +3,12 @@
 // SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
 
 #include "bupvfs.h"
+#include "blobcache.h"
+#include "bupodb.h"
+#include "chunkwalker.h"
+#include "nodecache.h"
+#include "readahead.h"
+#include "treetotals.h"
 #include "kupkio_debug.h"
 
 #include <git2/blob.h>
@@ -11,18 +17,20 @@
 #include <sys/stat.h>
 
 #include <QMimeDatabase>
+#include <QScopedPointer>
 
-git_revwalk *Node::mRevisionWalker = nullptr;
-git_repository *Node::mRepository = nullptr;
+
+// rough size of a QObject with its private data and the node map entry pointing to it
+static const quint64 cNodeOverhead = 200;
 
 Node::Node(QObject *pParent, const QString &pName, qint64 pMode)
-   :QObject(pParent), Metadata(pMode)
+   :QObject(pParent), Metadata(pMode), mContext(nullptr)
 {
 	setObjectName(pName);
-}
-
-int Node::readMetadata(VintStream &pMetadataStream) {
-	return ::readMetadata(pMetadataStream, *this);
+	auto lParent = qobject_cast<Node *>(pParent);
+	if(lParent != nullptr) {
+		mContext = lParent->mContext;
+	}
 }
 
 Node *Node::resolve(const QString &pPath, bool pFollowLinks) {
@@ -48,7 +56,7 @@ Node *Node::resolve(const QStringList &pPathList, bool pFollowLinks) {
 			if(lDir == nullptr) {
 				return nullptr;
 			}
-			lNode = lDir->subNodes().value(lPathComponent, nullptr);
+			lNode = lDir->subNode(lPathComponent);
 		}
 		if(lNode == nullptr) {
 			return nullptr;
@@ -86,6 +94,11 @@ Node *Node::parentCommit() {
 	return lNode;
 }
 
+quint64 Node::memoryCost() {
+	return cNodeOverhead + sizeof(*this) + static_cast<quint64>(objectName().size() + mMimeType.size() +
+	                                                            mSymlinkTarget.size()) * sizeof(QChar);
+}
+
 //Node *Node::parentRepository() {
 //	Node *lNode = this;
 //	while(lNode->parent() != nullptr && qobject_cast<Repository *>(lNode) == nullptr) {
@@ -109,291 +122,521 @@ NodeMap Directory::subNodes() {
 	return *mSubNodes;
 }
 
-int File::readMetadata(VintStream &pMetadataStream) {
-	int lRetVal = Node::readMetadata(pMetadataStream);
+Node *Directory::subNode(const QString &pName) {
+	return subNodes().value(pName, nullptr);
+}
+
+void Directory::evictSubNodes() {
+	if(mSubNodes == nullptr) {
+		return;
+	}
+	qDeleteAll(*mSubNodes);
+	delete mSubNodes;
+	mSubNodes = nullptr;
+}
+
+QString File::contentMimeType() {
+	if(mMimeTypeFromContent) {
+		return mMimeType;
+	}
 	QByteArray lContent, lNextData;
+	quint64 lOffset = mOffset;
 	seek(0);
 	while(lContent.size() < 1000 && 0 == read(lNextData)) {
 		lContent.append(lNextData);
 	}
-	seek(0);
+	stopReading();
+	mOffset = lOffset;
 	QMimeDatabase db;
 	if(!lContent.isEmpty()) {
 		mMimeType = db.mimeTypeForFileNameAndData(objectName(), lContent).name();
 	} else {
 		mMimeType = db.mimeTypeForFile(objectName()).name();
 	}
-	return lRetVal;
+	mMimeTypeFromContent = true;
+	auto lParent = qobject_cast<ArchivedDirectory *>(parent());
+	if(lParent != nullptr) {
+		lParent->cacheMimeType(objectName(), mMimeType);
+	}
+	return mMimeType;
 }
 
 BlobFile::BlobFile(Node *pParent, const git_oid *pOid, const QString &pName, qint64 pMode)
-   : File(pParent, pName, pMode), mOid(*pOid), mBlob(nullptr)
+   : File(pParent, pName, pMode), mOid(*pOid), mDataLoaded(false)
 {}
 
-BlobFile::~BlobFile() {
-    git_blob_free(mBlob);
-}
-
 int BlobFile::read(QByteArray &pChunk, qint64 pReadSize) {
 	if(mOffset >= size()) {
 		return KIO::ERR_NO_CONTENT;
 	}
-	git_blob *lBlob = cachedBlob();
-	if(lBlob == nullptr) {
+	if(!loadData()) {
 		return KIO::ERR_COULD_NOT_READ;
 	}
-	quint64 lAvailableSize = size() - mOffset;
+	// the size from the metadata can be more than the blob holds
+	if(mOffset >= static_cast<quint64>(mData.size())) {
+		return KIO::ERR_NO_CONTENT;
+	}
+	quint64 lAvailableSize = static_cast<quint64>(mData.size()) - mOffset;
 	quint64 lReadSize = lAvailableSize;
 	if(pReadSize > 0 && static_cast<quint64>(pReadSize) < lAvailableSize) {
 		lReadSize = static_cast<quint64>(pReadSize);
 	}
-	pChunk = QByteArray::fromRawData(static_cast<const char *>(git_blob_rawcontent(lBlob)) + mOffset, static_cast<int>(lReadSize));
+	pChunk = QByteArray::fromRawData(mData.constData() + mOffset, static_cast<int>(lReadSize));
 	mOffset += lReadSize;
 	return 0;
 }
 
-git_blob *BlobFile::cachedBlob() {
-	if(mBlob == nullptr) {
-		git_blob_lookup(&mBlob, mRepository, &mOid);
+void BlobFile::stopReading() {
+	// the blob cache decides how long the data is kept around.
+	mData.clear();
+	mDataLoaded = false;
+}
+
+bool BlobFile::loadData() {
+	if(!mDataLoaded) {
+		mDataLoaded = BlobCache::read(mContext->mRepository, &mOid, mData, &mBlobCorrupt);
+		if(mBlobCorrupt) {
+			mCorruptBlob = mOid;
+		}
 	}
-	return mBlob;
+	return mDataLoaded;
 }
 
 quint64 BlobFile::calculateSize() {
 	if(mSize >= 0) {
 		return static_cast<quint64>(mSize);
 	}
-	git_blob *lBlob = cachedBlob();
-	if(lBlob == nullptr) {
+	if(!loadData()) {
 		return 0;
 	}
-	return static_cast<quint64>(git_blob_rawsize(lBlob));
+	return static_cast<quint64>(mData.size());
 }
 
+int ChunkFile::mReadAheadWindow = 0;
+
 ChunkFile::ChunkFile(Node *pParent, const git_oid *pOid, const QString &pName, qint64 pMode)
-   : File(pParent, pName, pMode), mOid(*pOid), mCurrentBlob(nullptr), mValidSeekPosition(false)
-{
-	seek(0);
-}
+   : File(pParent, pName, pMode), mOid(*pOid), mWalker(nullptr), mReadAhead(nullptr), mChunkStart(0),
+     mIndexLoadTried(false), mIndexBuildTried(false)
+{}
 
 ChunkFile::~ChunkFile() {
-	if(mCurrentBlob != nullptr) {
-		git_blob_free(mCurrentBlob);
-	}
+	stopReading();
 }
 
 int ChunkFile::seek(quint64 pOffset) {
 	if(pOffset >= size()) {
 		return KIO::ERR_COULD_NOT_SEEK;
 	}
-	if(mOffset == pOffset && mValidSeekPosition) {
-		return 0; // nothing to do, success
-	}
-
+	// The chunk containing the new offset gets fetched on next read.
 	mOffset = pOffset;
-	mValidSeekPosition = false;
+	return 0; // success.
+}
 
-	while(!mPositionStack.isEmpty()) {
-		delete mPositionStack.takeLast();
+int ChunkFile::read(QByteArray &pChunk, qint64 pReadSize) {
+	if(mOffset >= size()) {
+		return KIO::ERR_NO_CONTENT;
 	}
-	if(mCurrentBlob != nullptr) {
-		git_blob_free(mCurrentBlob);
-		mCurrentBlob = nullptr;
+	if(mOffset < mChunkStart || mOffset >= mChunkStart + static_cast<quint64>(mChunk.size())) {
+		int lRetVal = fetchChunk();
+		if(lRetVal != 0) {
+			return lRetVal;
+		}
 	}
 
-	git_tree *lTree;
-	if(0 != git_tree_lookup(&lTree, mRepository, &mOid)) {
-		return KIO::ERR_COULD_NOT_SEEK;
+	quint64 lSkipSize = mOffset - mChunkStart;
+	quint64 lAvailableSize = static_cast<quint64>(mChunk.size()) - lSkipSize;
+	quint64 lReadSize = lAvailableSize;
+	if(pReadSize > 0 && static_cast<quint64>(pReadSize) < lAvailableSize) {
+		lReadSize = static_cast<quint64>(pReadSize);
 	}
+	pChunk = QByteArray::fromRawData(mChunk.constData() + lSkipSize, static_cast<int>(lReadSize));
+	mOffset += lReadSize;
+	return 0; // success.
+}
 
-	auto lCurrentPos = new TreePosition(lTree);
-	mPositionStack.append(lCurrentPos);
-	quint64 lLocalOffset = mOffset;
-	while(true) {
-		ulong lLower = 0;
-		const git_tree_entry *lLowerEntry = git_tree_entry_byindex(lCurrentPos->mTree, lLower);
-		ulong lLowerOffset = 0;
-		ulong lUpper = git_tree_entrycount(lCurrentPos->mTree);
-
-		while(lUpper - lLower > 1) {
-			ulong lToCheck = lLower + (lUpper - lLower)/2;
-			const git_tree_entry *lCheckEntry = git_tree_entry_byindex(lCurrentPos->mTree, lToCheck);
-			quint64 lCheckOffset;
-			if(!offsetFromName(lCheckEntry, lCheckOffset)) {
-				return KIO::ERR_COULD_NOT_SEEK;
-			}
-			if(lCheckOffset > lLocalOffset) {
-				lUpper = lToCheck;
-			} else {
-				lLower = lToCheck;
-				lLowerEntry = lCheckEntry;
-				lLowerOffset = lCheckOffset;
+void ChunkFile::stopReading() {
+	if(mReadAhead != nullptr) {
+		qCDebug(KUPKIO) << "read-ahead of" << objectName() << "stalled" << mReadAhead->mStallCount
+		                << "times, waited" << mReadAhead->mStallTime / 1000000 << "ms in total";
+		delete mReadAhead;
+		mReadAhead = nullptr;
+	}
+	delete mWalker;
+	mWalker = nullptr;
+	mChunk.clear();
+	mChunkStart = 0;
+}
+
+int ChunkFile::fetchChunk() {
+	mBlobCorrupt = false;
+	bool lSequential = !mChunk.isEmpty() && mOffset == mChunkStart + static_cast<quint64>(mChunk.size());
+	if(!lSequential && !mIndex) {
+		// An index saved earlier is always worth using, building a new one only
+		// pays off when the reader jumps around in the file.
+		bool lBuild = mOffset > 0 && !mIndexBuildTried;
+		if(!mIndexLoadTried || lBuild) {
+			mIndex = ChunkIndex::find(mContext->mRepository, &mOid, lBuild);
+			mIndexLoadTried = true;
+			mIndexBuildTried |= lBuild;
+			if(mIndex) {
+				delete mWalker;
+				mWalker = nullptr;
 			}
 		}
-		lCurrentPos->mIndex = lLower;
-		// the remainder of the offset will be a local offset into the blob or into the subtree.
-		lLocalOffset -= lLowerOffset;
-
-		if(S_ISDIR(git_tree_entry_filemode(lLowerEntry))) {
-			git_tree *lTree;
-			if(0 != git_tree_lookup(&lTree, mRepository, git_tree_entry_id(lLowerEntry))) {
-				return KIO::ERR_COULD_NOT_SEEK;
+	}
+	if(mReadAhead == nullptr && lSequential && mReadAheadWindow > 0) {
+		// Reading continues where the last chunk ended, worth reading ahead from here on.
+		mReadAhead = new ChunkReadAhead(git_repository_path(mContext->mRepository), &mOid, mReadAheadWindow);
+		mReadAhead->start();
+		lSequential = false;
+	}
+	if(mReadAhead != nullptr) {
+		if(!lSequential) {
+			mReadAhead->restart(mOffset, mIndex);
+		}
+		if(!mReadAhead->takeChunk(mChunk, mChunkStart)) {
+			mChunk.clear();
+			mBlobCorrupt = mReadAhead->corruptBlob(mCorruptBlob);
+			return KIO::ERR_COULD_NOT_READ;
+		}
+	} else {
+		if(mWalker == nullptr) {
+			mWalker = new ChunkWalker(mContext->mRepository, &mOid, mIndex);
+		}
+		quint64 lChunkStart = mChunkStart + static_cast<quint64>(mChunk.size());
+		if(lSequential) {
+			if(!mWalker->next()) {
+				mChunk.clear();
+				return KIO::ERR_COULD_NOT_READ;
 			}
-			lCurrentPos = new TreePosition(lTree);
-			mPositionStack.append(lCurrentPos);
 		} else {
-			lCurrentPos->mSkipSize = lLocalOffset;
-			break;
+			quint64 lSkipSize;
+			if(!mWalker->seek(mOffset, lSkipSize)) {
+				mChunk.clear();
+				return KIO::ERR_COULD_NOT_READ;
+			}
+			lChunkStart = mOffset - lSkipSize;
+		}
+		if(mWalker->currentBlob() == nullptr ||
+		      !BlobCache::read(mContext->mRepository, mWalker->currentBlob(), mChunk, &mBlobCorrupt)) {
+			if(mBlobCorrupt) {
+				mCorruptBlob = *mWalker->currentBlob();
+			}
+			mChunk.clear();
+			return KIO::ERR_COULD_NOT_READ;
 		}
+		mChunkStart = lChunkStart;
+	}
+	if(mOffset < mChunkStart || mOffset >= mChunkStart + static_cast<quint64>(mChunk.size())) {
+		// this must mean a corrupt bup tree somehow
+		mChunk.clear();
+		return KIO::ERR_COULD_NOT_READ;
 	}
-	mValidSeekPosition = true;
 	return 0; // success.
 }
 
-int ChunkFile::read(QByteArray &pChunk, qint64 pReadSize) {
-	if(mOffset >= size()) {
-		return KIO::ERR_NO_CONTENT;
-	}
-	if(!mValidSeekPosition) {
-		return KIO::ERR_COULD_NOT_READ;
+quint64 ChunkFile::calculateSize() {
+	if(mSize >= 0) {
+		return static_cast<quint64>(mSize);
 	}
+	return calculateChunkFileSize(&mOid, mContext->mRepository);
+}
 
-	TreePosition *lCurrentPos = mPositionStack.last();
-	if(mCurrentBlob != nullptr && lCurrentPos->mSkipSize == 0) {
-		// skipsize has been reset, this means current blob has been exhausted. Free it
-		// now as we're about to fetch a new one.
-		git_blob_free(mCurrentBlob);
-		mCurrentBlob = nullptr;
+ArchivedDirectory::ArchivedDirectory(Node *pParent, const git_oid *pOid, const QString &pName, qint64 pMode)
+   : Directory(pParent, pName, pMode), mHoldsTree(false)
+{
+	mOid = *pOid;
+}
+
+ArchivedDirectory::~ArchivedDirectory() {
+	if(mContext->mNodeCache != nullptr) {
+		mContext->mNodeCache->remove(this);
 	}
+	releaseChildren();
+}
 
-	if(mCurrentBlob == nullptr) {
-		const git_tree_entry *lTreeEntry = git_tree_entry_byindex(lCurrentPos->mTree, lCurrentPos->mIndex);
-		if(0 != git_blob_lookup(&mCurrentBlob, mRepository, git_tree_entry_id(lTreeEntry))) {
-			return KIO::ERR_COULD_NOT_READ;
+NodeMap ArchivedDirectory::subNodes() {
+	NodeRange lChildren = children();
+	for(quint32 i = lChildren.mFirst; i < lChildren.mFirst + lChildren.mCount; ++i) {
+		if(!mSubNodes->contains(string(record(i).mName))) {
+			materialize(i);
 		}
 	}
+	return *mSubNodes;
+}
 
-	auto lTotalSize = static_cast<quint64>(git_blob_rawsize(mCurrentBlob));
-	if(lTotalSize < lCurrentPos->mSkipSize) { // this must mean a corrupt bup tree somehow
-		return KIO::ERR_COULD_NOT_READ;
+Node *ArchivedDirectory::subNode(const QString &pName) {
+	NodeRange lChildren = children();
+	Node *lNode = mSubNodes->value(pName, nullptr);
+	if(lNode != nullptr) {
+		return lNode;
 	}
-	quint64 lAvailableSize = lTotalSize - lCurrentPos->mSkipSize;
-	quint64 lReadSize = lAvailableSize;
-	if(pReadSize > 0 && static_cast<quint64>(pReadSize) < lAvailableSize) {
-		lReadSize = static_cast<quint64>(pReadSize);
+	quint32 lName = mContext->mArena->mStrings.find(pName);
+	if(lName == 0) {
+		return nullptr;
 	}
-	pChunk = QByteArray::fromRawData(static_cast<const char *>(git_blob_rawcontent(mCurrentBlob)) + lCurrentPos->mSkipSize, static_cast<int>(lReadSize));
-	mOffset += lReadSize;
-	lCurrentPos->mSkipSize += lReadSize;
-
-	// check if it's time to find next blob.
-	if(lCurrentPos->mSkipSize == lTotalSize) {
-		lCurrentPos->mSkipSize = 0;
-		lCurrentPos->mIndex++;
-		while(true) {
-			if(lCurrentPos->mIndex < git_tree_entrycount(lCurrentPos->mTree)) {
-				const git_tree_entry *lTreeEntry = git_tree_entry_byindex(lCurrentPos->mTree, lCurrentPos->mIndex);
-				if(S_ISDIR(git_tree_entry_filemode(lTreeEntry))) {
-					git_tree *lTree;
-					if(0 != git_tree_lookup(&lTree, mRepository, git_tree_entry_id(lTreeEntry))) {
-						return KIO::ERR_COULD_NOT_READ;
-					}
-					lCurrentPos = new TreePosition(lTree); // will have index and skipsize initialized to zero.
-					mPositionStack.append(lCurrentPos);
-				} else {
-					// it's a blob
-					break;
-				}
-			} else {
-				delete mPositionStack.takeLast();
-				if(mPositionStack.isEmpty()) {
-					Q_ASSERT(mOffset == size());
-					break;
-				}
-				lCurrentPos = mPositionStack.last();
-				lCurrentPos->mIndex++;
-			}
+	for(quint32 i = lChildren.mFirst; i < lChildren.mFirst + lChildren.mCount; ++i) {
+		if(record(i).mName == lName) {
+			return materialize(i);
 		}
 	}
-	return 0; // success.
+	return nullptr;
 }
 
-quint64 ChunkFile::calculateSize() {
-	if(mSize >= 0) {
-		return static_cast<quint64>(mSize);
+void ArchivedDirectory::evictSubNodes() {
+	releaseChildren();
+	Directory::evictSubNodes();
+}
+
+void ArchivedDirectory::releaseChildren() {
+	if(mHoldsTree && mContext->mArena != nullptr) {
+		quint32 lFreed = mContext->mArena->releaseTree(mOid);
+		if(lFreed > 0 && mContext->mNodeCache != nullptr) {
+			mContext->mNodeCache->refundShared(lFreed * sizeof(NodeRecord));
+		}
 	}
-	return calculateChunkFileSize(&mOid, mRepository);
+	mHoldsTree = false;
+	mChildren = NodeRange{0, 0};
 }
 
-ChunkFile::TreePosition::TreePosition(git_tree *pTree) {
-	mTree = pTree;
-	mIndex = 0;
-	mSkipSize = 0;
+NodeRange ArchivedDirectory::children() {
+	if(mSubNodes != nullptr) {
+		if(mContext->mNodeCache != nullptr) {
+			mContext->mNodeCache->touch(this);
+		}
+		return mChildren;
+	}
+	mSubNodes = new NodeMap();
+	generateSubNodes();
+	if(mContext->mNodeCache != nullptr) {
+		// the records are paid for by the arena entry of the tree, see generateSubNodes().
+		mContext->mNodeCache->insert(this, 0);
+	}
+	return mChildren;
 }
 
-ChunkFile::TreePosition::~TreePosition() {
-	git_tree_free(mTree);
+quint64 ArchivedDirectory::fileSize(NodeRecord &pRecord) {
+	if(S_ISDIR(pRecord.mMode)) {
+		return 0;
+	}
+	if(pRecord.mSize < 0) {
+		pRecord.mSize = 0;
+		if(pRecord.isChunked()) {
+			pRecord.mSize = static_cast<qint64>(calculateChunkFileSize(&pRecord.mOid, mContext->mRepository));
+		} else {
+			git_blob *lBlob;
+			if(0 == git_blob_lookup(&lBlob, mContext->mRepository, &pRecord.mOid)) {
+				pRecord.mSize = static_cast<qint64>(git_blob_rawsize(lBlob));
+				git_blob_free(lBlob);
+			}
+		}
+	}
+	return static_cast<quint64>(pRecord.mSize);
 }
 
-ArchivedDirectory::ArchivedDirectory(Node *pParent, const git_oid *pOid, const QString &pName, qint64 pMode)
-   : Directory(pParent, pName, pMode)
-{
-	mOid = *pOid;
-	mMetadataStream = nullptr;
-	mTree = nullptr;
-	if(0 != git_tree_lookup(&mTree, mRepository, &mOid)) {
+void ArchivedDirectory::readTreeMetadata(const git_oid *pOid, Metadata &pMetadata) {
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, mContext->mRepository, pOid)) {
 		return;
 	}
-	const git_tree_entry *lTreeEntry = git_tree_entry_byname(mTree, ".bupm");
-	if(lTreeEntry != nullptr && 0 == git_blob_lookup(&mMetadataBlob, mRepository, git_tree_entry_id(lTreeEntry))) {
-		mMetadataStream = new VintStream(git_blob_rawcontent(mMetadataBlob), static_cast<int>(git_blob_rawsize(mMetadataBlob)), this);
-		readMetadata(*mMetadataStream); // the first entry is metadata for the directory itself
+	git_blob *lMetadataBlob;
+	const git_tree_entry *lTreeEntry = git_tree_entry_byname(lTree, ".bupm");
+	if(lTreeEntry != nullptr && 0 == git_blob_lookup(&lMetadataBlob, mContext->mRepository, git_tree_entry_id(lTreeEntry))) {
+		VintStream lMetadataStream(git_blob_rawcontent(lMetadataBlob), static_cast<size_t>(git_blob_rawsize(lMetadataBlob)));
+		readMetadata(lMetadataStream, pMetadata); // the first entry is metadata for the directory itself
+		git_blob_free(lMetadataBlob);
 	}
+	git_tree_free(lTree);
 }
 
 void ArchivedDirectory::generateSubNodes() {
-	if(mTree == nullptr) {
+	// Other commits very likely have this same folder open already.
+	mChildren = NodeRange{0, 0};
+	if(mContext->mArena->acquireTree(mOid, mChildren)) {
+		mHoldsTree = true;
+		return;
+	}
+	// This can run again after the records have been evicted from the node
+	// cache, so everything is looked up from the tree id each time.
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, mContext->mRepository, &mOid)) {
 		return;
 	}
-	ulong lEntryCount = git_tree_entrycount(mTree);
-	for(uint i = 0; i < lEntryCount; ++i) {
+	QMimeDatabase lMimeDatabase;
+	auto lEntryCount = static_cast<quint32>(git_tree_entrycount(lTree));
+	QVector<Metadata> lMetadataList;
+	int lMetadataIndex = 1; // the first entry is metadata for the directory itself, skip it.
+	git_blob *lMetadataBlob;
+	const git_tree_entry *lMetadataEntry = git_tree_entry_byname(lTree, ".bupm");
+	if(lMetadataEntry != nullptr && 0 == git_blob_lookup(&lMetadataBlob, mContext->mRepository, git_tree_entry_id(lMetadataEntry))) {
+		lMetadataList.reserve(static_cast<int>(lEntryCount));
+		readMetadataList(git_blob_rawcontent(lMetadataBlob), static_cast<size_t>(git_blob_rawsize(lMetadataBlob)), lMetadataList);
+		git_blob_free(lMetadataBlob);
+	}
+	mChildren = mContext->mArena->allocate(lMetadataEntry != nullptr ? lEntryCount - 1 : lEntryCount);
+	quint32 lRecordIndex = mChildren.mFirst;
+	for(quint32 i = 0; i < lEntryCount; ++i) {
 		uint lMode;
 		const git_oid *lOid;
 		QString lName;
 		bool lChunked;
-		const git_tree_entry *lTreeEntry = git_tree_entry_byindex(mTree, i);
+		const git_tree_entry *lTreeEntry = git_tree_entry_byindex(lTree, i);
 		getEntryAttributes(lTreeEntry, lMode, lChunked, lOid, lName);
 		if(lName == QStringLiteral(".bupm")) {
 			continue;
 		}
 
-		Node *lSubNode = nullptr;
+		Metadata lMetadata(lMode);
+		if(S_ISDIR(lMode)) {
+			readTreeMetadata(lOid, lMetadata);
+		} else if(lMetadataIndex < lMetadataList.count()) {
+			lMetadata = lMetadataList.at(lMetadataIndex++);
+			if(lMetadata.mMode == 0) {
+				lMetadata.mMode = lMode;
+			}
+		}
+		if(S_ISLNK(lMode) && lMetadata.mSymlinkTarget.isEmpty()) {
+			git_blob *lBlob;
+			if(0 == git_blob_lookup(&lBlob, mContext->mRepository, lOid)) {
+				lMetadata.mSymlinkTarget = QString::fromUtf8(static_cast<const char *>(git_blob_rawcontent(lBlob)),
+				                                             static_cast<int>(git_blob_rawsize(lBlob)));
+				git_blob_free(lBlob);
+			}
+		}
+
+		NodeRecord &lRecord = record(lRecordIndex++);
+		lRecord.mOid = *lOid;
+		lRecord.mName = mContext->mArena->mStrings.intern(lName);
+		lRecord.mMode = static_cast<quint32>(lMetadata.mMode);
+		lRecord.mSymlinkTarget = mContext->mArena->mStrings.intern(lMetadata.mSymlinkTarget);
+		lRecord.mUid = static_cast<quint32>(lMetadata.mUid);
+		lRecord.mGid = static_cast<quint32>(lMetadata.mGid);
+		lRecord.mAtime = lMetadata.mAtime;
+		lRecord.mMtime = lMetadata.mMtime;
+		lRecord.mSize = lMetadata.mSize;
+		lRecord.mFlags = lChunked ? NodeRecord::Chunked : 0;
 		if(S_ISDIR(lMode)) {
-			lSubNode = new ArchivedDirectory(this, lOid, lName, lMode);
-		} else if(S_ISLNK(lMode)) {
-			lSubNode = new Symlink(this, lOid, lName, lMode);
-		} else if(lChunked) {
-			lSubNode = new ChunkFile(this, lOid, lName, lMode);
+			lRecord.mMimeType = mContext->mArena->mStrings.intern(QStringLiteral("inode/directory"));
 		} else {
-			lSubNode = new BlobFile(this, lOid, lName, lMode);
+			// Only a guess from the name, reading the content of every file would make listing slow.
+			lRecord.mMimeType = mContext->mArena->mStrings.intern(lMimeDatabase.mimeTypeForFile(lName, QMimeDatabase::MatchExtension).name());
 		}
-		mSubNodes->insert(lName, lSubNode);
-		if(!S_ISDIR(lMode) && mMetadataStream != nullptr) {
-			lSubNode->readMetadata(*mMetadataStream);
+	}
+	git_tree_free(lTree);
+	mContext->mArena->addTree(mOid, mChildren);
+	mHoldsTree = true;
+	if(mContext->mNodeCache != nullptr) {
+		mContext->mNodeCache->chargeShared(mChildren.mCount * sizeof(NodeRecord));
+	}
+}
+
+Node *ArchivedDirectory::createNode(const NodeRecord &pRecord, QObject *pParent) {
+	const QString &lName = string(pRecord.mName);
+	Node *lNode;
+	if(S_ISDIR(pRecord.mMode)) {
+		lNode = new ArchivedDirectory(this, &pRecord.mOid, lName, pRecord.mMode);
+	} else if(S_ISLNK(pRecord.mMode)) {
+		lNode = new Symlink(this, &pRecord.mOid, lName, pRecord.mMode);
+	} else if(pRecord.isChunked()) {
+		lNode = new ChunkFile(this, &pRecord.mOid, lName, pRecord.mMode);
+	} else {
+		lNode = new BlobFile(this, &pRecord.mOid, lName, pRecord.mMode);
+	}
+	if(pParent != this) {
+		lNode->setParent(pParent); // created with this as parent only to share the repository context
+	}
+	lNode->mUid = pRecord.mUid;
+	lNode->mGid = pRecord.mGid;
+	lNode->mAtime = pRecord.mAtime;
+	lNode->mMtime = pRecord.mMtime;
+	lNode->mSize = pRecord.mSize;
+	lNode->mSymlinkTarget = string(pRecord.mSymlinkTarget);
+	if(pRecord.mMimeType != 0) {
+		lNode->mMimeType = string(pRecord.mMimeType);
+	}
+	auto lFile = qobject_cast<File *>(lNode);
+	if(lFile != nullptr) {
+		lFile->mMimeTypeFromContent = (pRecord.mFlags & NodeRecord::MimeTypeFromContent) != 0;
+	}
+	return lNode;
+}
+
+bool ArchivedDirectory::totals(TreeTotals &pTotals) {
+	return TreeTotals::calculate(mContext->mRepository, &mOid, pTotals);
+}
+
+const QString &ArchivedDirectory::contentMimeType(quint32 pIndex) {
+	NodeRecord &lRecord = record(pIndex);
+	if(!S_ISDIR(lRecord.mMode) && !(lRecord.mFlags & NodeRecord::MimeTypeFromContent)) {
+		auto lFile = qobject_cast<File *>(mSubNodes->value(string(lRecord.mName), nullptr));
+		QString lMimeType;
+		if(lFile != nullptr) {
+			lMimeType = lFile->contentMimeType();
+		} else {
+			// a short lived node is the easiest way to read the start of blobs and chunked files alike.
+			QScopedPointer<Node> lNode(createNode(lRecord, nullptr));
+			lMimeType = qobject_cast<File *>(lNode.data())->contentMimeType();
+		}
+		quint32 lOldMimeType = lRecord.mMimeType;
+		lRecord.mMimeType = mContext->mArena->mStrings.intern(lMimeType);
+		mContext->mArena->mStrings.release(lOldMimeType);
+		lRecord.mFlags |= NodeRecord::MimeTypeFromContent;
+	}
+	return string(lRecord.mMimeType);
+}
+
+void ArchivedDirectory::cacheMimeType(const QString &pName, const QString &pMimeType) {
+	NodeRange lChildren = children();
+	quint32 lName = mContext->mArena->mStrings.find(pName);
+	for(quint32 i = lChildren.mFirst; lName != 0 && i < lChildren.mFirst + lChildren.mCount; ++i) {
+		NodeRecord &lRecord = record(i);
+		if(lRecord.mName == lName) {
+			quint32 lOldMimeType = lRecord.mMimeType;
+			lRecord.mMimeType = mContext->mArena->mStrings.intern(pMimeType);
+			mContext->mArena->mStrings.release(lOldMimeType);
+			lRecord.mFlags |= NodeRecord::MimeTypeFromContent;
+			return;
 		}
 	}
-	if(mMetadataStream != nullptr) {
-		delete mMetadataStream;
-		mMetadataStream = nullptr;
-		git_blob_free(mMetadataBlob);
-		mMetadataBlob = nullptr;
+}
+
+Node *ArchivedDirectory::materialize(quint32 pIndex) {
+	Node *lNode = createNode(record(pIndex), this);
+	mSubNodes->insert(lNode->objectName(), lNode);
+	if(mContext->mNodeCache != nullptr) {
+		mContext->mNodeCache->grow(this, lNode->memoryCost());
 	}
-	git_tree_free(mTree);
-	mTree = nullptr;
+	return lNode;
+}
+
+CommitDirectory::CommitDirectory(Node *pParent, const git_oid *pTreeOid, const QString &pName, qint64 pCommitTime)
+   : ArchivedDirectory(pParent, pTreeOid, pName, DEFAULT_MODE_DIRECTORY), mMetadataLoaded(false)
+{
+	mAtime = pCommitTime;
+	mMtime = pCommitTime;
+}
+
+void CommitDirectory::loadMetadata() {
+	if(mMetadataLoaded) {
+		return;
+	}
+	mMetadataLoaded = true;
+	Metadata lMetadata(mMode);
+	readTreeMetadata(&mOid, lMetadata);
+	mMode = lMetadata.mMode;
+	mUid = lMetadata.mUid;
+	mGid = lMetadata.mGid;
+	mAtime = lMetadata.mAtime; // but keep the commit time as modification time
+}
+
+void CommitDirectory::generateSubNodes() {
+	ArchivedDirectory::generateSubNodes();
+	loadMetadata();
 }
 
 Branch::Branch(Node *pParent, const char *pName)
-   : Directory(pParent, QString::fromLocal8Bit(pName).remove(0, 11), DEFAULT_MODE_DIRECTORY)
+   : Directory(pParent, QString::fromLocal8Bit(pName).remove(0, 11), DEFAULT_MODE_DIRECTORY),
+     mCommitIndex(QByteArray(pName)), mFilenameIndex(QByteArray(pName))
 {
 	mRefName = QByteArray(pName);
 	QByteArray lPath = parent()->objectName().toLocal8Bit();
@@ -414,40 +657,57 @@ void Branch::reload() {
 	generateSubNodes();
 }
 
+const QVector<CommitIndex::Entry> &Branch::commits() {
+	reload();
+	return mCommitIndex.mEntries;
+}
+
+bool Branch::pathHistory(const QStringList &pPath, QVector<PathHistory::Version> &pVersions) {
+	PathHistory lHistory(mRefName, pPath);
+	if(!lHistory.update(mContext->mRepository, commits())) {
+		return false;
+	}
+	pVersions = lHistory.mVersions;
+	return true;
+}
+
+const FilenameIndex *Branch::filenameIndex() {
+	return mFilenameIndex.update(mContext->mRepository) ? &mFilenameIndex : nullptr;
+}
+
 void Branch::generateSubNodes() {
-	if(0 != git_revwalk_push_ref(mRevisionWalker, mRefName)) {
+	int lAdded;
+	if(!mCommitIndex.update(mContext->mRepository, mContext->mRevisionWalker, lAdded)) {
 		return;
 	}
-	git_oid lOid;
-	while(0 == git_revwalk_next(&lOid, mRevisionWalker)) {
-		git_commit *lCommit;
-		if(0 != git_commit_lookup(&lCommit, mRepository, &lOid)) {
-			continue;
-		}
-		QString lCommitTimeLocal = vfsTimeToString(git_commit_time(lCommit));
+	// on reload only the commits added to the index can be missing.
+	int lCount = mSubNodes->isEmpty() ? mCommitIndex.mEntries.count() : lAdded;
+	for(int i = 0; i < lCount; ++i) {
+		const CommitIndex::Entry &lEntry = mCommitIndex.mEntries.at(i);
+		QString lCommitTimeLocal = vfsTimeToString(lEntry.mTime);
 		if(!mSubNodes->contains(lCommitTimeLocal)) {
-			Directory * lDirectory = new ArchivedDirectory(this, git_commit_tree_id(lCommit),
-			                                               lCommitTimeLocal, DEFAULT_MODE_DIRECTORY);
-			lDirectory->mMtime = git_commit_time(lCommit);
-			mSubNodes->insert(lCommitTimeLocal, lDirectory);
+			mSubNodes->insert(lCommitTimeLocal, new CommitDirectory(this, &lEntry.mTree, lCommitTimeLocal, lEntry.mTime));
 		}
-		git_commit_free(lCommit);
 	}
 }
 
-Repository::Repository(QObject *pParent, const QString &pRepositoryPath)
+Repository::Repository(QObject *pParent, const QString &pRepositoryPath, quint64 pNodeCacheBudget)
    : Directory(pParent, pRepositoryPath, DEFAULT_MODE_DIRECTORY)
 {
+	mContext = &mRepositoryContext;
+	mContext->mNodeCache = new NodeCache(pNodeCacheBudget);
+	mContext->mArena = new NodeArena();
 	if(!objectName().endsWith(QLatin1Char('/'))) {
 		setObjectName(objectName() + QLatin1Char('/'));
 	}
-	if(0 != git_repository_open(&mRepository, pRepositoryPath.toLocal8Bit())) {
+	if(0 != git_repository_open(&mContext->mRepository, pRepositoryPath.toLocal8Bit())) {
 		qCWarning(KUPKIO) << "could not open repository " << pRepositoryPath;
-		mRepository = nullptr;
+		mContext->mRepository = nullptr;
 		return;
 	}
+	addBupOdbBackend(mContext->mRepository);
 	git_strarray lBranchNames;
-	git_reference_list(&lBranchNames, mRepository);
+	git_reference_list(&lBranchNames, mContext->mRepository);
 	for(uint i = 0; i < lBranchNames.count; ++i) {
 		QString lRefName = QString::fromLocal8Bit(lBranchNames.strings[i]);
 		if(lRefName.startsWith(QStringLiteral("refs/heads/"))) {
@@ -465,25 +725,40 @@ Repository::Repository(QObject *pParent, const QString &pRepositoryPath)
 	}
 	git_strarray_free(&lBranchNames);
 
-	if(0 != git_revwalk_new(&mRevisionWalker, mRepository)) {
+	if(0 != git_revwalk_new(&mContext->mRevisionWalker, mContext->mRepository)) {
 		qCWarning(KUPKIO) << "could not create a revision walker in repository " << pRepositoryPath;
-		mRevisionWalker = nullptr;
+		mContext->mRevisionWalker = nullptr;
 		return;
 	}
 }
 
 Repository::~Repository() {
-	if(mRepository != nullptr) {
-		git_repository_free(mRepository);
+	// Sub nodes point to the context, delete them while it is still around.
+	// No need for them to update the node cache or the arena on the way.
+	NodeCache *lNodeCache = mContext->mNodeCache;
+	NodeArena *lArena = mContext->mArena;
+	mContext->mNodeCache = nullptr;
+	mContext->mArena = nullptr;
+	evictSubNodes();
+	delete lNodeCache;
+	delete lArena;
+	if(mContext->mRepository != nullptr) {
+		git_repository_free(mContext->mRepository);
+	}
+	if(mContext->mRevisionWalker != nullptr) {
+		git_revwalk_free(mContext->mRevisionWalker);
 	}
-	if(mRevisionWalker != nullptr) {
-		git_revwalk_free(mRevisionWalker);
+}
+
+void Repository::trimNodeCache(Node *pPinned) {
+	if(mContext->mNodeCache != nullptr) {
+		mContext->mNodeCache->trim(pPinned);
 	}
 }
 
 void Repository::generateSubNodes() {
 	git_strarray lBranchNames;
-	git_reference_list(&lBranchNames, mRepository);
+	git_reference_list(&lBranchNames, mContext->mRepository);
 	for(uint i = 0; i < lBranchNames.count; ++i) {
 		auto lRefName = QString::fromLocal8Bit(lBranchNames.strings[i]);
 		if(lRefName.startsWith(QStringLiteral("refs/heads/"))) {
@@ -10,24 +10,46 @@
 #include <kio/global.h>
 #include <sys/types.h>
 
+#include "chunkindex.h"
+#include "commitindex.h"
+#include "filenameindex.h"
+#include "nodearena.h"
+#include "pathhistory.h"
 #include "vfshelpers.h"
 
+class NodeCache;
+struct TreeTotals;
+
+// What all nodes of one repository share. Each open repository has its own,
+// owned by its Repository node.
+struct RepositoryContext {
+	git_repository *mRepository;
+	git_revwalk *mRevisionWalker;
+	NodeCache *mNodeCache;
+	NodeArena *mArena;
+};
+
 class Node: public QObject, public Metadata {
 	Q_OBJECT
 public:
 	Node(QObject *pParent, const QString &pName, qint64 pMode);
 	~Node() override {}
-	virtual int readMetadata(VintStream &pMetadataStream);
 	Node *resolve(const QString &pPath, bool pFollowLinks = false);
 	Node *resolve(const QStringList &pPathList, bool pFollowLinks = false);
 	QString completePath();
 	Node *parentCommit();
 //	Node *parentRepository();
+	virtual quint64 memoryCost();
+	// Some nodes only get the full metadata when it is needed.
+	virtual void loadMetadata() {}
+	// for opening the repository again in other threads
+	QByteArray repositoryPath() {
+		return QByteArray(git_repository_path(mContext->mRepository));
+	}
 	QString mMimeType;
 
 protected:
-	static git_revwalk *mRevisionWalker;
-	static git_repository *mRepository;
+	RepositoryContext *mContext; // taken from the parent node
 };
 
 typedef QHash<QString, Node*> NodeMap;
@@ -41,7 +63,9 @@ public:
 		delete mSubNodes;
 	}
 	virtual NodeMap subNodes();
+	virtual Node *subNode(const QString &pName);
 	virtual void reload() {}
+	virtual void evictSubNodes();
 
 protected:
 	virtual void generateSubNodes() {}
@@ -56,6 +80,8 @@ public:
 	{
 		mOffset = 0;
 		mCachedSize = 0;
+		mMimeTypeFromContent = false;
+		mBlobCorrupt = false;
 	}
 	virtual quint64 size() {
 		if(mCachedSize == 0) {
@@ -71,26 +97,41 @@ public:
 		return 0; // success
 	}
 	virtual int read(QByteArray &pChunk, qint64 pReadSize = -1) = 0;
-	int readMetadata(VintStream &pMetadataStream) override;
+	// Free resources used for reading, until next read.
+	virtual void stopReading() {}
+	// mMimeType is only guessed from the file name until this has looked at the content.
+	QString contentMimeType();
+	bool mMimeTypeFromContent;
+	// The blob that did not match its id, if that is why read() failed.
+	const git_oid *corruptBlob() const {
+		return mBlobCorrupt ? &mCorruptBlob : nullptr;
+	}
 
 protected:
 	virtual quint64 calculateSize() = 0;
 	quint64 mOffset;
 	quint64 mCachedSize;
+	git_oid mCorruptBlob{};
+	bool mBlobCorrupt;
 };
 
 class BlobFile: public File {
 	Q_OBJECT
 public:
 	BlobFile(Node *pParent, const git_oid *pOid, const QString &pName, qint64 pMode);
-	~BlobFile() override;
 	int read(QByteArray &pChunk, qint64 pReadSize = -1) override;
 
+	void stopReading() override;
+	const git_oid *oid() const {
+		return &mOid;
+	}
+
 protected:
-	git_blob *cachedBlob();
+	bool loadData();
 	quint64 calculateSize() override;
 	git_oid mOid{};
-	git_blob *mBlob;
+	QByteArray mData; // shared with the blob cache
+	bool mDataLoaded;
 };
 
 class Symlink: public BlobFile {
@@ -98,15 +139,12 @@ class Symlink: public BlobFile {
 public:
 	Symlink(Node *pParent, const git_oid *pOid, const QString &pName, qint64 pMode)
 	   : BlobFile(pParent, pOid, pName, pMode)
-	{
-		QByteArray lArray;
-		if(0 == read(lArray)) {
-			mSymlinkTarget = QString::fromUtf8(lArray.data(), lArray.size());
-			seek(0);
-		}
-	}
+	{}
 };
 
+class ChunkWalker;
+class ChunkReadAhead;
+
 class ChunkFile: public File {
 	Q_OBJECT
 public:
@@ -114,35 +152,77 @@ public:
 	~ChunkFile() override;
 	int seek(quint64 pOffset) override;
 	int read(QByteArray &pChunk, qint64 pReadSize = -1) override;
+	void stopReading() override;
+	// the tree of chunks
+	const git_oid *oid() const {
+		return &mOid;
+	}
+
+	// Number of chunks to read ahead in a background thread, 0 to read synchronously.
+	static int mReadAheadWindow;
 
 protected:
 	quint64 calculateSize() override;
+	int fetchChunk();
 
 	git_oid mOid;
-	git_blob *mCurrentBlob;
-	struct TreePosition {
-		TreePosition(git_tree *pTree);
-		~TreePosition();
-		git_tree *mTree;
-		ulong mIndex;
-		quint64 mSkipSize;
-	};
-
-	QList<TreePosition *> mPositionStack;
-	bool mValidSeekPosition;
+	ChunkWalker *mWalker;
+	ChunkReadAhead *mReadAhead;
+	QByteArray mChunk; // the chunk at mChunkStart in the file
+	quint64 mChunkStart;
+	QSharedPointer<const ChunkIndex> mIndex;
+	bool mIndexLoadTried;
+	bool mIndexBuildTried;
 };
 
+// The entries of an archived directory are kept as compact records in the
+// node arena. Node objects are only created for entries that get resolved,
+// the sub node map holds those.
 class ArchivedDirectory: public Directory {
 	Q_OBJECT
 public:
 	ArchivedDirectory(Node *pParent, const git_oid *pOid, const QString &pName, qint64 pMode);
+	~ArchivedDirectory() override;
+	NodeMap subNodes() override;
+	Node *subNode(const QString &pName) override;
+	void evictSubNodes() override;
+
+	NodeRange children();
+	NodeRecord &record(quint32 pIndex) {
+		return mContext->mArena->record(pIndex);
+	}
+	const QString &string(quint32 pIndex) {
+		return mContext->mArena->mStrings.at(pIndex);
+	}
+	quint64 fileSize(NodeRecord &pRecord);
+	// Sniffs the content of the entry on first use, the result is kept in the record.
+	const QString &contentMimeType(quint32 pIndex);
+	void cacheMimeType(const QString &pName, const QString &pMimeType);
+	void readTreeMetadata(const git_oid *pOid, Metadata &pMetadata);
+	// Size and number of everything below this directory, from metadata only.
+	bool totals(TreeTotals &pTotals);
 
 protected:
 	void generateSubNodes() override;
+	Node *createNode(const NodeRecord &pRecord, QObject *pParent);
+	Node *materialize(quint32 pIndex);
+	void releaseChildren();
 	git_oid mOid{};
-	git_blob *mMetadataBlob{};
-	git_tree *mTree;
-	VintStream *mMetadataStream;
+	NodeRange mChildren{}; // shared with other directories of the same tree
+	bool mHoldsTree; // only once the tree was added to or acquired from the arena
+};
+
+// Placeholder for the root folder of a commit. Only knows the commit time
+// and tree until it is entered or its metadata is asked for.
+class CommitDirectory: public ArchivedDirectory {
+	Q_OBJECT
+public:
+	CommitDirectory(Node *pParent, const git_oid *pTreeOid, const QString &pName, qint64 pCommitTime);
+	void loadMetadata() override;
+
+protected:
+	void generateSubNodes() override;
+	bool mMetadataLoaded;
 };
 
 class Branch: public Directory {
@@ -150,24 +230,34 @@ class Branch: public Directory {
 public:
 	Branch(Node *pParent, const char *pName);
 	void reload() override;
+	// All commits, newest first, after checking for new ones.
+	const QVector<CommitIndex::Entry> &commits();
+	// The distinct versions of pPath, a path inside the commits, newest first.
+	bool pathHistory(const QStringList &pPath, QVector<PathHistory::Version> &pVersions);
+	// Every path in the commits, updated with new commits first.
+	const FilenameIndex *filenameIndex();
 
 protected:
 	void generateSubNodes() override;
 	QByteArray mRefName;
+	CommitIndex mCommitIndex;
+	FilenameIndex mFilenameIndex;
 };
 
 
 class Repository: public Directory {
 	Q_OBJECT
 public:
-	Repository(QObject *pParent, const QString &pRepositoryPath);
+	Repository(QObject *pParent, const QString &pRepositoryPath, quint64 pNodeCacheBudget);
 	~Repository() override;
 	bool isValid() {
-		return mRepository != nullptr && mRevisionWalker != nullptr;
+		return mRepositoryContext.mRepository != nullptr && mRepositoryContext.mRevisionWalker != nullptr;
 	}
+	void trimNodeCache(Node *pPinned);
 
 protected:
 	void generateSubNodes() override;
+	RepositoryContext mRepositoryContext{};
 };
 
 
@@ -0,0 +1,134 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "chunkindex.h"
+#include "vfshelpers.h"
+#include "kupkio_debug.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+static const char cIndexMagic[] = "KUPCHIDX";
+static const quint32 cIndexVersion = 1;
+static const int cIndexHeaderSize = CacheFile::cHeaderSize + 4;
+static const int cIndexEntrySize = 8 + GIT_OID_RAWSZ;
+static const int cMaxCachedIndexes = 32;
+
+static QMutex sCacheMutex;
+static QHash<git_oid, QSharedPointer<const ChunkIndex>> sCache;
+static QList<git_oid> sCacheOrder;
+
+bool ChunkIndex::mPersist = false;
+
+static bool addTree(git_repository *pRepository, const git_oid *pOid, quint64 pBase, QVector<ChunkIndex::Entry> &pEntries) {
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, pRepository, pOid)) {
+		return false;
+	}
+	bool lOk = true;
+	ulong lEntryCount = git_tree_entrycount(lTree);
+	for(ulong i = 0; i < lEntryCount && lOk; ++i) {
+		const git_tree_entry *lEntry = git_tree_entry_byindex(lTree, i);
+		quint64 lOffset;
+		if(!offsetFromName(lEntry, lOffset)) {
+			lOk = false;
+		} else if(S_ISDIR(git_tree_entry_filemode(lEntry))) {
+			lOk = addTree(pRepository, git_tree_entry_id(lEntry), pBase + lOffset, pEntries);
+		} else {
+			pEntries.append(ChunkIndex::Entry{pBase + lOffset, *git_tree_entry_id(lEntry)});
+		}
+	}
+	git_tree_free(lTree);
+	return lOk;
+}
+
+QSharedPointer<const ChunkIndex> ChunkIndex::find(git_repository *pRepository, const git_oid *pOid, bool pBuild) {
+	{
+		QMutexLocker lLocker(&sCacheMutex);
+		QSharedPointer<const ChunkIndex> lIndex = sCache.value(*pOid);
+		if(lIndex) {
+			return lIndex;
+		}
+	}
+
+	char lOidString[GIT_OID_HEXSZ + 1];
+	git_oid_tostr(lOidString, sizeof lOidString, pOid);
+	const QString lPath = repositoryCachePath(pRepository) + QStringLiteral("/chunkindex/") + QLatin1String(lOidString);
+	QSharedPointer<ChunkIndex> lIndex(new ChunkIndex);
+	if(!lIndex->load(lPath)) {
+		if(!pBuild || !lIndex->build(pRepository, pOid)) {
+			return QSharedPointer<const ChunkIndex>();
+		}
+		if(mPersist) {
+			lIndex->save(lPath);
+		}
+	}
+
+	QMutexLocker lLocker(&sCacheMutex);
+	if(!sCache.contains(*pOid)) {
+		sCache.insert(*pOid, lIndex);
+		sCacheOrder.append(*pOid);
+		while(sCacheOrder.count() > cMaxCachedIndexes) {
+			sCache.remove(sCacheOrder.takeFirst());
+		}
+	}
+	return lIndex;
+}
+
+int ChunkIndex::entryAt(quint64 pOffset) const {
+	auto lIter = std::upper_bound(mEntries.constBegin(), mEntries.constEnd(), pOffset,
+	                              [](quint64 pValue, const Entry &pEntry) {return pValue < pEntry.mOffset;});
+	return static_cast<int>(lIter - mEntries.constBegin()) - 1;
+}
+
+bool ChunkIndex::build(git_repository *pRepository, const git_oid *pOid) {
+	mEntries.clear();
+	if(!addTree(pRepository, pOid, 0, mEntries) || mEntries.isEmpty()) {
+		mEntries.clear();
+		return false;
+	}
+	qCDebug(KUPKIO) << "built chunk index with" << mEntries.count() << "entries";
+	return true;
+}
+
+bool ChunkIndex::load(const QString &pPath) {
+	const QByteArray lData = CacheFile::load(pPath, cIndexMagic, cIndexVersion);
+	if(lData.size() < cIndexHeaderSize) {
+		return false;
+	}
+	const uchar *lPointer = reinterpret_cast<const uchar *>(lData.constData()) + CacheFile::cHeaderSize;
+	quint32 lCount = qFromLittleEndian<quint32>(lPointer);
+	if(lCount == 0 ||
+	      static_cast<qint64>(lData.size()) != cIndexHeaderSize + static_cast<qint64>(lCount) * cIndexEntrySize) {
+		return false;
+	}
+	lPointer += 4;
+	mEntries.resize(static_cast<int>(lCount));
+	for(quint32 i = 0; i < lCount; ++i) {
+		Entry &lEntry = mEntries[static_cast<int>(i)];
+		lEntry.mOffset = qFromLittleEndian<quint64>(lPointer);
+		git_oid_fromraw(&lEntry.mOid, lPointer + 8);
+		lPointer += cIndexEntrySize;
+	}
+	return true;
+}
+
+void ChunkIndex::save(const QString &pPath) const {
+	QByteArray lData(cIndexHeaderSize + mEntries.count() * cIndexEntrySize, Qt::Uninitialized);
+	auto lPointer = reinterpret_cast<uchar *>(lData.data());
+	qToLittleEndian<quint32>(static_cast<quint32>(mEntries.count()), lPointer + CacheFile::cHeaderSize);
+	lPointer += cIndexHeaderSize;
+	foreach(const Entry &lEntry, mEntries) {
+		qToLittleEndian<quint64>(lEntry.mOffset, lPointer);
+		memcpy(lPointer + 8, lEntry.mOid.id, GIT_OID_RAWSZ);
+		lPointer += cIndexEntrySize;
+	}
+	CacheFile::save(pPath, cIndexMagic, cIndexVersion, lData);
+}
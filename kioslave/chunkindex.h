@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef CHUNKINDEX_H
+#define CHUNKINDEX_H
+
+#include <QSharedPointer>
+#include <QVector>
+
+#include <git2.h>
+
+// Flat list of where each blob of a chunked file starts, sorted by offset.
+// Looking up an offset is then a binary search instead of a walk down the
+// chunk tree. Indexes are shared between all files with the same chunk tree.
+class ChunkIndex {
+public:
+	struct Entry {
+		quint64 mOffset;
+		git_oid mOid;
+	};
+
+	// Returns a cached index, or one saved earlier in the repository cache
+	// folder. If there is none, build one if pBuild is set.
+	static QSharedPointer<const ChunkIndex> find(git_repository *pRepository, const git_oid *pOid, bool pBuild);
+
+	// index of the entry for the blob containing pOffset
+	int entryAt(quint64 pOffset) const;
+
+	QVector<Entry> mEntries;
+
+	// Whether built indexes are saved in the repository, for use by later
+	// processes. Off by default, nothing removes saved indexes again.
+	static bool mPersist;
+
+protected:
+	bool build(git_repository *pRepository, const git_oid *pOid);
+	bool load(const QString &pPath);
+	void save(const QString &pPath) const;
+};
+
+#endif // CHUNKINDEX_H
@@ -0,0 +1,164 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "chunkwalker.h"
+#include "vfshelpers.h"
+
+#include <sys/stat.h>
+
+ChunkWalker::ChunkWalker(git_repository *pRepository, const git_oid *pOid,
+                         const QSharedPointer<const ChunkIndex> &pIndex)
+   : mRepository(pRepository), mOid(*pOid), mIndex(pIndex), mIndexPosition(-1)
+{}
+
+ChunkWalker::~ChunkWalker() {
+	clear();
+}
+
+bool ChunkWalker::seek(quint64 pOffset, quint64 &pSkip) {
+	if(mIndex) {
+		mIndexPosition = mIndex->entryAt(pOffset);
+		if(mIndexPosition < 0) {
+			return false;
+		}
+		pSkip = pOffset - mIndex->mEntries.at(mIndexPosition).mOffset;
+		return true;
+	}
+
+	// Only climb as far up as needed to find a subtree which covers the new
+	// offset, short seeks then don't have to start over from the root.
+	while(!mPositionStack.isEmpty() &&
+	      (pOffset < mPositionStack.last()->mBase || pOffset >= mPositionStack.last()->mEnd)) {
+		delete mPositionStack.takeLast();
+	}
+	if(mPositionStack.isEmpty()) {
+		git_tree *lTree;
+		if(0 != git_tree_lookup(&lTree, mRepository, &mOid)) {
+			return false;
+		}
+		mPositionStack.append(new TreePosition(lTree, 0, Q_UINT64_C(0xFFFFFFFFFFFFFFFF)));
+	}
+
+	TreePosition *lCurrentPos = mPositionStack.last();
+	quint64 lLocalOffset = pOffset - lCurrentPos->mBase;
+	while(true) {
+		ulong lLower = 0;
+		const git_tree_entry *lLowerEntry = git_tree_entry_byindex(lCurrentPos->mTree, lLower);
+		quint64 lLowerOffset = 0;
+		ulong lUpper = git_tree_entrycount(lCurrentPos->mTree);
+
+		while(lUpper - lLower > 1) {
+			ulong lToCheck = lLower + (lUpper - lLower)/2;
+			const git_tree_entry *lCheckEntry = git_tree_entry_byindex(lCurrentPos->mTree, lToCheck);
+			quint64 lCheckOffset;
+			if(!offsetFromName(lCheckEntry, lCheckOffset)) {
+				return false;
+			}
+			if(lCheckOffset > lLocalOffset) {
+				lUpper = lToCheck;
+			} else {
+				lLower = lToCheck;
+				lLowerEntry = lCheckEntry;
+				lLowerOffset = lCheckOffset;
+			}
+		}
+		lCurrentPos->mIndex = lLower;
+		// the remainder of the offset will be a local offset into the blob or into the subtree.
+		lLocalOffset -= lLowerOffset;
+
+		if(S_ISDIR(git_tree_entry_filemode(lLowerEntry))) {
+			if(!descend(lLowerEntry, lCurrentPos)) {
+				return false;
+			}
+			lCurrentPos = mPositionStack.last();
+		} else {
+			pSkip = lLocalOffset;
+			return true;
+		}
+	}
+}
+
+bool ChunkWalker::next() {
+	if(mIndex) {
+		if(mIndexPosition >= 0) {
+			++mIndexPosition;
+		}
+		return true;
+	}
+	if(mPositionStack.isEmpty()) {
+		return true;
+	}
+	TreePosition *lCurrentPos = mPositionStack.last();
+	lCurrentPos->mIndex++;
+	while(true) {
+		if(lCurrentPos->mIndex < git_tree_entrycount(lCurrentPos->mTree)) {
+			const git_tree_entry *lTreeEntry = git_tree_entry_byindex(lCurrentPos->mTree, lCurrentPos->mIndex);
+			if(!S_ISDIR(git_tree_entry_filemode(lTreeEntry))) {
+				return true; // it's a blob
+			}
+			if(!descend(lTreeEntry, lCurrentPos)) {
+				return false;
+			}
+			lCurrentPos = mPositionStack.last(); // will have index initialized to zero.
+		} else {
+			delete mPositionStack.takeLast();
+			if(mPositionStack.isEmpty()) {
+				return true; // reached the end
+			}
+			lCurrentPos = mPositionStack.last();
+			lCurrentPos->mIndex++;
+		}
+	}
+}
+
+const git_oid *ChunkWalker::currentBlob() const {
+	if(mIndex) {
+		if(mIndexPosition < 0 || mIndexPosition >= mIndex->mEntries.count()) {
+			return nullptr;
+		}
+		return &mIndex->mEntries.at(mIndexPosition).mOid;
+	}
+	if(mPositionStack.isEmpty()) {
+		return nullptr;
+	}
+	TreePosition *lCurrentPos = mPositionStack.last();
+	return git_tree_entry_id(git_tree_entry_byindex(lCurrentPos->mTree, lCurrentPos->mIndex));
+}
+
+bool ChunkWalker::descend(const git_tree_entry *pEntry, TreePosition *pParent) {
+	quint64 lStart, lEnd = pParent->mEnd;
+	if(!offsetFromName(pEntry, lStart)) {
+		return false;
+	}
+	lStart += pParent->mBase;
+	if(pParent->mIndex + 1 < git_tree_entrycount(pParent->mTree)) {
+		if(!offsetFromName(git_tree_entry_byindex(pParent->mTree, pParent->mIndex + 1), lEnd)) {
+			return false;
+		}
+		lEnd += pParent->mBase;
+	}
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, mRepository, git_tree_entry_id(pEntry))) {
+		return false;
+	}
+	mPositionStack.append(new TreePosition(lTree, lStart, lEnd));
+	return true;
+}
+
+void ChunkWalker::clear() {
+	while(!mPositionStack.isEmpty()) {
+		delete mPositionStack.takeLast();
+	}
+}
+
+ChunkWalker::TreePosition::TreePosition(git_tree *pTree, quint64 pBase, quint64 pEnd) {
+	mTree = pTree;
+	mIndex = 0;
+	mBase = pBase;
+	mEnd = pEnd;
+}
+
+ChunkWalker::TreePosition::~TreePosition() {
+	git_tree_free(mTree);
+}
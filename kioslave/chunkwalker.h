@@ -0,0 +1,49 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef CHUNKWALKER_H
+#define CHUNKWALKER_H
+
+#include "chunkindex.h"
+
+#include <QList>
+
+#include <git2.h>
+
+// Walks the tree of a chunked file, one blob at a time in file order. Only
+// uses the repository it was given, so it can run in any thread that owns it.
+// With a chunk index it only steps through the flat list of blobs.
+class ChunkWalker {
+public:
+	ChunkWalker(git_repository *pRepository, const git_oid *pOid,
+	            const QSharedPointer<const ChunkIndex> &pIndex = QSharedPointer<const ChunkIndex>());
+	~ChunkWalker();
+	// Position at the blob containing pOffset, pSkip is set to where in that blob pOffset is.
+	bool seek(quint64 pOffset, quint64 &pSkip);
+	// Step to the blob after the current one.
+	bool next();
+	// nullptr when past the end
+	const git_oid *currentBlob() const;
+
+protected:
+	void clear();
+
+	struct TreePosition {
+		TreePosition(git_tree *pTree, quint64 pBase, quint64 pEnd);
+		~TreePosition();
+		git_tree *mTree;
+		ulong mIndex;
+		quint64 mBase; // file offsets covered by this tree
+		quint64 mEnd;
+	};
+	bool descend(const git_tree_entry *pEntry, TreePosition *pParent);
+
+	git_repository *mRepository;
+	git_oid mOid;
+	QList<TreePosition *> mPositionStack;
+	QSharedPointer<const ChunkIndex> mIndex;
+	int mIndexPosition;
+};
+
+#endif // CHUNKWALKER_H
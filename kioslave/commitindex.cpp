@@ -0,0 +1,112 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "commitindex.h"
+#include "vfshelpers.h"
+#include "kupkio_debug.h"
+
+#include <QtEndian>
+
+#include <cstring>
+
+static const char cIndexMagic[] = "KUPCOMIX";
+static const quint32 cIndexVersion = 1;
+static const int cIndexHeaderSize = CacheFile::cHeaderSize + GIT_OID_RAWSZ + 4;
+static const int cIndexEntrySize = 8 + 2 * GIT_OID_RAWSZ;
+
+CommitIndex::CommitIndex(const QByteArray &pRefName)
+   : mRefName(pRefName), mHasHead(false), mLoadTried(false)
+{}
+
+bool CommitIndex::update(git_repository *pRepository, git_revwalk *pRevisionWalker, int &pAdded) {
+	pAdded = 0;
+	git_oid lHead;
+	if(0 != git_reference_name_to_id(&lHead, pRepository, mRefName)) {
+		return false;
+	}
+	const QString lPath = indexPath(pRepository);
+	if(!mLoadTried) {
+		mLoadTried = true;
+		load(lPath);
+	}
+	if(mHasHead && git_oid_equal(&lHead, &mHead)) {
+		return true;
+	}
+
+	git_revwalk_reset(pRevisionWalker);
+	if(0 != git_revwalk_push(pRevisionWalker, &lHead)) {
+		return false;
+	}
+	if(mHasHead && 1 == git_graph_descendant_of(pRepository, &lHead, &mHead)) {
+		git_revwalk_hide(pRevisionWalker, &mHead);
+	} else {
+		if(mHasHead) {
+			qCDebug(KUPKIO) << mRefName << "has been rewritten, indexing all commits again";
+		}
+		mEntries.clear();
+	}
+
+	QVector<Entry> lNewEntries;
+	git_oid lOid;
+	while(0 == git_revwalk_next(&lOid, pRevisionWalker)) {
+		git_commit *lCommit;
+		if(0 != git_commit_lookup(&lCommit, pRepository, &lOid)) {
+			continue;
+		}
+		lNewEntries.append(Entry{git_commit_time(lCommit), lOid, *git_commit_tree_id(lCommit)});
+		git_commit_free(lCommit);
+	}
+	qCDebug(KUPKIO) << "indexed" << lNewEntries.count() << "new commits in" << mRefName;
+	pAdded = lNewEntries.count();
+	lNewEntries.append(mEntries);
+	mEntries = lNewEntries;
+	mHead = lHead;
+	mHasHead = true;
+	save(lPath);
+	return true;
+}
+
+QString CommitIndex::indexPath(git_repository *pRepository) const {
+	return repositoryCachePath(pRepository) + QStringLiteral("/commitindex/") +
+	       QString::fromLatin1(mRefName.toPercentEncoding());
+}
+
+bool CommitIndex::load(const QString &pPath) {
+	const QByteArray lData = CacheFile::load(pPath, cIndexMagic, cIndexVersion);
+	if(lData.size() < cIndexHeaderSize) {
+		return false;
+	}
+	const uchar *lPointer = reinterpret_cast<const uchar *>(lData.constData()) + CacheFile::cHeaderSize;
+	quint32 lCount = qFromLittleEndian<quint32>(lPointer + GIT_OID_RAWSZ);
+	if(static_cast<qint64>(lData.size()) != cIndexHeaderSize + static_cast<qint64>(lCount) * cIndexEntrySize) {
+		return false;
+	}
+	git_oid_fromraw(&mHead, lPointer);
+	lPointer = reinterpret_cast<const uchar *>(lData.constData()) + cIndexHeaderSize;
+	mEntries.resize(static_cast<int>(lCount));
+	for(quint32 i = 0; i < lCount; ++i) {
+		Entry &lEntry = mEntries[static_cast<int>(i)];
+		lEntry.mTime = qFromLittleEndian<qint64>(lPointer);
+		git_oid_fromraw(&lEntry.mCommit, lPointer + 8);
+		git_oid_fromraw(&lEntry.mTree, lPointer + 8 + GIT_OID_RAWSZ);
+		lPointer += cIndexEntrySize;
+	}
+	mHasHead = true;
+	return true;
+}
+
+void CommitIndex::save(const QString &pPath) const {
+	QByteArray lData(cIndexHeaderSize + mEntries.count() * cIndexEntrySize, Qt::Uninitialized);
+	auto lPointer = reinterpret_cast<uchar *>(lData.data()) + CacheFile::cHeaderSize;
+	memcpy(lPointer, mHead.id, GIT_OID_RAWSZ);
+	qToLittleEndian<quint32>(static_cast<quint32>(mEntries.count()), lPointer + GIT_OID_RAWSZ);
+	lPointer += GIT_OID_RAWSZ + 4;
+	foreach(const Entry &lEntry, mEntries) {
+		qToLittleEndian<qint64>(lEntry.mTime, lPointer);
+		memcpy(lPointer + 8, lEntry.mCommit.id, GIT_OID_RAWSZ);
+		memcpy(lPointer + 8 + GIT_OID_RAWSZ, lEntry.mTree.id, GIT_OID_RAWSZ);
+		lPointer += cIndexEntrySize;
+	}
+	CacheFile::save(pPath, cIndexMagic, cIndexVersion, lData);
+}
@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef COMMITINDEX_H
+#define COMMITINDEX_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <git2.h>
+
+// Commit time, commit and tree of every commit in a branch, saved in the
+// repository cache folder. Only commits added since the head recorded in the
+// index need to be walked. If the branch no longer descends from that head,
+// after a prune for example, the index is built again from scratch.
+class CommitIndex {
+public:
+	struct Entry {
+		qint64 mTime;
+		git_oid mCommit;
+		git_oid mTree;
+	};
+
+	explicit CommitIndex(const QByteArray &pRefName);
+	// Bring the index up to date with where the branch points now. pAdded is
+	// set to how many entries at the front of mEntries were not there before.
+	bool update(git_repository *pRepository, git_revwalk *pRevisionWalker, int &pAdded);
+
+	QVector<Entry> mEntries; // newest first
+
+protected:
+	QString indexPath(git_repository *pRepository) const;
+	bool load(const QString &pPath);
+	void save(const QString &pPath) const;
+
+	QByteArray mRefName;
+	git_oid mHead{};
+	bool mHasHead;
+	bool mLoadTried;
+};
+
+#endif // COMMITINDEX_H
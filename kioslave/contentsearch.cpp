@@ -0,0 +1,219 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "contentsearch.h"
+#include "bupodb.h"
+#include "chunkwalker.h"
+#include "threadrepository.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+
+#include <sys/stat.h>
+
+// how often matches are handed over while waiting for the last files, in ms.
+static const int cReportInterval = 200;
+// chunk results kept, enough for all chunks of a few big files
+static const int cMaxChunkResults = 65536;
+
+namespace {
+
+class SearchTask: public QRunnable {
+public:
+	SearchTask(ContentSearch *pSearch, const QByteArray &pRepositoryPath, const git_oid *pOid, bool pChunked)
+	   : mSearch(pSearch), mRepositoryPath(pRepositoryPath), mOid(*pOid), mChunked(pChunked)
+	{}
+
+	void run() override {
+		mSearch->fileSearched(mOid, search());
+	}
+
+protected:
+	// A file that can't be read is taken as not matching.
+	bool search() {
+		git_repository *lRepository = threadRepository(mRepositoryPath);
+		if(lRepository == nullptr) {
+			return false;
+		}
+		bool lMatch;
+		QByteArray lChunkStart, lChunkEnd;
+		if(!mChunked) {
+			return mSearch->searchBlob(lRepository, &mOid, lMatch, lChunkStart, lChunkEnd) && lMatch;
+		}
+		// chunks in file order, without building a chunk index for it
+		ChunkWalker lWalker(lRepository, &mOid);
+		quint64 lSkip;
+		if(!lWalker.seek(0, lSkip)) {
+			return false;
+		}
+		const int lOverlap = mSearch->matcher().pattern().size() - 1;
+		QByteArray lEnd; // of everything before the current chunk
+		while(lWalker.currentBlob() != nullptr) {
+			if(!mSearch->searchChunk(lRepository, lWalker.currentBlob(), lMatch, lChunkStart, lChunkEnd)) {
+				return false;
+			}
+			if(lMatch || (!lEnd.isEmpty() && mSearch->matcher().indexIn(lEnd + lChunkStart) >= 0)) {
+				return true;
+			}
+			lEnd = (lEnd + lChunkEnd).right(lOverlap);
+			if(!lWalker.next()) {
+				return false;
+			}
+		}
+		return false;
+	}
+
+	ContentSearch *mSearch;
+	QByteArray mRepositoryPath;
+	git_oid mOid;
+	bool mChunked;
+};
+
+} // namespace
+
+ContentSearch::ContentSearch(const QByteArray &pRepositoryPath, const QByteArray &pPattern)
+   : mRepositoryPath(pRepositoryPath), mMatcher(pPattern)
+{
+	mPool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+}
+
+ContentSearch::~ContentSearch() {
+	mPool.waitForDone();
+}
+
+bool ContentSearch::search(const QVector<Root> &pRoots, const QString &pPath,
+                           const std::function<void(const QStringList &)> &pReport) {
+	// not a thread repository, this thread may well outlive libgit2.
+	git_repository *lRepository;
+	if(mMatcher.pattern().isEmpty() || 0 != git_repository_open(&lRepository, mRepositoryPath.constData())) {
+		return false;
+	}
+	addBupOdbBackend(lRepository);
+	foreach(const Root &lRoot, pRoots) {
+		if(pPath.isEmpty()) {
+			walk(lRepository, &lRoot.mTree, lRoot.mName);
+		} else {
+			git_tree *lTree;
+			if(0 != git_tree_lookup(&lTree, lRepository, &lRoot.mTree)) {
+				continue;
+			}
+			git_tree_entry *lEntry;
+			if(0 == git_tree_entry_bypath(&lEntry, lTree, pPath.toUtf8().constData())) {
+				if(git_tree_entry_type(lEntry) == GIT_OBJECT_TREE) {
+					walk(lRepository, git_tree_entry_id(lEntry), lRoot.mName + QLatin1Char('/') + pPath);
+				}
+				git_tree_entry_free(lEntry);
+			}
+			git_tree_free(lTree);
+		}
+		report(pReport);
+	}
+	while(!mPool.waitForDone(cReportInterval)) {
+		report(pReport);
+	}
+	report(pReport);
+	git_repository_free(lRepository);
+	return true;
+}
+
+bool ContentSearch::searchChunk(git_repository *pRepository, const git_oid *pOid, bool &pMatch, QByteArray &pStart,
+                                QByteArray &pEnd) {
+	{
+		QMutexLocker lLocker(&mMutex);
+		auto lIter = mChunkResults.constFind(*pOid);
+		if(lIter != mChunkResults.constEnd()) {
+			pMatch = lIter->mMatch;
+			pStart = lIter->mStart;
+			pEnd = lIter->mEnd;
+			return true;
+		}
+	}
+	if(!searchBlob(pRepository, pOid, pMatch, pStart, pEnd)) {
+		return false;
+	}
+	QMutexLocker lLocker(&mMutex);
+	if(mChunkResults.count() >= cMaxChunkResults) {
+		mChunkResults.clear();
+	}
+	mChunkResults.insert(*pOid, ChunkResult{pMatch, pStart, pEnd});
+	return true;
+}
+
+bool ContentSearch::searchBlob(git_repository *pRepository, const git_oid *pOid, bool &pMatch, QByteArray &pStart,
+                               QByteArray &pEnd) {
+	// Read without going through the blob cache, a search would only push
+	// out what is being used for reading files.
+	git_blob *lBlob;
+	if(0 != git_blob_lookup(&lBlob, pRepository, pOid)) {
+		return false;
+	}
+	auto lData = static_cast<const char *>(git_blob_rawcontent(lBlob));
+	auto lSize = static_cast<int>(git_blob_rawsize(lBlob));
+	const int lOverlap = qMin(mMatcher.pattern().size() - 1, lSize);
+	pMatch = mMatcher.indexIn(lData, lSize) >= 0;
+	pStart = QByteArray(lData, lOverlap);
+	pEnd = QByteArray(lData + lSize - lOverlap, lOverlap);
+	git_blob_free(lBlob);
+	return true;
+}
+
+void ContentSearch::fileSearched(const git_oid &pOid, bool pMatch) {
+	QMutexLocker lLocker(&mMutex);
+	mFileResults.insert(pOid, pMatch);
+	const QStringList lPaths = mWaitingPaths.take(pOid);
+	if(pMatch) {
+		mMatches.append(lPaths);
+	}
+}
+
+void ContentSearch::walk(git_repository *pRepository, const git_oid *pTree, const QString &pPath) {
+	// Trees seen before are walked again, the files in them have other paths
+	// here. Their content is not searched again.
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, pRepository, pTree)) {
+		return;
+	}
+	ulong lEntryCount = git_tree_entrycount(lTree);
+	for(ulong i = 0; i < lEntryCount; ++i) {
+		uint lMode;
+		const git_oid *lOid;
+		QString lName;
+		bool lChunked;
+		getEntryAttributes(git_tree_entry_byindex(lTree, i), lMode, lChunked, lOid, lName);
+		if(lName == QStringLiteral(".bupm")) {
+			continue;
+		}
+		const QString lPath = pPath + QLatin1Char('/') + lName;
+		if(S_ISDIR(lMode)) {
+			walk(pRepository, lOid, lPath);
+		} else if(S_ISREG(lMode)) {
+			QMutexLocker lLocker(&mMutex);
+			auto lResult = mFileResults.constFind(*lOid);
+			if(lResult != mFileResults.constEnd()) {
+				if(lResult.value()) {
+					mMatches.append(lPath);
+				}
+			} else if(mWaitingPaths.contains(*lOid)) {
+				mWaitingPaths[*lOid].append(lPath);
+			} else {
+				mWaitingPaths.insert(*lOid, QStringList(lPath));
+				lLocker.unlock();
+				mPool.start(new SearchTask(this, mRepositoryPath, lOid, lChunked));
+			}
+		}
+	}
+	git_tree_free(lTree);
+}
+
+void ContentSearch::report(const std::function<void(const QStringList &)> &pReport) {
+	QStringList lMatches;
+	{
+		QMutexLocker lLocker(&mMutex);
+		lMatches.swap(mMatches);
+	}
+	if(!lMatches.isEmpty()) {
+		pReport(lMatches);
+	}
+}
@@ -0,0 +1,72 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef CONTENTSEARCH_H
+#define CONTENTSEARCH_H
+
+#include <QByteArrayMatcher>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <functional>
+
+#include <git2.h>
+
+#include "vfshelpers.h"
+
+// Finds files containing a byte string in a set of saves. The trees are
+// walked in the calling thread and the content is searched in a thread pool.
+// Each distinct file is searched once, every path it has is reported from
+// that one result. Most versions of a big file share nearly all of their
+// chunks, so what was found in recently read chunks is kept too. Whether a
+// match crosses from one chunk into the next is found from the start and end
+// of each chunk.
+class ContentSearch {
+public:
+	// A folder to search in, named as it should be in the reported paths.
+	struct Root {
+		QString mName;
+		git_oid mTree;
+	};
+
+	ContentSearch(const QByteArray &pRepositoryPath, const QByteArray &pPattern);
+	~ContentSearch();
+
+	// Searches pPath in each root, everything if it is empty. pReport gets the
+	// paths of matching files in batches, in the calling thread, while the
+	// search is going on.
+	bool search(const QVector<Root> &pRoots, const QString &pPath,
+	            const std::function<void(const QStringList &)> &pReport);
+
+	// called by the search tasks
+	bool searchBlob(git_repository *pRepository, const git_oid *pOid, bool &pMatch, QByteArray &pStart, QByteArray &pEnd);
+	bool searchChunk(git_repository *pRepository, const git_oid *pOid, bool &pMatch, QByteArray &pStart, QByteArray &pEnd);
+	void fileSearched(const git_oid &pOid, bool pMatch);
+	const QByteArrayMatcher &matcher() const {
+		return mMatcher;
+	}
+
+protected:
+	struct ChunkResult {
+		bool mMatch;
+		QByteArray mStart; // the first and last bytes, one less than the pattern length
+		QByteArray mEnd;
+	};
+	void walk(git_repository *pRepository, const git_oid *pTree, const QString &pPath);
+	void report(const std::function<void(const QStringList &)> &pReport);
+
+	QByteArray mRepositoryPath;
+	QByteArrayMatcher mMatcher;
+	QThreadPool mPool;
+	QMutex mMutex;
+	QHash<git_oid, bool> mFileResults; // whether each file searched so far matched
+	QHash<git_oid, QStringList> mWaitingPaths; // of files still being searched
+	QHash<git_oid, ChunkResult> mChunkResults; // emptied when it gets too big
+	QStringList mMatches; // not reported yet
+};
+
+#endif // CONTENTSEARCH_H
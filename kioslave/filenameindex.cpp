@@ -0,0 +1,399 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "filenameindex.h"
+#include "vfshelpers.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+static const char cIndexMagic[] = "KUPFNIDX";
+static const quint32 cIndexVersion = 2;
+static const int cIndexHeaderSize = CacheFile::cHeaderSize + GIT_OID_RAWSZ + 8 + 4 + 4 + 4;
+static const int cIndexEntrySize = 4 + GIT_OID_RAWSZ + 8 + 8 + 4 + 4 + 8 + 8;
+static const int cIndexCommitSize = GIT_OID_RAWSZ + 8;
+static const quint32 cIndexChunked = 1;
+
+FilenameIndex::FilenameIndex(const QByteArray &pRefName)
+   : mHeadTime(0), mRefName(pRefName), mHasHead(false), mLoadTried(false)
+{}
+
+bool FilenameIndex::update(git_repository *pRepository) {
+	git_oid lHead;
+	if(0 != git_reference_name_to_id(&lHead, pRepository, mRefName)) {
+		return false;
+	}
+	const QString lPath = indexPath(pRepository);
+	if(!mLoadTried) {
+		mLoadTried = true;
+		load(lPath);
+	}
+	if(mHasHead && git_oid_equal(&lHead, &mHead)) {
+		return true;
+	}
+
+	git_revwalk *lWalker;
+	if(0 != git_revwalk_new(&lWalker, pRepository)) {
+		return false;
+	}
+	git_revwalk_sorting(lWalker, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME | GIT_SORT_REVERSE);
+	git_revwalk_push(lWalker, &lHead);
+	git_oid lPreviousTree{};
+	if(mHasHead && 1 == git_graph_descendant_of(pRepository, &lHead, &mHead)) {
+		git_revwalk_hide(lWalker, &mHead);
+		git_commit *lCommit;
+		if(0 == git_commit_lookup(&lCommit, pRepository, &mHead)) {
+			lPreviousTree = *git_commit_tree_id(lCommit);
+			git_commit_free(lCommit);
+		}
+	} else {
+		// first time, or the branch has been rewritten.
+		mEntries.clear();
+		mCommits.clear();
+		mPaths.clear();
+		mPathIndexes.clear();
+		mCurrentEntries.clear();
+		mHeadTime = 0;
+	}
+	clearNameIndex();
+
+	git_oid lOid;
+	while(0 == git_revwalk_next(&lOid, lWalker)) { // oldest first
+		git_commit *lCommit;
+		if(0 != git_commit_lookup(&lCommit, pRepository, &lOid)) {
+			continue;
+		}
+		const git_oid lTree = *git_commit_tree_id(lCommit);
+		const qint64 lTime = git_commit_time(lCommit);
+		git_commit_free(lCommit);
+		bool lFirst = mHeadTime == 0;
+		compareTrees(pRepository, lFirst ? nullptr : &lPreviousTree, &lTree, QString(), mHeadTime, lTime);
+		mCommits.append(Commit{lTree, lTime});
+		lPreviousTree = lTree;
+		mHeadTime = lTime;
+	}
+	git_revwalk_free(lWalker);
+	mHead = lHead;
+	mHasHead = true;
+	save(lPath);
+	return true;
+}
+
+static quint64 trigram(const QString &pString, int pIndex) {
+	return static_cast<quint64>(pString.at(pIndex).unicode()) << 32 |
+	      static_cast<quint64>(pString.at(pIndex + 1).unicode()) << 16 |
+	      pString.at(pIndex + 2).unicode();
+}
+
+QVector<int> FilenameIndex::find(const QString &pName, int pMaxResults) const {
+	if(mNames.isEmpty()) {
+		makeNameIndex();
+	}
+	const QString lName = pName.toLower();
+	QVector<int> lResults;
+	auto lCheckName = [&](quint32 pNameIndex) {
+		if(mNames.at(static_cast<int>(pNameIndex)).contains(lName)) {
+			foreach(quint32 lPath, mNamePaths.at(static_cast<int>(pNameIndex))) {
+				lResults.append(mPathEntries.at(static_cast<int>(lPath)));
+			}
+		}
+	};
+	if(lName.length() < 3) {
+		// there are far fewer distinct names than paths, and they are short.
+		for(quint32 i = 0; i < static_cast<quint32>(mNames.count()); ++i) {
+			lCheckName(i);
+		}
+	} else {
+		// only the names with the rarest trigram of pName need to be compared.
+		const QVector<quint32> *lCandidates = nullptr;
+		for(int i = 0; i + 2 < lName.length(); ++i) {
+			auto lIter = mTrigrams.constFind(trigram(lName, i));
+			if(lIter == mTrigrams.constEnd()) {
+				return lResults;
+			}
+			if(lCandidates == nullptr || lIter.value().count() < lCandidates->count()) {
+				lCandidates = &lIter.value();
+			}
+		}
+		foreach(quint32 lNameIndex, *lCandidates) {
+			lCheckName(lNameIndex);
+		}
+	}
+	std::sort(lResults.begin(), lResults.end());
+	if(lResults.count() > pMaxResults) {
+		lResults.resize(pMaxResults);
+	}
+	return lResults;
+}
+
+void FilenameIndex::makeNameIndex() const {
+	QHash<QString, quint32> lNameIndexes;
+	mNamePaths.clear();
+	mPathEntries.clear();
+	mPathEntries.resize(mPaths.count());
+	for(int i = 0; i < mPaths.count(); ++i) {
+		const QString &lPath = mPaths.at(i);
+		const QString lName = lPath.mid(lPath.lastIndexOf(QLatin1Char('/')) + 1).toLower();
+		auto lIter = lNameIndexes.constFind(lName);
+		if(lIter == lNameIndexes.constEnd()) {
+			lIter = lNameIndexes.insert(lName, static_cast<quint32>(mNames.count()));
+			mNames.append(lName);
+			mNamePaths.append(QVector<quint32>());
+		}
+		mNamePaths[static_cast<int>(lIter.value())].append(static_cast<quint32>(i));
+	}
+	for(quint32 i = 0; i < static_cast<quint32>(mNames.count()); ++i) {
+		const QString &lName = mNames.at(static_cast<int>(i));
+		for(int j = 0; j + 2 < lName.length(); ++j) {
+			QVector<quint32> &lNameList = mTrigrams[trigram(lName, j)];
+			if(lNameList.isEmpty() || lNameList.last() != i) {
+				lNameList.append(i);
+			}
+		}
+	}
+	for(int i = 0; i < mEntries.count(); ++i) {
+		mPathEntries[static_cast<int>(mEntries.at(i).mPath)].append(i);
+	}
+}
+
+void FilenameIndex::clearNameIndex() {
+	mNames.clear();
+	mNamePaths.clear();
+	mTrigrams.clear();
+	mPathEntries.clear();
+}
+
+void FilenameIndex::readTree(git_repository *pRepository, const git_oid *pTree, QHash<QString, TreeEntry> &pEntries,
+                             qint64 pTime) {
+	git_tree *lTree;
+	if(pTree == nullptr || 0 != git_tree_lookup(&lTree, pRepository, pTree)) {
+		return;
+	}
+	ulong lEntryCount = git_tree_entrycount(lTree);
+	pEntries.reserve(static_cast<int>(lEntryCount));
+	QVector<Metadata> lMetadataList;
+	int lMetadataIndex = 1; // the first entry is metadata for the directory itself.
+	const git_tree_entry *lMetadataEntry = git_tree_entry_byname(lTree, ".bupm");
+	git_blob *lMetadataBlob;
+	if(pTime != 0 && lMetadataEntry != nullptr &&
+	      0 == git_blob_lookup(&lMetadataBlob, pRepository, git_tree_entry_id(lMetadataEntry))) {
+		readMetadataList(git_blob_rawcontent(lMetadataBlob), static_cast<size_t>(git_blob_rawsize(lMetadataBlob)), lMetadataList);
+		git_blob_free(lMetadataBlob);
+	}
+	for(ulong i = 0; i < lEntryCount; ++i) {
+		uint lMode;
+		const git_oid *lOid;
+		QString lName;
+		bool lChunked;
+		getEntryAttributes(git_tree_entry_byindex(lTree, i), lMode, lChunked, lOid, lName);
+		if(lName == QStringLiteral(".bupm")) {
+			continue;
+		}
+		TreeEntry lEntry{*lOid, S_ISDIR(lMode) != 0, lMode, lChunked, pTime, -1};
+		if(!lEntry.mIsDirectory && lMetadataIndex < lMetadataList.count()) {
+			const Metadata &lMetadata = lMetadataList.at(lMetadataIndex++);
+			lEntry.mMtime = lMetadata.mMtime;
+			lEntry.mSize = lMetadata.mSize;
+		}
+		pEntries.insert(lName, lEntry);
+	}
+	git_tree_free(lTree);
+}
+
+// Either tree can be missing. Sub trees with the same id in both are the same
+// all the way down and are not looked at.
+void FilenameIndex::compareTrees(git_repository *pRepository, const git_oid *pOldTree, const git_oid *pNewTree,
+                                 const QString &pPrefix, qint64 pOldTime, qint64 pNewTime) {
+	QHash<QString, TreeEntry> lOldEntries, lNewEntries;
+	readTree(pRepository, pOldTree, lOldEntries);
+	readTree(pRepository, pNewTree, lNewEntries, pNewTime);
+	for(auto lIter = lNewEntries.constBegin(); lIter != lNewEntries.constEnd(); ++lIter) {
+		const QString lPath = pPrefix + lIter.key();
+		const TreeEntry &lNew = lIter.value();
+		auto lOld = lOldEntries.constFind(lIter.key());
+		bool lHadOld = lOld != lOldEntries.constEnd();
+		if(lHadOld && git_oid_equal(&lOld->mOid, &lNew.mOid)) {
+			// same version, but the metadata may have changed
+			if(!lNew.mIsDirectory) {
+				updateEntry(lPath, lNew);
+			}
+			continue;
+		}
+		if(lHadOld) {
+			closeEntry(lPath, pOldTime);
+		}
+		addEntry(lPath, lNew, pNewTime);
+		const git_oid *lOldTree = lHadOld && lOld->mIsDirectory ? &lOld->mOid : nullptr;
+		if(lNew.mIsDirectory || lOldTree != nullptr) {
+			compareTrees(pRepository, lOldTree, lNew.mIsDirectory ? &lNew.mOid : nullptr, lPath + QLatin1Char('/'),
+			             pOldTime, pNewTime);
+		}
+	}
+	for(auto lIter = lOldEntries.constBegin(); lIter != lOldEntries.constEnd(); ++lIter) {
+		if(lNewEntries.contains(lIter.key())) {
+			continue;
+		}
+		const QString lPath = pPrefix + lIter.key();
+		closeEntry(lPath, pOldTime);
+		if(lIter->mIsDirectory) {
+			compareTrees(pRepository, &lIter->mOid, nullptr, lPath + QLatin1Char('/'), pOldTime, pNewTime);
+		}
+	}
+}
+
+void FilenameIndex::addEntry(const QString &pPath, const TreeEntry &pTreeEntry, qint64 pTime) {
+	auto lIter = mPathIndexes.constFind(pPath);
+	quint32 lPath;
+	if(lIter != mPathIndexes.constEnd()) {
+		lPath = lIter.value();
+	} else {
+		lPath = static_cast<quint32>(mPaths.count());
+		mPaths.append(pPath);
+		mPathIndexes.insert(pPath, lPath);
+	}
+	mCurrentEntries.insert(lPath, mEntries.count());
+	mEntries.append(Entry{lPath, pTreeEntry.mOid, pTime, 0, pTreeEntry.mMode, pTreeEntry.mChunked,
+	                      pTreeEntry.mIsDirectory ? pTime : pTreeEntry.mMtime, pTreeEntry.mSize});
+}
+
+void FilenameIndex::closeEntry(const QString &pPath, qint64 pTime) {
+	auto lIter = mCurrentEntries.find(mPathIndexes.value(pPath, 0xFFFFFFFF));
+	if(lIter != mCurrentEntries.end()) {
+		mEntries[lIter.value()].mLastSeen = pTime;
+		mCurrentEntries.erase(lIter);
+	}
+}
+
+void FilenameIndex::updateEntry(const QString &pPath, const TreeEntry &pTreeEntry) {
+	auto lIter = mCurrentEntries.constFind(mPathIndexes.value(pPath, 0xFFFFFFFF));
+	if(lIter != mCurrentEntries.constEnd()) {
+		Entry &lEntry = mEntries[lIter.value()];
+		lEntry.mMtime = pTreeEntry.mMtime;
+		lEntry.mSize = pTreeEntry.mSize;
+	}
+}
+
+QString FilenameIndex::indexPath(git_repository *pRepository) const {
+	return repositoryCachePath(pRepository) + QStringLiteral("/filenameindex/") +
+	       QString::fromLatin1(mRefName.toPercentEncoding());
+}
+
+bool FilenameIndex::load(const QString &pPath) {
+	const QByteArray lData = CacheFile::load(pPath, cIndexMagic, cIndexVersion);
+	if(lData.size() < cIndexHeaderSize) {
+		return false;
+	}
+	auto lPointer = reinterpret_cast<const uchar *>(lData.constData()) + CacheFile::cHeaderSize;
+	const uchar *lEnd = reinterpret_cast<const uchar *>(lData.constData()) + lData.size();
+	quint32 lPathCount = qFromLittleEndian<quint32>(lPointer + GIT_OID_RAWSZ + 8);
+	quint32 lEntryCount = qFromLittleEndian<quint32>(lPointer + GIT_OID_RAWSZ + 12);
+	quint32 lCommitCount = qFromLittleEndian<quint32>(lPointer + GIT_OID_RAWSZ + 16);
+	const quint64 lFixedSize = static_cast<quint64>(lEntryCount) * cIndexEntrySize +
+	                           static_cast<quint64>(lCommitCount) * cIndexCommitSize;
+	if(lFixedSize > static_cast<quint64>(lData.size())) {
+		return false;
+	}
+	git_oid lHead;
+	git_oid_fromraw(&lHead, lPointer);
+	qint64 lHeadTime = qFromLittleEndian<qint64>(lPointer + GIT_OID_RAWSZ);
+	lPointer = reinterpret_cast<const uchar *>(lData.constData()) + cIndexHeaderSize;
+
+	QVector<QString> lPaths;
+	lPaths.reserve(static_cast<int>(qMin<quint32>(lPathCount, static_cast<quint32>(lData.size()))));
+	for(quint32 i = 0; i < lPathCount; ++i) {
+		if(lEnd - lPointer < 4) {
+			return false;
+		}
+		quint32 lLength = qFromLittleEndian<quint32>(lPointer);
+		lPointer += 4;
+		if(static_cast<quint64>(lEnd - lPointer) < lLength) {
+			return false;
+		}
+		lPaths.append(QString::fromUtf8(reinterpret_cast<const char *>(lPointer), static_cast<int>(lLength)));
+		lPointer += lLength;
+	}
+	if(static_cast<quint64>(lEnd - lPointer) != lFixedSize) {
+		return false;
+	}
+	QVector<Entry> lEntries(static_cast<int>(lEntryCount));
+	for(quint32 i = 0; i < lEntryCount; ++i) {
+		Entry &lEntry = lEntries[static_cast<int>(i)];
+		lEntry.mPath = qFromLittleEndian<quint32>(lPointer);
+		git_oid_fromraw(&lEntry.mOid, lPointer + 4);
+		lEntry.mFirstSeen = qFromLittleEndian<qint64>(lPointer + 4 + GIT_OID_RAWSZ);
+		lEntry.mLastSeen = qFromLittleEndian<qint64>(lPointer + 12 + GIT_OID_RAWSZ);
+		lEntry.mMode = qFromLittleEndian<quint32>(lPointer + 20 + GIT_OID_RAWSZ);
+		lEntry.mChunked = (qFromLittleEndian<quint32>(lPointer + 24 + GIT_OID_RAWSZ) & cIndexChunked) != 0;
+		lEntry.mMtime = qFromLittleEndian<qint64>(lPointer + 28 + GIT_OID_RAWSZ);
+		lEntry.mSize = qFromLittleEndian<qint64>(lPointer + 36 + GIT_OID_RAWSZ);
+		if(lEntry.mPath >= lPathCount) {
+			return false;
+		}
+		lPointer += cIndexEntrySize;
+	}
+	QVector<Commit> lCommits(static_cast<int>(lCommitCount));
+	for(quint32 i = 0; i < lCommitCount; ++i) {
+		Commit &lCommit = lCommits[static_cast<int>(i)];
+		git_oid_fromraw(&lCommit.mTree, lPointer);
+		lCommit.mTime = qFromLittleEndian<qint64>(lPointer + GIT_OID_RAWSZ);
+		lPointer += cIndexCommitSize;
+	}
+
+	mPaths = lPaths;
+	mPathIndexes.clear();
+	mPathIndexes.reserve(mPaths.count());
+	for(int i = 0; i < mPaths.count(); ++i) {
+		mPathIndexes.insert(mPaths.at(i), static_cast<quint32>(i));
+	}
+	mEntries = lEntries;
+	mCommits = lCommits;
+	mCurrentEntries.clear();
+	for(int i = 0; i < mEntries.count(); ++i) {
+		if(mEntries.at(i).mLastSeen == 0) {
+			mCurrentEntries.insert(mEntries.at(i).mPath, i);
+		}
+	}
+	mHead = lHead;
+	mHeadTime = lHeadTime;
+	mHasHead = true;
+	return true;
+}
+
+void FilenameIndex::save(const QString &pPath) const {
+	QByteArray lData(cIndexHeaderSize, Qt::Uninitialized);
+	auto lPointer = reinterpret_cast<uchar *>(lData.data()) + CacheFile::cHeaderSize;
+	memcpy(lPointer, mHead.id, GIT_OID_RAWSZ);
+	qToLittleEndian<qint64>(mHeadTime, lPointer + GIT_OID_RAWSZ);
+	qToLittleEndian<quint32>(static_cast<quint32>(mPaths.count()), lPointer + GIT_OID_RAWSZ + 8);
+	qToLittleEndian<quint32>(static_cast<quint32>(mEntries.count()), lPointer + GIT_OID_RAWSZ + 12);
+	qToLittleEndian<quint32>(static_cast<quint32>(mCommits.count()), lPointer + GIT_OID_RAWSZ + 16);
+	uchar lBuffer[cIndexEntrySize];
+	foreach(const QString &lPath, mPaths) {
+		const QByteArray lUtf8 = lPath.toUtf8();
+		qToLittleEndian<quint32>(static_cast<quint32>(lUtf8.size()), lBuffer);
+		lData.append(reinterpret_cast<const char *>(lBuffer), 4);
+		lData.append(lUtf8);
+	}
+	lData.reserve(lData.size() + mEntries.count() * cIndexEntrySize + mCommits.count() * cIndexCommitSize);
+	foreach(const Entry &lEntry, mEntries) {
+		qToLittleEndian<quint32>(lEntry.mPath, lBuffer);
+		memcpy(lBuffer + 4, lEntry.mOid.id, GIT_OID_RAWSZ);
+		qToLittleEndian<qint64>(lEntry.mFirstSeen, lBuffer + 4 + GIT_OID_RAWSZ);
+		qToLittleEndian<qint64>(lEntry.mLastSeen, lBuffer + 12 + GIT_OID_RAWSZ);
+		qToLittleEndian<quint32>(lEntry.mMode, lBuffer + 20 + GIT_OID_RAWSZ);
+		qToLittleEndian<quint32>(lEntry.mChunked ? cIndexChunked : 0, lBuffer + 24 + GIT_OID_RAWSZ);
+		qToLittleEndian<qint64>(lEntry.mMtime, lBuffer + 28 + GIT_OID_RAWSZ);
+		qToLittleEndian<qint64>(lEntry.mSize, lBuffer + 36 + GIT_OID_RAWSZ);
+		lData.append(reinterpret_cast<const char *>(lBuffer), cIndexEntrySize);
+	}
+	foreach(const Commit &lCommit, mCommits) {
+		memcpy(lBuffer, lCommit.mTree.id, GIT_OID_RAWSZ);
+		qToLittleEndian<qint64>(lCommit.mTime, lBuffer + GIT_OID_RAWSZ);
+		lData.append(reinterpret_cast<const char *>(lBuffer), cIndexCommitSize);
+	}
+	CacheFile::save(pPath, cIndexMagic, cIndexVersion, lData);
+}
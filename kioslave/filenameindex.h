@@ -0,0 +1,100 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef FILENAMEINDEX_H
+#define FILENAMEINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <git2.h>
+
+// Every path that has been in a branch, with the saves it was first and last
+// seen in, saved in the repository cache folder. Only commits added since the
+// last update are looked at, and only the parts of their trees that differ
+// from the commit before. A path gets a new entry each time its tree entry
+// changes, so there is one entry per version. The mode, modification time and
+// size of each version are kept too, so that File Digger can show the merged
+// history of the branch from this alone.
+// Used by both the kioslave and File Digger, so nothing is logged here.
+class FilenameIndex {
+public:
+	struct Entry {
+		quint32 mPath; // index in mPaths
+		git_oid mOid; // of the tree entry
+		qint64 mFirstSeen; // commit time
+		qint64 mLastSeen; // commit time, 0 if still there in the newest commit
+		quint32 mMode;
+		bool mChunked;
+		// From the newest save with this version in it. The commit time for
+		// folders and for files without metadata.
+		qint64 mMtime;
+		qint64 mSize; // -1 if not in the metadata
+	};
+	struct Commit {
+		git_oid mTree;
+		qint64 mTime;
+	};
+
+	explicit FilenameIndex(const QByteArray &pRefName);
+	// Load the saved index if not done already and add new commits to it.
+	bool update(git_repository *pRepository);
+	// Entries for the paths with a file or folder name containing pName, in
+	// any case. Paths with more versions come up once for each version.
+	QVector<int> find(const QString &pName, int pMaxResults) const;
+	const QString &path(const Entry &pEntry) const {
+		return mPaths.at(static_cast<int>(pEntry.mPath));
+	}
+	const QVector<QString> &paths() const {
+		return mPaths;
+	}
+	const git_oid &head() const {
+		return mHead;
+	}
+
+	QVector<Entry> mEntries;
+	QVector<Commit> mCommits; // oldest first
+	qint64 mHeadTime; // time of the newest indexed commit
+
+protected:
+	struct TreeEntry {
+		git_oid mOid;
+		bool mIsDirectory;
+		uint mMode;
+		bool mChunked;
+		qint64 mMtime;
+		qint64 mSize;
+	};
+	// pTime is used for the entries without metadata, which is only read if it is given.
+	void readTree(git_repository *pRepository, const git_oid *pTree, QHash<QString, TreeEntry> &pEntries, qint64 pTime = 0);
+	void compareTrees(git_repository *pRepository, const git_oid *pOldTree, const git_oid *pNewTree,
+	                  const QString &pPrefix, qint64 pOldTime, qint64 pNewTime);
+	void addEntry(const QString &pPath, const TreeEntry &pTreeEntry, qint64 pTime);
+	void closeEntry(const QString &pPath, qint64 pTime);
+	void updateEntry(const QString &pPath, const TreeEntry &pTreeEntry);
+	QString indexPath(git_repository *pRepository) const;
+	bool load(const QString &pPath);
+	void save(const QString &pPath) const;
+	// Made on the first search after an update: the distinct lower case file
+	// and folder names, the paths with each name, the names containing each
+	// trigram and the entries of each path.
+	void makeNameIndex() const;
+	void clearNameIndex();
+
+	QByteArray mRefName;
+	git_oid mHead{};
+	bool mHasHead;
+	bool mLoadTried;
+	QVector<QString> mPaths;
+	QHash<QString, quint32> mPathIndexes;
+	QHash<quint32, int> mCurrentEntries; // of the paths in the newest commit
+	mutable QVector<QString> mNames;
+	mutable QVector<QVector<quint32>> mNamePaths;
+	mutable QHash<quint64, QVector<quint32>> mTrigrams; // to indexes in mNames, in order
+	mutable QVector<QVector<int>> mPathEntries;
+};
+
+#endif // FILENAMEINDEX_H
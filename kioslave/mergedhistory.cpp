@@ -0,0 +1,269 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "mergedhistory.h"
+#include "filenameindex.h"
+#include "vfshelpers.h"
+
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+static const char cHistoryMagic[] = "KUPMHIST";
+static const int cHistoryMagicSize = 8;
+static const quint32 cHistoryVersion = 1;
+static const int cHistoryHeaderSize = CacheFile::cHeaderSize + 4 + 4 + 4 + GIT_OID_RAWSZ + 4;
+static const int cHistoryNodeSize = 8 * 4;
+static const int cHistoryVersionSize = GIT_OID_RAWSZ + 4 + 8 + 8 + 8;
+static const quint32 cHistoryChunked = 1;
+
+namespace {
+
+struct BuildNode {
+	QString mName;
+	quint32 mMode;
+	int mParent;
+	qint64 mNewest; // commit time of the newest version
+	QVector<int> mChildren;
+	QVector<MergedHistory::Version> mVersions;
+	QHash<git_oid, int> mVersionIndexes;
+};
+
+class HistoryBuilder {
+public:
+	explicit HistoryBuilder(const FilenameIndex &pIndex)
+	   : mIndex(pIndex)
+	{
+		mNodes.append(BuildNode{QString(), DEFAULT_MODE_DIRECTORY, -1, 0, {}, {}, {}});
+		for(int i = pIndex.mCommits.count() - 1; i >= 0; --i) {
+			const FilenameIndex::Commit &lCommit = pIndex.mCommits.at(i);
+			mNodes[0].mVersions.append({lCommit.mTree, false, lCommit.mTime, lCommit.mTime, 0});
+		}
+	}
+
+	void addEntry(const FilenameIndex::Entry &pEntry) {
+		const int lNode = node(mIndex.path(pEntry), pEntry.mMode);
+		BuildNode &lBuildNode = mNodes[lNode];
+		const qint64 lTime = pEntry.mLastSeen == 0 ? mIndex.mHeadTime : pEntry.mLastSeen;
+		MergedHistory::Version lVersion{pEntry.mOid, pEntry.mChunked, lTime,
+		                                S_ISDIR(pEntry.mMode) ? lTime : pEntry.mMtime, pEntry.mSize};
+		// the same version can have been there more than once, the newest counts.
+		int lVersionIndex = lBuildNode.mVersionIndexes.value(pEntry.mOid, -1);
+		if(lVersionIndex < 0) {
+			lBuildNode.mVersionIndexes.insert(pEntry.mOid, lBuildNode.mVersions.count());
+			lBuildNode.mVersions.append(lVersion);
+		} else if(lTime > lBuildNode.mVersions.at(lVersionIndex).mCommitTime) {
+			lBuildNode.mVersions[lVersionIndex] = lVersion;
+		}
+		if(lTime > lBuildNode.mNewest) {
+			lBuildNode.mNewest = lTime;
+			lBuildNode.mMode = pEntry.mMode;
+		}
+	}
+
+	QByteArray write() {
+		for(BuildNode &lNode: mNodes) {
+			std::sort(lNode.mVersions.begin(), lNode.mVersions.end(),
+			          [](const MergedHistory::Version &a, const MergedHistory::Version &b) {
+				return a.mModifiedDate > b.mModifiedDate;
+			});
+			std::sort(lNode.mChildren.begin(), lNode.mChildren.end(), [this](int a, int b) {
+				const BuildNode &lA = mNodes.at(a);
+				const BuildNode &lB = mNodes.at(b);
+				if(lA.mName != lB.mName) {
+					return lA.mName < lB.mName;
+				}
+				return lA.mNewest > lB.mNewest;
+			});
+		}
+		// breadth first, so that the sub nodes of each node are together.
+		QVector<int> lOrder{0};
+		QVector<quint32> lPositions(mNodes.count());
+		for(int i = 0; i < lOrder.count(); ++i) {
+			lPositions[lOrder.at(i)] = static_cast<quint32>(i);
+			lOrder += mNodes.at(lOrder.at(i)).mChildren;
+		}
+		quint32 lVersionCount = 0;
+		QByteArray lStrings;
+		QByteArray lNodeData(mNodes.count() * cHistoryNodeSize, Qt::Uninitialized);
+		auto lPointer = reinterpret_cast<uchar *>(lNodeData.data());
+		quint32 lNextChild = 1;
+		foreach(int lIndex, lOrder) {
+			const BuildNode &lNode = mNodes.at(lIndex);
+			const QByteArray lName = lNode.mName.toUtf8();
+			qToLittleEndian<quint32>(static_cast<quint32>(lStrings.size()), lPointer);
+			qToLittleEndian<quint32>(static_cast<quint32>(lName.size()), lPointer + 4);
+			qToLittleEndian<quint32>(lNode.mMode, lPointer + 8);
+			qToLittleEndian<quint32>(lNode.mParent < 0 ? 0 : lPositions.at(lNode.mParent), lPointer + 12);
+			qToLittleEndian<quint32>(lNextChild, lPointer + 16);
+			qToLittleEndian<quint32>(static_cast<quint32>(lNode.mChildren.count()), lPointer + 20);
+			qToLittleEndian<quint32>(lVersionCount, lPointer + 24);
+			qToLittleEndian<quint32>(static_cast<quint32>(lNode.mVersions.count()), lPointer + 28);
+			lStrings.append(lName);
+			lNextChild += static_cast<quint32>(lNode.mChildren.count());
+			lVersionCount += static_cast<quint32>(lNode.mVersions.count());
+			lPointer += cHistoryNodeSize;
+		}
+
+		QByteArray lData(cHistoryHeaderSize, '\0');
+		lPointer = reinterpret_cast<uchar *>(lData.data()) + CacheFile::cHeaderSize;
+		qToLittleEndian<quint32>(static_cast<quint32>(mNodes.count()), lPointer);
+		qToLittleEndian<quint32>(lVersionCount, lPointer + 4);
+		qToLittleEndian<quint32>(static_cast<quint32>(lStrings.size()), lPointer + 8);
+		memcpy(lPointer + 12, mIndex.head().id, GIT_OID_RAWSZ);
+		lData.reserve(cHistoryHeaderSize + lNodeData.size() + static_cast<int>(lVersionCount) * cHistoryVersionSize +
+		              lStrings.size());
+		lData.append(lNodeData);
+		uchar lBuffer[cHistoryVersionSize];
+		foreach(int lIndex, lOrder) {
+			foreach(const MergedHistory::Version &lVersion, mNodes.at(lIndex).mVersions) {
+				memcpy(lBuffer, lVersion.mOid.id, GIT_OID_RAWSZ);
+				qToLittleEndian<quint32>(lVersion.mChunked ? cHistoryChunked : 0, lBuffer + GIT_OID_RAWSZ);
+				qToLittleEndian<qint64>(lVersion.mCommitTime, lBuffer + GIT_OID_RAWSZ + 4);
+				qToLittleEndian<qint64>(lVersion.mModifiedDate, lBuffer + GIT_OID_RAWSZ + 12);
+				qToLittleEndian<qint64>(lVersion.mSize, lBuffer + GIT_OID_RAWSZ + 20);
+				lData.append(reinterpret_cast<const char *>(lBuffer), cHistoryVersionSize);
+			}
+		}
+		lData.append(lStrings);
+		return lData;
+	}
+
+protected:
+	// Folders on the way are added as needed, they are in the index anyway.
+	int node(const QString &pPath, quint32 pMode) {
+		const QPair<QString, quint32> lKey(pPath, S_IFMT & pMode);
+		auto lIter = mNodeIndexes.constFind(lKey);
+		if(lIter != mNodeIndexes.constEnd()) {
+			return lIter.value();
+		}
+		const int lSlash = pPath.lastIndexOf(QLatin1Char('/'));
+		const int lParent = lSlash < 0 ? 0 : node(pPath.left(lSlash), DEFAULT_MODE_DIRECTORY);
+		const int lNode = mNodes.count();
+		mNodes.append(BuildNode{pPath.mid(lSlash + 1), pMode, lParent, 0, {}, {}, {}});
+		mNodes[lParent].mChildren.append(lNode);
+		mNodeIndexes.insert(lKey, lNode);
+		return lNode;
+	}
+
+	const FilenameIndex &mIndex;
+	QVector<BuildNode> mNodes;
+	QHash<QPair<QString, quint32>, int> mNodeIndexes;
+};
+
+} // namespace
+
+MergedHistory::MergedHistory(const QByteArray &pRefName)
+   : mRefName(pRefName), mData(nullptr), mNodes(nullptr), mVersions(nullptr), mStrings(nullptr),
+     mNodeCount(0), mVersionCount(0)
+{}
+
+bool MergedHistory::open(git_repository *pRepository) {
+	close();
+	git_oid lHead;
+	if(0 != git_reference_name_to_id(&lHead, pRepository, mRefName)) {
+		return false;
+	}
+	mFile.setFileName(historyPath(pRepository));
+	if(!mFile.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	const uchar *lData = mFile.map(0, mFile.size());
+	if(lData == nullptr || !use(lData, mFile.size(), &lHead)) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool MergedHistory::update(git_repository *pRepository, const FilenameIndex &pIndex) {
+	close();
+	HistoryBuilder lBuilder(pIndex);
+	foreach(const FilenameIndex::Entry &lEntry, pIndex.mEntries) {
+		lBuilder.addEntry(lEntry);
+	}
+	QByteArray lData = lBuilder.write();
+	if(CacheFile::save(historyPath(pRepository), cHistoryMagic, cHistoryVersion, lData) && open(pRepository)) {
+		return true;
+	}
+	mMemoryCopy = lData;
+	return use(reinterpret_cast<const uchar *>(mMemoryCopy.constData()), mMemoryCopy.size(), &pIndex.head());
+}
+
+MergedHistory::Node MergedHistory::node(quint32 pNode) const {
+	const uchar *lPointer = mNodes + static_cast<size_t>(pNode) * cHistoryNodeSize;
+	return Node{qFromLittleEndian<quint32>(lPointer + 8), qFromLittleEndian<quint32>(lPointer + 12),
+	            qFromLittleEndian<quint32>(lPointer + 16), qFromLittleEndian<quint32>(lPointer + 20),
+	            qFromLittleEndian<quint32>(lPointer + 24), qFromLittleEndian<quint32>(lPointer + 28)};
+}
+
+QString MergedHistory::name(quint32 pNode) const {
+	const uchar *lPointer = mNodes + static_cast<size_t>(pNode) * cHistoryNodeSize;
+	return QString::fromUtf8(reinterpret_cast<const char *>(mStrings + qFromLittleEndian<quint32>(lPointer)),
+	                         static_cast<int>(qFromLittleEndian<quint32>(lPointer + 4)));
+}
+
+MergedHistory::Version MergedHistory::version(quint32 pVersion) const {
+	const uchar *lPointer = mVersions + static_cast<size_t>(pVersion) * cHistoryVersionSize;
+	Version lVersion;
+	git_oid_fromraw(&lVersion.mOid, lPointer);
+	lVersion.mChunked = (qFromLittleEndian<quint32>(lPointer + GIT_OID_RAWSZ) & cHistoryChunked) != 0;
+	lVersion.mCommitTime = qFromLittleEndian<qint64>(lPointer + GIT_OID_RAWSZ + 4);
+	lVersion.mModifiedDate = qFromLittleEndian<qint64>(lPointer + GIT_OID_RAWSZ + 12);
+	lVersion.mSize = qFromLittleEndian<qint64>(lPointer + GIT_OID_RAWSZ + 20);
+	return lVersion;
+}
+
+// Checks everything that is later used for indexing, so that a damaged file
+// can not make the readers go astray.
+bool MergedHistory::use(const uchar *pData, qint64 pSize, const git_oid *pHead) {
+	if(pSize < cHistoryHeaderSize || 0 != memcmp(pData, cHistoryMagic, cHistoryMagicSize)) {
+		return false;
+	}
+	const uchar *lPointer = pData + cHistoryMagicSize;
+	const quint32 lNodeCount = qFromLittleEndian<quint32>(lPointer + 4);
+	const quint32 lVersionCount = qFromLittleEndian<quint32>(lPointer + 8);
+	const quint32 lStringSize = qFromLittleEndian<quint32>(lPointer + 12);
+	if(qFromLittleEndian<quint32>(lPointer) != cHistoryVersion || 0 != memcmp(lPointer + 16, pHead->id, GIT_OID_RAWSZ) ||
+	      lNodeCount == 0 || static_cast<quint64>(pSize) != cHistoryHeaderSize +
+	      static_cast<quint64>(lNodeCount) * cHistoryNodeSize + static_cast<quint64>(lVersionCount) * cHistoryVersionSize +
+	      lStringSize) {
+		return false;
+	}
+	const uchar *lNodes = pData + cHistoryHeaderSize;
+	for(quint32 i = 0; i < lNodeCount; ++i) {
+		lPointer = lNodes + static_cast<size_t>(i) * cHistoryNodeSize;
+		if(static_cast<quint64>(qFromLittleEndian<quint32>(lPointer)) + qFromLittleEndian<quint32>(lPointer + 4) > lStringSize ||
+		      qFromLittleEndian<quint32>(lPointer + 12) >= lNodeCount ||
+		      static_cast<quint64>(qFromLittleEndian<quint32>(lPointer + 16)) + qFromLittleEndian<quint32>(lPointer + 20) > lNodeCount ||
+		      static_cast<quint64>(qFromLittleEndian<quint32>(lPointer + 24)) + qFromLittleEndian<quint32>(lPointer + 28) > lVersionCount) {
+			return false;
+		}
+	}
+	mData = pData;
+	mNodes = lNodes;
+	mVersions = mNodes + static_cast<size_t>(lNodeCount) * cHistoryNodeSize;
+	mStrings = mVersions + static_cast<size_t>(lVersionCount) * cHistoryVersionSize;
+	mNodeCount = lNodeCount;
+	mVersionCount = lVersionCount;
+	return true;
+}
+
+void MergedHistory::close() {
+	mData = nullptr;
+	mNodeCount = 0;
+	mVersionCount = 0;
+	mMemoryCopy.clear();
+	mFile.close(); // unmaps it
+}
+
+QString MergedHistory::historyPath(git_repository *pRepository) const {
+	return repositoryCachePath(pRepository) + QStringLiteral("/mergedhistory/") +
+	       QString::fromLatin1(mRefName.toPercentEncoding());
+}
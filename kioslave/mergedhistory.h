@@ -0,0 +1,71 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef MERGEDHISTORY_H
+#define MERGEDHISTORY_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <git2.h>
+
+class FilenameIndex;
+
+// The merged tree of a branch as File Digger shows it: every file and folder
+// that has been in the branch, each with its distinct versions. It is made
+// from the FilenameIndex and saved in the repository cache folder, in a form
+// that is used straight from a memory mapping. Opening it takes no time as
+// long as it is of the current head of the branch.
+// Nodes are stored breadth first, so the sub nodes of each node are next to
+// each other. They are sorted by name, and the newest comes first when a name
+// has been used for different kinds of nodes. Node 0 is the root, it has one
+// version per commit. Versions are sorted with the newest first.
+// Used by both File Digger and kup-search, so nothing is logged here.
+class MergedHistory {
+public:
+	struct Node {
+		quint32 mMode;
+		quint32 mParent;
+		quint32 mFirstChild;
+		quint32 mChildCount;
+		quint32 mFirstVersion;
+		quint32 mVersionCount;
+	};
+	struct Version {
+		git_oid mOid;
+		bool mChunked;
+		qint64 mCommitTime; // newest commit with this version
+		qint64 mModifiedDate;
+		qint64 mSize; // -1 if not known
+	};
+
+	explicit MergedHistory(const QByteArray &pRefName);
+	// Maps the saved history, if it is of the current head of the branch.
+	bool open(git_repository *pRepository);
+	// Makes the whole history again from pIndex, which must be up to date. It
+	// is saved if the repository can be written to, and used from memory
+	// otherwise.
+	bool update(git_repository *pRepository, const FilenameIndex &pIndex);
+	Node node(quint32 pNode) const;
+	QString name(quint32 pNode) const;
+	Version version(quint32 pVersion) const;
+
+protected:
+	bool use(const uchar *pData, qint64 pSize, const git_oid *pHead);
+	void close();
+	QString historyPath(git_repository *pRepository) const;
+
+	QByteArray mRefName;
+	QFile mFile;
+	QByteArray mMemoryCopy; // used when the history could not be saved
+	const uchar *mData;
+	const uchar *mNodes;
+	const uchar *mVersions;
+	const uchar *mStrings;
+	quint32 mNodeCount;
+	quint32 mVersionCount;
+};
+
+#endif // MERGEDHISTORY_H
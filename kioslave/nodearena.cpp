@@ -0,0 +1,194 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "nodearena.h"
+
+const quint32 NodeArena::cSlabShift;
+const quint32 NodeArena::cSlabSize;
+const quint32 NodeArena::cSlabMask;
+const quint32 NodeArena::cNoBlock;
+
+StringPool::StringPool()
+   : mStringBytes(0)
+{
+	mStrings.append(QString());
+	mUseCounts.append(0);
+	mIndexes.insert(QString(), 0);
+}
+
+quint32 StringPool::intern(const QString &pString) {
+	auto lIter = mIndexes.constFind(pString);
+	if(lIter != mIndexes.constEnd()) {
+		if(lIter.value() != 0) {
+			mUseCounts[static_cast<int>(lIter.value())]++;
+		}
+		return lIter.value();
+	}
+	quint32 lIndex;
+	if(!mFreeIndexes.isEmpty()) {
+		lIndex = mFreeIndexes.takeLast();
+		mStrings[static_cast<int>(lIndex)] = pString;
+		mUseCounts[static_cast<int>(lIndex)] = 1;
+	} else {
+		lIndex = static_cast<quint32>(mStrings.count());
+		mStrings.append(pString);
+		mUseCounts.append(1);
+	}
+	mIndexes.insert(pString, lIndex);
+	mStringBytes += static_cast<quint64>(pString.size()) * sizeof(QChar);
+	return lIndex;
+}
+
+void StringPool::release(quint32 pIndex) {
+	auto lIndex = static_cast<int>(pIndex);
+	if(pIndex == 0 || --mUseCounts[lIndex] > 0) {
+		return;
+	}
+	mStringBytes -= static_cast<quint64>(mStrings.at(lIndex).size()) * sizeof(QChar);
+	mIndexes.remove(mStrings.at(lIndex));
+	mStrings[lIndex] = QString();
+	mFreeIndexes.append(pIndex);
+}
+
+quint32 StringPool::find(const QString &pString) const {
+	return mIndexes.value(pString, 0);
+}
+
+quint64 StringPool::memoryCost() const {
+	// each string is shared between the vector and the hash, add some for the hash node.
+	return mStringBytes + static_cast<quint64>(mStrings.count()) * (sizeof(QString) + sizeof(quint32) + 32);
+}
+
+NodeArena::NodeArena()
+   : mOpenBlock(cNoBlock), mSlabsInUse(0)
+{}
+
+NodeArena::~NodeArena() {
+	foreach(const Block &lBlock, mBlocks) {
+		delete[] lBlock.mRecords;
+	}
+}
+
+NodeRange NodeArena::allocate(quint32 pCount) {
+	NodeRange lRange{0, 0};
+	if(pCount == 0) {
+		return lRange;
+	}
+	quint32 lBlockStart;
+	if(pCount <= cSlabSize) {
+		if(mOpenBlock == cNoBlock || mBlocks.value(mOpenBlock).mUsed + pCount > cSlabSize) {
+			quint32 lOldBlock = mOpenBlock;
+			mOpenBlock = reserveSlabs(1);
+			if(lOldBlock != cNoBlock && mBlocks.value(lOldBlock).mLiveRanges == 0) {
+				freeBlock(lOldBlock);
+			}
+		}
+		lBlockStart = mOpenBlock;
+	} else {
+		lBlockStart = reserveSlabs((pCount + cSlabSize - 1) / cSlabSize);
+	}
+	Block &lBlock = mBlocks[lBlockStart];
+	lRange.mFirst = (lBlock.mFirstSlab << cSlabShift) + lBlock.mUsed;
+	lRange.mCount = pCount;
+	lBlock.mUsed += pCount;
+	lBlock.mLiveRanges++;
+	return lRange;
+}
+
+void NodeArena::release(const NodeRange &pRange) {
+	if(pRange.mCount == 0) {
+		return;
+	}
+	for(quint32 i = pRange.mFirst; i < pRange.mFirst + pRange.mCount; ++i) {
+		const NodeRecord &lRecord = record(i);
+		mStrings.release(lRecord.mName);
+		mStrings.release(lRecord.mSymlinkTarget);
+		mStrings.release(lRecord.mMimeType);
+	}
+	quint32 lBlockStart = mBlockOfSlab.at(static_cast<int>(pRange.mFirst >> cSlabShift));
+	Block &lBlock = mBlocks[lBlockStart];
+	if(--lBlock.mLiveRanges > 0) {
+		return;
+	}
+	if(lBlockStart == mOpenBlock) {
+		lBlock.mUsed = 0; // nothing left in it, start filling it from the beginning again
+	} else {
+		freeBlock(lBlockStart);
+	}
+}
+
+bool NodeArena::acquireTree(const git_oid &pOid, NodeRange &pRange) {
+	auto lIter = mTrees.find(pOid);
+	if(lIter == mTrees.end()) {
+		return false;
+	}
+	lIter->mUsers++;
+	pRange = lIter->mRange;
+	return true;
+}
+
+void NodeArena::addTree(const git_oid &pOid, const NodeRange &pRange) {
+	mTrees.insert(pOid, SharedTree{pRange, 1});
+}
+
+quint32 NodeArena::releaseTree(const git_oid &pOid) {
+	auto lIter = mTrees.find(pOid);
+	if(lIter == mTrees.end() || --lIter->mUsers > 0) {
+		return 0;
+	}
+	const quint32 lCount = lIter->mRange.mCount;
+	release(lIter->mRange);
+	mTrees.erase(lIter);
+	return lCount;
+}
+
+quint64 NodeArena::memoryCost() const {
+	return mSlabsInUse * cSlabSize * sizeof(NodeRecord) + mStrings.memoryCost() +
+	      static_cast<quint64>(mTrees.count()) * (sizeof(git_oid) + sizeof(SharedTree) + 16);
+}
+
+quint32 NodeArena::reserveSlabs(quint32 pCount) {
+	// look for a run of unused slab indexes before growing the index space
+	int lFirst = 0;
+	quint32 lRunLength = 0;
+	for(int i = 0; i < mSlabs.count() && lRunLength < pCount; ++i) {
+		if(mSlabs.at(i) == nullptr) {
+			if(lRunLength++ == 0) {
+				lFirst = i;
+			}
+		} else {
+			lRunLength = 0;
+		}
+	}
+	if(lRunLength < pCount) {
+		if(lRunLength == 0) {
+			lFirst = mSlabs.count();
+		}
+		mSlabs.resize(lFirst + static_cast<int>(pCount));
+		mBlockOfSlab.resize(mSlabs.count());
+	}
+	Block lBlock;
+	lBlock.mRecords = new NodeRecord[pCount * cSlabSize];
+	lBlock.mFirstSlab = static_cast<quint32>(lFirst);
+	lBlock.mSlabCount = pCount;
+	lBlock.mUsed = 0;
+	lBlock.mLiveRanges = 0;
+	for(quint32 i = 0; i < pCount; ++i) {
+		mSlabs[lFirst + static_cast<int>(i)] = lBlock.mRecords + i * cSlabSize;
+		mBlockOfSlab[lFirst + static_cast<int>(i)] = lBlock.mFirstSlab;
+	}
+	mBlocks.insert(lBlock.mFirstSlab, lBlock);
+	mSlabsInUse += pCount;
+	return lBlock.mFirstSlab;
+}
+
+void NodeArena::freeBlock(quint32 pFirstSlab) {
+	Block lBlock = mBlocks.take(pFirstSlab);
+	delete[] lBlock.mRecords;
+	for(quint32 i = 0; i < lBlock.mSlabCount; ++i) {
+		mSlabs[static_cast<int>(pFirstSlab + i)] = nullptr;
+		mBlockOfSlab[static_cast<int>(pFirstSlab + i)] = cNoBlock;
+	}
+	mSlabsInUse -= lBlock.mSlabCount;
+}
@@ -0,0 +1,120 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef NODEARENA_H
+#define NODEARENA_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <git2.h>
+
+#include "vfshelpers.h"
+
+// Compact, fixed size description of one entry in an archived directory.
+// Strings are indexes into the StringPool of the arena, index 0 is the empty string.
+struct NodeRecord {
+	git_oid mOid;
+	quint32 mName;
+	quint32 mMode;
+	quint32 mSymlinkTarget;
+	quint32 mMimeType;
+	quint32 mUid;
+	quint32 mGid;
+	qint64 mAtime;
+	qint64 mMtime;
+	qint64 mSize; // negative if not known yet
+	quint32 mFlags;
+
+	enum Flags {
+		Chunked = 0x1,
+		MimeTypeFromContent = 0x2 // otherwise mMimeType is only based on the file name
+	};
+	bool isChunked() const { return mFlags & Chunked; }
+};
+
+struct NodeRange {
+	quint32 mFirst;
+	quint32 mCount;
+};
+
+// Strings are counted, each intern() needs a release() once the index is no
+// longer stored anywhere. Indexes of released strings are used again.
+class StringPool {
+public:
+	StringPool();
+	quint32 intern(const QString &pString);
+	void release(quint32 pIndex);
+	// returns 0 if the string is not in the pool
+	quint32 find(const QString &pString) const;
+	const QString &at(quint32 pIndex) const {
+		return mStrings.at(static_cast<int>(pIndex));
+	}
+	quint64 memoryCost() const;
+
+protected:
+	QVector<QString> mStrings;
+	QVector<quint32> mUseCounts;
+	QVector<quint32> mFreeIndexes;
+	QHash<QString, quint32> mIndexes;
+	quint64 mStringBytes;
+};
+
+// Records are allocated in slabs of cSlabSize, the ranges handed out are
+// always contiguous. Ranges that do not fit in one slab get a block of
+// consecutive slabs for themselves. A block is freed when the last range in
+// it has been released.
+class NodeArena {
+public:
+	NodeArena();
+	~NodeArena();
+	NodeRange allocate(quint32 pCount);
+	// Also releases the strings of the records, all of them must have been filled in.
+	void release(const NodeRange &pRange);
+	// Archived directories with the same tree id share one range of records,
+	// most folders are the same tree in save after save. acquireTree() returns
+	// false if the tree has not been decoded yet, then the caller decodes it
+	// and hands the range over with addTree().
+	bool acquireTree(const git_oid &pOid, NodeRange &pRange);
+	void addTree(const git_oid &pOid, const NodeRange &pRange);
+	// Returns how many records were freed, 0 while others still use the tree.
+	quint32 releaseTree(const git_oid &pOid);
+	NodeRecord &record(quint32 pIndex) {
+		return mSlabs.at(static_cast<int>(pIndex >> cSlabShift))[pIndex & cSlabMask];
+	}
+	quint64 memoryCost() const;
+
+	StringPool mStrings;
+
+	static const quint32 cSlabShift = 12;
+	static const quint32 cSlabSize = 1 << cSlabShift;
+	static const quint32 cSlabMask = cSlabSize - 1;
+
+protected:
+	struct Block {
+		NodeRecord *mRecords;
+		quint32 mFirstSlab;
+		quint32 mSlabCount;
+		quint32 mUsed;
+		quint32 mLiveRanges;
+	};
+	struct SharedTree {
+		NodeRange mRange;
+		quint32 mUsers;
+	};
+	quint32 reserveSlabs(quint32 pCount);
+	void freeBlock(quint32 pFirstSlab);
+
+	QVector<NodeRecord *> mSlabs;
+	QVector<quint32> mBlockOfSlab; // first slab of the block that each slab belongs to
+	QHash<quint32, Block> mBlocks; // indexed by first slab
+	QHash<git_oid, SharedTree> mTrees;
+	quint32 mOpenBlock; // block still accepting small ranges, or cNoBlock
+	quint64 mSlabsInUse;
+
+	static const quint32 cNoBlock = 0xFFFFFFFF;
+};
+
+#endif // NODEARENA_H
@@ -0,0 +1,93 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "nodecache.h"
+#include "bupvfs.h"
+#include "kupkio_debug.h"
+
+#include <QSet>
+
+NodeCache::NodeCache(quint64 pBudget)
+   : mBudget(pBudget), mUsage(0), mSharedUsage(0), mHits(0), mMisses(0), mEvictions(0)
+{}
+
+NodeCache::~NodeCache() {
+	logStatistics();
+}
+
+void NodeCache::insert(Directory *pDirectory, quint64 pCost) {
+	++mMisses;
+	remove(pDirectory);
+	mEntries.push_front(Entry{pDirectory, pCost});
+	mLookup.insert(pDirectory, mEntries.begin());
+	mUsage += pCost;
+}
+
+void NodeCache::grow(Directory *pDirectory, quint64 pCost) {
+	auto lIter = mLookup.find(pDirectory);
+	if(lIter == mLookup.end()) {
+		return;
+	}
+	lIter.value()->mCost += pCost;
+	mUsage += pCost;
+}
+
+void NodeCache::touch(Directory *pDirectory) {
+	auto lIter = mLookup.find(pDirectory);
+	if(lIter == mLookup.end()) {
+		return;
+	}
+	++mHits;
+	mEntries.splice(mEntries.begin(), mEntries, lIter.value());
+}
+
+void NodeCache::remove(Directory *pDirectory) {
+	auto lIter = mLookup.find(pDirectory);
+	if(lIter == mLookup.end()) {
+		return;
+	}
+	mUsage -= lIter.value()->mCost;
+	mEntries.erase(lIter.value());
+	mLookup.erase(lIter);
+}
+
+void NodeCache::chargeShared(quint64 pCost) {
+	mSharedUsage += pCost;
+	mUsage += pCost;
+}
+
+void NodeCache::refundShared(quint64 pCost) {
+	mSharedUsage -= pCost;
+	mUsage -= pCost;
+}
+
+void NodeCache::trim(Node *pPinned) {
+	if(mUsage <= mBudget) {
+		return;
+	}
+	QSet<Node *> lPinned;
+	for(Node *lNode = pPinned; lNode != nullptr; lNode = qobject_cast<Node *>(lNode->parent())) {
+		lPinned.insert(lNode);
+	}
+	auto lCandidate = mEntries.end();
+	while(mUsage > mBudget && lCandidate != mEntries.begin()) {
+		--lCandidate;
+		Directory *lDirectory = lCandidate->mDirectory;
+		if(lPinned.contains(lDirectory)) {
+			continue;
+		}
+		// evicting deletes sub directories, removing their entries too. Start over from the end.
+		remove(lDirectory);
+		lDirectory->evictSubNodes();
+		++mEvictions;
+		lCandidate = mEntries.end();
+	}
+	logStatistics();
+}
+
+void NodeCache::logStatistics() const {
+	qCDebug(KUPKIO) << "node cache: hits" << mHits << "misses" << mMisses << "evictions" << mEvictions
+	                << "usage" << mUsage << "of" << mBudget << "bytes in" << mEntries.size() << "directories,"
+	                << mSharedUsage << "bytes of it in shared records";
+}
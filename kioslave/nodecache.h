@@ -0,0 +1,56 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef NODECACHE_H
+#define NODECACHE_H
+
+#include <QHash>
+#include <QtGlobal>
+
+#include <list>
+
+class Directory;
+class Node;
+
+// Keeps track of which archived directories currently have their sub nodes
+// generated and how much memory they are estimated to use. When the total
+// goes above the budget the least recently used directories get their sub
+// nodes deleted, they will be generated again from the tree if needed.
+class NodeCache {
+public:
+	explicit NodeCache(quint64 pBudget);
+	~NodeCache();
+
+	void insert(Directory *pDirectory, quint64 pCost);
+	void grow(Directory *pDirectory, quint64 pCost);
+	void touch(Directory *pDirectory);
+	void remove(Directory *pDirectory);
+	// Records shared by directories of the same tree are paid for on their
+	// own, from when they are decoded until the last of those lets go of them.
+	void chargeShared(quint64 pCost);
+	void refundShared(quint64 pCost);
+
+	// Evict until within budget. Directories above pPinned in the tree are kept.
+	void trim(Node *pPinned = nullptr);
+	void logStatistics() const;
+
+	quint64 mBudget;
+	quint64 mUsage;
+	quint64 mSharedUsage; // part of mUsage
+	quint64 mHits;
+	quint64 mMisses;
+	quint64 mEvictions;
+
+protected:
+	struct Entry {
+		Directory *mDirectory;
+		quint64 mCost;
+	};
+	using EntryList = std::list<Entry>;
+
+	EntryList mEntries; // most recently used first
+	QHash<Directory *, EntryList::iterator> mLookup;
+};
+
+#endif // NODECACHE_H
@@ -0,0 +1,177 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "pathhistory.h"
+#include "vfshelpers.h"
+#include "kupkio_debug.h"
+
+#include <QCryptographicHash>
+#include <QtEndian>
+
+#include <cstring>
+
+static const char cHistoryMagic[] = "KUPPATHH";
+static const quint32 cHistoryVersion = 1;
+static const int cHistoryHeaderSize = CacheFile::cHeaderSize + GIT_OID_RAWSZ + 4;
+static const int cHistoryEntrySize = 8 + 2 * GIT_OID_RAWSZ;
+
+// Finds pName in a bup tree, where chunked files have ".bup" added to their
+// name and other names already ending in ".bup" or ".bupl" get ".bupl" added.
+// Only the last one can be a file, chunked or not.
+static const git_tree_entry *findEntry(git_tree *pTree, const QString &pName, bool pLast) {
+	const QByteArray lName = pName.toUtf8();
+	const git_tree_entry *lEntry;
+	if(lName.endsWith(".bup") || lName.endsWith(".bupl")) {
+		lEntry = git_tree_entry_byname(pTree, QByteArray(lName + ".bupl").constData());
+	} else {
+		lEntry = git_tree_entry_byname(pTree, lName.constData());
+	}
+	if(lEntry == nullptr && pLast) {
+		lEntry = git_tree_entry_byname(pTree, QByteArray(lName + ".bup").constData());
+	}
+	return lEntry;
+}
+
+bool PathHistory::Version::exists() const {
+	static const git_oid cZeroOid{};
+	return !git_oid_equal(&mOid, &cZeroOid);
+}
+
+PathHistory::PathHistory(const QByteArray &pRefName, const QStringList &pPath)
+   : mRefName(pRefName), mPath(pPath), mHasHead(false)
+{}
+
+bool PathHistory::update(git_repository *pRepository, const QVector<CommitIndex::Entry> &pCommits) {
+	const QString lPath = historyPath(pRepository);
+	if(!mHasHead) {
+		load(lPath);
+	}
+	int lNewCount = pCommits.count();
+	for(int i = 0; mHasHead && i < pCommits.count(); ++i) {
+		if(git_oid_equal(&pCommits.at(i).mCommit, &mHead)) {
+			lNewCount = i;
+			break;
+		}
+	}
+	if(lNewCount == 0) {
+		return true;
+	}
+	if(lNewCount == pCommits.count()) {
+		mVersions.clear(); // first time, or the branch has been rewritten
+	}
+
+	QVector<Version> lNewVersions;
+	QVector<git_oid> lChain; // tree ids down to the path in the commit after the current one
+	for(int i = 0; i < lNewCount; ++i) {
+		const CommitIndex::Entry &lCommit = pCommits.at(i);
+		if(lookUp(pRepository, &lCommit.mTree, lChain) || lNewVersions.isEmpty()) {
+			git_oid lOid{};
+			if(lChain.count() == mPath.count() + 1) {
+				lOid = lChain.last();
+			}
+			if(lNewVersions.isEmpty() || !git_oid_equal(&lOid, &lNewVersions.last().mOid)) {
+				lNewVersions.append(Version{lCommit.mTime, lCommit.mCommit, lOid});
+				continue;
+			}
+		}
+		// same as in the newer commit, so this version is older than we knew.
+		lNewVersions.last().mTime = lCommit.mTime;
+		lNewVersions.last().mCommit = lCommit.mCommit;
+	}
+	if(!mVersions.isEmpty() && git_oid_equal(&lNewVersions.last().mOid, &mVersions.first().mOid)) {
+		lNewVersions.removeLast(); // continues into what was known already
+	}
+	qCDebug(KUPKIO) << "looked at" << lNewCount << "commits for the history of" << mPath.join(QLatin1Char('/'));
+	lNewVersions.append(mVersions);
+	mVersions = lNewVersions;
+	mHead = pCommits.first().mCommit;
+	mHasHead = true;
+	save(lPath);
+	return true;
+}
+
+// Updates pChain from the root tree down, returns false as soon as one level
+// is the same as in pChain from before, then everything below it is too.
+bool PathHistory::lookUp(git_repository *pRepository, const git_oid *pTree, QVector<git_oid> &pChain) {
+	if(!pChain.isEmpty() && git_oid_equal(pTree, &pChain.first())) {
+		return false;
+	}
+	int lLength = 1;
+	if(pChain.isEmpty()) {
+		pChain.append(*pTree);
+	} else {
+		pChain[0] = *pTree;
+	}
+	git_oid lTreeOid = *pTree;
+	for(int i = 0; i < mPath.count(); ++i) {
+		git_tree *lTree;
+		if(0 != git_tree_lookup(&lTree, pRepository, &lTreeOid)) {
+			break;
+		}
+		bool lLast = i == mPath.count() - 1;
+		const git_tree_entry *lEntry = findEntry(lTree, mPath.at(i), lLast);
+		if(lEntry == nullptr || (!lLast && git_tree_entry_type(lEntry) != GIT_OBJECT_TREE)) {
+			git_tree_free(lTree);
+			break;
+		}
+		lTreeOid = *git_tree_entry_id(lEntry);
+		git_tree_free(lTree);
+		if(lLength < pChain.count() && git_oid_equal(&lTreeOid, &pChain.at(lLength))) {
+			return false;
+		}
+		if(lLength < pChain.count()) {
+			pChain[lLength] = lTreeOid;
+		} else {
+			pChain.append(lTreeOid);
+		}
+		++lLength;
+	}
+	pChain.resize(lLength);
+	return true;
+}
+
+QString PathHistory::historyPath(git_repository *pRepository) const {
+	QByteArray lPathHash = QCryptographicHash::hash(mPath.join(QLatin1Char('/')).toUtf8(), QCryptographicHash::Sha1);
+	return repositoryCachePath(pRepository) + QStringLiteral("/pathhistory/") +
+	       QString::fromLatin1(mRefName.toPercentEncoding()) + QLatin1Char('/') + QString::fromLatin1(lPathHash.toHex());
+}
+
+bool PathHistory::load(const QString &pPath) {
+	const QByteArray lData = CacheFile::load(pPath, cHistoryMagic, cHistoryVersion);
+	if(lData.size() < cHistoryHeaderSize) {
+		return false;
+	}
+	const uchar *lPointer = reinterpret_cast<const uchar *>(lData.constData()) + CacheFile::cHeaderSize;
+	quint32 lCount = qFromLittleEndian<quint32>(lPointer + GIT_OID_RAWSZ);
+	if(static_cast<qint64>(lData.size()) != cHistoryHeaderSize + static_cast<qint64>(lCount) * cHistoryEntrySize) {
+		return false;
+	}
+	git_oid_fromraw(&mHead, lPointer);
+	lPointer = reinterpret_cast<const uchar *>(lData.constData()) + cHistoryHeaderSize;
+	mVersions.resize(static_cast<int>(lCount));
+	for(quint32 i = 0; i < lCount; ++i) {
+		Version &lVersion = mVersions[static_cast<int>(i)];
+		lVersion.mTime = qFromLittleEndian<qint64>(lPointer);
+		git_oid_fromraw(&lVersion.mCommit, lPointer + 8);
+		git_oid_fromraw(&lVersion.mOid, lPointer + 8 + GIT_OID_RAWSZ);
+		lPointer += cHistoryEntrySize;
+	}
+	mHasHead = true;
+	return true;
+}
+
+void PathHistory::save(const QString &pPath) const {
+	QByteArray lData(cHistoryHeaderSize + mVersions.count() * cHistoryEntrySize, Qt::Uninitialized);
+	auto lPointer = reinterpret_cast<uchar *>(lData.data()) + CacheFile::cHeaderSize;
+	memcpy(lPointer, mHead.id, GIT_OID_RAWSZ);
+	qToLittleEndian<quint32>(static_cast<quint32>(mVersions.count()), lPointer + GIT_OID_RAWSZ);
+	lPointer += GIT_OID_RAWSZ + 4;
+	foreach(const Version &lVersion, mVersions) {
+		qToLittleEndian<qint64>(lVersion.mTime, lPointer);
+		memcpy(lPointer + 8, lVersion.mCommit.id, GIT_OID_RAWSZ);
+		memcpy(lPointer + 8 + GIT_OID_RAWSZ, lVersion.mOid.id, GIT_OID_RAWSZ);
+		lPointer += cHistoryEntrySize;
+	}
+	CacheFile::save(pPath, cHistoryMagic, cHistoryVersion, lData);
+}
@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef PATHHISTORY_H
+#define PATHHISTORY_H
+
+#include "commitindex.h"
+
+#include <QStringList>
+
+// The distinct versions of one path in a branch, saved in the repository
+// cache folder. Commits are compared one level at a time from the root, a
+// commit is passed over as soon as a folder on the way has the same tree id
+// as in the commit after it. Only commits added since the last update are
+// looked at.
+class PathHistory {
+public:
+	struct Version {
+		qint64 mTime; // of the first commit with this version
+		git_oid mCommit; // the first commit with this version
+		git_oid mOid; // of the file or folder, zero if the path did not exist
+		bool exists() const;
+	};
+
+	PathHistory(const QByteArray &pRefName, const QStringList &pPath);
+	// pCommits is the commit index of the branch, newest first.
+	bool update(git_repository *pRepository, const QVector<CommitIndex::Entry> &pCommits);
+
+	QVector<Version> mVersions; // newest first
+
+protected:
+	bool lookUp(git_repository *pRepository, const git_oid *pTree, QVector<git_oid> &pChain);
+	QString historyPath(git_repository *pRepository) const;
+	bool load(const QString &pPath);
+	void save(const QString &pPath) const;
+
+	QByteArray mRefName;
+	QStringList mPath;
+	git_oid mHead{};
+	bool mHasHead;
+};
+
+#endif // PATHHISTORY_H
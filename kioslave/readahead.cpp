@@ -0,0 +1,157 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "readahead.h"
+#include "blobcache.h"
+#include "bupodb.h"
+#include "chunkwalker.h"
+#include "vfshelpers.h"
+#include "kupkio_debug.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+ChunkReadAhead::ChunkReadAhead(const QByteArray &pRepositoryPath, const git_oid *pOid, int pWindowSize)
+   : mStallCount(0), mStallTime(0), mRepositoryPath(pRepositoryPath), mOid(*pOid), mHead(0), mCount(0),
+     mGeneration(0), mStartOffset(0), mAtEnd(true), mFailed(false), mBlobCorrupt(false), mStop(false)
+{
+	mRing.resize(qMax(1, pWindowSize));
+}
+
+ChunkReadAhead::~ChunkReadAhead() {
+	mMutex.lock();
+	mStop = true;
+	mNotFull.wakeAll();
+	mMutex.unlock();
+	wait();
+}
+
+void ChunkReadAhead::restart(quint64 pOffset, const QSharedPointer<const ChunkIndex> &pIndex) {
+	QMutexLocker lLocker(&mMutex);
+	++mGeneration;
+	mStartOffset = pOffset;
+	mIndex = pIndex;
+	for(int i = 0; i < mRing.count(); ++i) {
+		mRing[i].mData.clear();
+	}
+	mHead = 0;
+	mCount = 0;
+	mAtEnd = false;
+	mFailed = false;
+	mBlobCorrupt = false;
+	mNotFull.wakeAll();
+}
+
+bool ChunkReadAhead::takeChunk(QByteArray &pData, quint64 &pStart) {
+	QMutexLocker lLocker(&mMutex);
+	if(mCount == 0 && !mAtEnd && !mFailed) {
+		QElapsedTimer lTimer;
+		lTimer.start();
+		while(mCount == 0 && !mAtEnd && !mFailed) {
+			mNotEmpty.wait(&mMutex);
+		}
+		mStallTime += lTimer.nsecsElapsed();
+		++mStallCount;
+	}
+	if(mCount == 0) {
+		return false;
+	}
+	Chunk &lChunk = mRing[mHead];
+	pData = lChunk.mData;
+	pStart = lChunk.mStart;
+	lChunk.mData.clear();
+	mHead = (mHead + 1) % mRing.count();
+	--mCount;
+	mNotFull.wakeAll();
+	return true;
+}
+
+bool ChunkReadAhead::corruptBlob(git_oid &pOid) {
+	QMutexLocker lLocker(&mMutex);
+	if(mBlobCorrupt) {
+		pOid = mCorruptBlob;
+	}
+	return mBlobCorrupt;
+}
+
+void ChunkReadAhead::run() {
+	git_repository *lRepository;
+	if(0 != git_repository_open(&lRepository, mRepositoryPath)) {
+		qCWarning(KUPKIO) << "read-ahead could not open repository" << mRepositoryPath;
+		QMutexLocker lLocker(&mMutex);
+		mFailed = true;
+		mNotEmpty.wakeAll();
+		return;
+	}
+	addBupOdbBackend(lRepository);
+	QMutexLocker lLocker(&mMutex);
+	quint32 lGeneration = mGeneration;
+	bool lIdle = mAtEnd;
+	while(!mStop) {
+		if(lIdle && lGeneration == mGeneration) {
+			mNotFull.wait(&mMutex); // until restarted or stopped
+			continue;
+		}
+		lGeneration = mGeneration;
+		quint64 lOffset = mStartOffset;
+		QSharedPointer<const ChunkIndex> lIndex = mIndex;
+		lLocker.unlock();
+		bool lOk = fill(lRepository, lGeneration, lOffset, lIndex);
+		lLocker.relock();
+		if(lGeneration == mGeneration) {
+			if(lOk) {
+				mAtEnd = true;
+			} else {
+				mFailed = true;
+			}
+			mNotEmpty.wakeAll();
+		}
+		lIdle = true;
+	}
+	lLocker.unlock();
+	git_repository_free(lRepository);
+}
+
+bool ChunkReadAhead::fill(git_repository *pRepository, quint32 pGeneration, quint64 pOffset,
+                          const QSharedPointer<const ChunkIndex> &pIndex) {
+	ChunkWalker lWalker(pRepository, &mOid, pIndex);
+	quint64 lSkip;
+	if(!lWalker.seek(pOffset, lSkip)) {
+		return false;
+	}
+	quint64 lChunkStart = pOffset - lSkip;
+	while(lWalker.currentBlob() != nullptr) {
+		Chunk lChunk;
+		lChunk.mStart = lChunkStart;
+		bool lCorrupt = false;
+		if(!BlobCache::read(pRepository, lWalker.currentBlob(), lChunk.mData, &lCorrupt)) {
+			if(lCorrupt) {
+				QMutexLocker lLocker(&mMutex);
+				if(pGeneration == mGeneration) {
+					mBlobCorrupt = true;
+					mCorruptBlob = *lWalker.currentBlob();
+				}
+			}
+			return false;
+		}
+		lChunkStart += static_cast<quint64>(lChunk.mData.size());
+
+		QMutexLocker lLocker(&mMutex);
+		while(mCount == mRing.count() && pGeneration == mGeneration && !mStop) {
+			mNotFull.wait(&mMutex);
+		}
+		if(pGeneration != mGeneration || mStop) {
+			return true; // not an error, the reader wants something else now.
+		}
+		mRing[(mHead + mCount) % mRing.count()] = lChunk;
+		++mCount;
+		mNotEmpty.wakeAll();
+		lLocker.unlock();
+
+		if(!lWalker.next()) {
+			return false;
+		}
+	}
+	return true;
+}
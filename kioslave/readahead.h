@@ -0,0 +1,66 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <git2.h>
+
+#include "chunkindex.h"
+
+// Background stage for reading a chunked file sequentially. A worker thread
+// with its own repository handle walks the chunk tree ahead of the reader
+// and keeps a bounded ring of inflated chunks ready to be taken.
+class ChunkReadAhead: public QThread {
+	Q_OBJECT
+public:
+	ChunkReadAhead(const QByteArray &pRepositoryPath, const git_oid *pOid, int pWindowSize);
+	~ChunkReadAhead() override;
+
+	// Throw away whatever has been read ahead and continue from the chunk containing pOffset.
+	// The chunk index is used for walking the file, if there is one.
+	void restart(quint64 pOffset, const QSharedPointer<const ChunkIndex> &pIndex);
+	// Blocks until the next chunk is available. pStart is set to where in the file it begins.
+	bool takeChunk(QByteArray &pData, quint64 &pStart);
+	// After takeChunk() failed, whether that was because of a blob not matching its id.
+	bool corruptBlob(git_oid &pOid);
+
+	qint64 mStallCount;
+	qint64 mStallTime; // nanoseconds spent waiting in takeChunk()
+
+protected:
+	void run() override;
+	bool fill(git_repository *pRepository, quint32 pGeneration, quint64 pOffset,
+	          const QSharedPointer<const ChunkIndex> &pIndex);
+
+	struct Chunk {
+		QByteArray mData;
+		quint64 mStart;
+	};
+
+	QByteArray mRepositoryPath;
+	git_oid mOid;
+	QMutex mMutex;
+	QWaitCondition mNotEmpty;
+	QWaitCondition mNotFull; // also signalled on restart and stop
+	QVector<Chunk> mRing;
+	int mHead;
+	int mCount;
+	quint32 mGeneration;
+	quint64 mStartOffset;
+	QSharedPointer<const ChunkIndex> mIndex;
+	bool mAtEnd;
+	bool mFailed;
+	bool mBlobCorrupt;
+	git_oid mCorruptBlob{};
+	bool mStop;
+};
+
+#endif // READAHEAD_H
@@ -0,0 +1,204 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "sha1.h"
+
+#include <QtEndian>
+
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SHA1_X86_EXTENSIONS
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline quint32 rotateLeft(quint32 pValue, int pBits) {
+	return (pValue << pBits) | (pValue >> (32 - pBits));
+}
+
+void processBlocksPlain(quint32 *pState, const uchar *pData, size_t pBlockCount) {
+	quint32 lW[80];
+	while(pBlockCount-- > 0) {
+		for(int i = 0; i < 16; ++i) {
+			lW[i] = qFromBigEndian<quint32>(pData + 4 * i);
+		}
+		for(int i = 16; i < 80; ++i) {
+			lW[i] = rotateLeft(lW[i - 3] ^ lW[i - 8] ^ lW[i - 14] ^ lW[i - 16], 1);
+		}
+		quint32 a = pState[0], b = pState[1], c = pState[2], d = pState[3], e = pState[4];
+		auto lRound = [&](quint32 pF, quint32 pK, quint32 pW) {
+			quint32 lTemp = rotateLeft(a, 5) + pF + e + pK + pW;
+			e = d;
+			d = c;
+			c = rotateLeft(b, 30);
+			b = a;
+			a = lTemp;
+		};
+		for(int i = 0; i < 20; ++i) {
+			lRound((b & c) | (~b & d), 0x5A827999, lW[i]);
+		}
+		for(int i = 20; i < 40; ++i) {
+			lRound(b ^ c ^ d, 0x6ED9EBA1, lW[i]);
+		}
+		for(int i = 40; i < 60; ++i) {
+			lRound((b & c) | (b & d) | (c & d), 0x8F1BBCDC, lW[i]);
+		}
+		for(int i = 60; i < 80; ++i) {
+			lRound(b ^ c ^ d, 0xCA62C1D6, lW[i]);
+		}
+		pState[0] += a;
+		pState[1] += b;
+		pState[2] += c;
+		pState[3] += d;
+		pState[4] += e;
+		pData += 64;
+	}
+}
+
+#ifdef SHA1_X86_EXTENSIONS
+
+bool cpuHasShaExtensions() {
+	unsigned int a, b, c, d;
+	if(!__get_cpuid(1, &a, &b, &c, &d) || (c & bit_SSSE3) == 0 || (c & bit_SSE4_1) == 0) {
+		return false;
+	}
+	if(!__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+		return false;
+	}
+	return (b & (1u << 29)) != 0; // SHA
+}
+
+// Four rounds, with the message schedule for the rounds after. The messages
+// and the two e registers take turns, pMsgA is the newest block of words.
+template<int F>
+__attribute__((target("sha,sse4.1"), always_inline))
+inline void shaRounds(__m128i &pAbcd, __m128i &pE, __m128i &pNextE,
+                      __m128i &pMsgA, __m128i &pMsgB, __m128i &pMsgC, __m128i &pMsgD) {
+	pE = _mm_sha1nexte_epu32(pE, pMsgA);
+	pNextE = pAbcd;
+	pMsgB = _mm_sha1msg2_epu32(pMsgB, pMsgA);
+	pAbcd = _mm_sha1rnds4_epu32(pAbcd, pE, F);
+	pMsgD = _mm_sha1msg1_epu32(pMsgD, pMsgA);
+	pMsgC = _mm_xor_si128(pMsgC, pMsgA);
+}
+
+__attribute__((target("sha,sse4.1")))
+void processBlocksShaExtensions(quint32 *pState, const uchar *pData, size_t pBlockCount) {
+	const __m128i lByteSwap = _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+	__m128i lAbcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pState)), 0x1B);
+	__m128i lE0 = _mm_set_epi32(static_cast<int>(pState[4]), 0, 0, 0);
+	while(pBlockCount-- > 0) {
+		const __m128i lAbcdSaved = lAbcd;
+		const __m128i lE0Saved = lE0;
+		__m128i lE1;
+		__m128i lMsg0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pData)), lByteSwap);
+		__m128i lMsg1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pData + 16)), lByteSwap);
+		__m128i lMsg2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pData + 32)), lByteSwap);
+		__m128i lMsg3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pData + 48)), lByteSwap);
+
+		// rounds 0 to 11, the message schedule is still being filled
+		lE0 = _mm_add_epi32(lE0, lMsg0);
+		lE1 = lAbcd;
+		lAbcd = _mm_sha1rnds4_epu32(lAbcd, lE0, 0);
+		lE1 = _mm_sha1nexte_epu32(lE1, lMsg1);
+		lE0 = lAbcd;
+		lAbcd = _mm_sha1rnds4_epu32(lAbcd, lE1, 0);
+		lMsg0 = _mm_sha1msg1_epu32(lMsg0, lMsg1);
+		lE0 = _mm_sha1nexte_epu32(lE0, lMsg2);
+		lE1 = lAbcd;
+		lAbcd = _mm_sha1rnds4_epu32(lAbcd, lE0, 0);
+		lMsg1 = _mm_sha1msg1_epu32(lMsg1, lMsg2);
+		lMsg0 = _mm_xor_si128(lMsg0, lMsg2);
+
+		shaRounds<0>(lAbcd, lE1, lE0, lMsg3, lMsg0, lMsg1, lMsg2);
+		shaRounds<0>(lAbcd, lE0, lE1, lMsg0, lMsg1, lMsg2, lMsg3);
+		shaRounds<1>(lAbcd, lE1, lE0, lMsg1, lMsg2, lMsg3, lMsg0);
+		shaRounds<1>(lAbcd, lE0, lE1, lMsg2, lMsg3, lMsg0, lMsg1);
+		shaRounds<1>(lAbcd, lE1, lE0, lMsg3, lMsg0, lMsg1, lMsg2);
+		shaRounds<1>(lAbcd, lE0, lE1, lMsg0, lMsg1, lMsg2, lMsg3);
+		shaRounds<1>(lAbcd, lE1, lE0, lMsg1, lMsg2, lMsg3, lMsg0);
+		shaRounds<2>(lAbcd, lE0, lE1, lMsg2, lMsg3, lMsg0, lMsg1);
+		shaRounds<2>(lAbcd, lE1, lE0, lMsg3, lMsg0, lMsg1, lMsg2);
+		shaRounds<2>(lAbcd, lE0, lE1, lMsg0, lMsg1, lMsg2, lMsg3);
+		shaRounds<2>(lAbcd, lE1, lE0, lMsg1, lMsg2, lMsg3, lMsg0);
+		shaRounds<2>(lAbcd, lE0, lE1, lMsg2, lMsg3, lMsg0, lMsg1);
+		shaRounds<3>(lAbcd, lE1, lE0, lMsg3, lMsg0, lMsg1, lMsg2);
+		shaRounds<3>(lAbcd, lE0, lE1, lMsg0, lMsg1, lMsg2, lMsg3);
+		shaRounds<3>(lAbcd, lE1, lE0, lMsg1, lMsg2, lMsg3, lMsg0);
+		shaRounds<3>(lAbcd, lE0, lE1, lMsg2, lMsg3, lMsg0, lMsg1);
+		shaRounds<3>(lAbcd, lE1, lE0, lMsg3, lMsg0, lMsg1, lMsg2);
+
+		lE0 = _mm_sha1nexte_epu32(lE0, lE0Saved);
+		lAbcd = _mm_add_epi32(lAbcd, lAbcdSaved);
+		pData += 64;
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(pState), _mm_shuffle_epi32(lAbcd, 0x1B));
+	pState[4] = static_cast<quint32>(_mm_extract_epi32(lE0, 3));
+}
+
+#endif // SHA1_X86_EXTENSIONS
+
+} // namespace
+
+Sha1::Sha1()
+   : mState{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0}, mLength(0), mBufferUsed(0)
+{}
+
+void Sha1::update(const void *pData, size_t pSize) {
+	auto lData = static_cast<const uchar *>(pData);
+	mLength += pSize;
+	if(mBufferUsed > 0) {
+		size_t lCount = qMin(pSize, sizeof mBuffer - mBufferUsed);
+		memcpy(mBuffer + mBufferUsed, lData, lCount);
+		mBufferUsed += lCount;
+		lData += lCount;
+		pSize -= lCount;
+		if(mBufferUsed < sizeof mBuffer) {
+			return;
+		}
+		processBlocks(mBuffer, 1);
+		mBufferUsed = 0;
+	}
+	// whole blocks straight from the data, no copying
+	processBlocks(lData, pSize / 64);
+	lData += pSize & ~static_cast<size_t>(63);
+	mBufferUsed = pSize & 63;
+	memcpy(mBuffer, lData, mBufferUsed);
+}
+
+void Sha1::final(uchar pDigest[20]) {
+	const quint64 lBitLength = mLength * 8;
+	uchar lPadding[72] = {0x80};
+	size_t lPaddingSize = (mBufferUsed < 56 ? 56 : 120) - mBufferUsed;
+	qToBigEndian<quint64>(lBitLength, lPadding + lPaddingSize);
+	update(lPadding, lPaddingSize + 8);
+	for(int i = 0; i < 5; ++i) {
+		qToBigEndian<quint32>(mState[i], pDigest + 4 * i);
+	}
+}
+
+bool Sha1::hardwareAccelerated() {
+#ifdef SHA1_X86_EXTENSIONS
+	static const bool lHasExtensions = cpuHasShaExtensions();
+	return lHasExtensions;
+#else
+	return false;
+#endif
+}
+
+void Sha1::processBlocks(const uchar *pData, size_t pBlockCount) {
+	if(pBlockCount == 0) {
+		return;
+	}
+#ifdef SHA1_X86_EXTENSIONS
+	if(hardwareAccelerated()) {
+		processBlocksShaExtensions(mState, pData, pBlockCount);
+		return;
+	}
+#endif
+	processBlocksPlain(mState, pData, pBlockCount);
+}
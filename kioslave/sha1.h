@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <QtGlobal>
+
+#include <cstddef>
+
+// SHA-1, for checking git object ids. Uses the SHA extensions of x86
+// processors when the one running has them, a few times faster than the
+// plain version. No collision detection, the ids only need to catch damage.
+class Sha1 {
+public:
+	Sha1();
+	void update(const void *pData, size_t pSize);
+	void final(uchar pDigest[20]);
+	static bool hardwareAccelerated();
+
+protected:
+	void processBlocks(const uchar *pData, size_t pBlockCount);
+
+	quint32 mState[5];
+	quint64 mLength; // in bytes
+	uchar mBuffer[64];
+	size_t mBufferUsed;
+};
+
+#endif // SHA1_H
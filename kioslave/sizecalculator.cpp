@@ -0,0 +1,80 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "sizecalculator.h"
+#include "nodearena.h"
+#include "threadrepository.h"
+#include "vfshelpers.h"
+
+#include <QRunnable>
+#include <QThread>
+
+#include <sys/stat.h>
+
+const int SizeCalculator::cMinimumRecords;
+
+namespace {
+
+class SizeTask: public QRunnable {
+public:
+	SizeTask(const QByteArray &pRepositoryPath, NodeRecord * const *pBegin, NodeRecord * const *pEnd)
+	   : mRepositoryPath(pRepositoryPath), mBegin(pBegin), mEnd(pEnd)
+	{}
+
+	void run() override {
+		git_repository *lRepository = threadRepository(mRepositoryPath);
+		git_odb *lOdb = nullptr;
+		if(lRepository != nullptr) {
+			git_repository_odb(&lOdb, lRepository);
+		}
+		for(NodeRecord * const *lIter = mBegin; lIter != mEnd; ++lIter) {
+			NodeRecord *lRecord = *lIter;
+			lRecord->mSize = 0;
+			if(lOdb == nullptr) {
+				continue;
+			}
+			if(lRecord->isChunked()) {
+				lRecord->mSize = static_cast<qint64>(calculateChunkFileSize(&lRecord->mOid, lRepository));
+			} else {
+				// only the object header is needed, no need to inflate the blob.
+				size_t lSize;
+				git_object_t lType;
+				if(0 == git_odb_read_header(&lSize, &lType, lOdb, &lRecord->mOid)) {
+					lRecord->mSize = static_cast<qint64>(lSize);
+				}
+			}
+		}
+		git_odb_free(lOdb);
+	}
+
+protected:
+	QByteArray mRepositoryPath;
+	NodeRecord * const *mBegin;
+	NodeRecord * const *mEnd;
+};
+
+} // namespace
+
+SizeCalculator::SizeCalculator() {
+	mPool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+}
+
+SizeCalculator::~SizeCalculator() {
+	mPool.waitForDone();
+}
+
+void SizeCalculator::calculate(const QByteArray &pRepositoryPath, const QVector<NodeRecord *> &pRecords) {
+	// a few tasks per thread evens out directories where some files are much bigger than others.
+	const int lTaskCount = qMin(pRecords.count(), mPool.maxThreadCount() * 4);
+	if(lTaskCount == 0) {
+		return;
+	}
+	NodeRecord * const *lRecords = pRecords.constData();
+	for(int i = 0; i < lTaskCount; ++i) {
+		int lBegin = pRecords.count() * i / lTaskCount;
+		int lEnd = pRecords.count() * (i + 1) / lTaskCount;
+		mPool.start(new SizeTask(pRepositoryPath, lRecords + lBegin, lRecords + lEnd));
+	}
+	mPool.waitForDone();
+}
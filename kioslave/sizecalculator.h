@@ -0,0 +1,32 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef SIZECALCULATOR_H
+#define SIZECALCULATOR_H
+
+#include <QByteArray>
+#include <QThreadPool>
+#include <QVector>
+
+struct NodeRecord;
+
+// Works out the sizes of the files in a directory on a pool of threads. For
+// chunked files that means following the chunk tree down to its last blob,
+// which adds up in big directories. Each thread opens its own handle of the
+// repository, libgit2 objects can't be shared between threads.
+class SizeCalculator {
+public:
+	SizeCalculator();
+	~SizeCalculator();
+	// Sets mSize of the records, blocks until all are done.
+	void calculate(const QByteArray &pRepositoryPath, const QVector<NodeRecord *> &pRecords);
+
+	// Fewer records than this are not worth handing out to threads.
+	static const int cMinimumRecords = 16;
+
+protected:
+	QThreadPool mPool;
+};
+
+#endif // SIZECALCULATOR_H
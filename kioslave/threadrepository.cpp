@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "threadrepository.h"
+#include "bupodb.h"
+
+#include <QHash>
+#include <QThreadStorage>
+
+namespace {
+
+struct ThreadRepositories {
+	~ThreadRepositories() {
+		foreach(git_repository *lRepository, mRepositories) {
+			git_repository_free(lRepository);
+		}
+	}
+	QHash<QByteArray, git_repository *> mRepositories;
+};
+
+QThreadStorage<ThreadRepositories *> sThreadRepositories;
+
+} // namespace
+
+git_repository *threadRepository(const QByteArray &pPath) {
+	if(!sThreadRepositories.hasLocalData()) {
+		sThreadRepositories.setLocalData(new ThreadRepositories);
+	}
+	QHash<QByteArray, git_repository *> &lRepositories = sThreadRepositories.localData()->mRepositories;
+	git_repository *lRepository = lRepositories.value(pPath, nullptr);
+	if(lRepository == nullptr && 0 == git_repository_open(&lRepository, pPath)) {
+		addBupOdbBackend(lRepository);
+		lRepositories.insert(pPath, lRepository);
+	}
+	return lRepository;
+}
@@ -0,0 +1,18 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef THREADREPOSITORY_H
+#define THREADREPOSITORY_H
+
+#include <QByteArray>
+
+#include <git2.h>
+
+// A repository handle for use by the calling thread only, libgit2 repositories
+// must not be shared between threads. Opened on first use in each thread,
+// with the bup object lookup added, and freed when the thread exits.
+// Returns nullptr if the repository can not be opened.
+git_repository *threadRepository(const QByteArray &pPath);
+
+#endif // THREADREPOSITORY_H
@@ -0,0 +1,108 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "treetotals.h"
+#include "vfshelpers.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
+#include <sys/stat.h>
+
+// about 50 bytes each, start over rather than grow without bounds.
+static const int cMaxRememberedTrees = 200000;
+
+static QMutex sTotalsMutex;
+static QHash<git_oid, TreeTotals> sTotals;
+
+static bool lookUp(const git_oid *pTree, TreeTotals &pTotals) {
+	QMutexLocker lLocker(&sTotalsMutex);
+	auto lIter = sTotals.constFind(*pTree);
+	if(lIter == sTotals.constEnd()) {
+		return false;
+	}
+	pTotals = lIter.value();
+	return true;
+}
+
+static void remember(const git_oid *pTree, const TreeTotals &pTotals) {
+	QMutexLocker lLocker(&sTotalsMutex);
+	if(sTotals.count() >= cMaxRememberedTrees) {
+		sTotals.clear();
+	}
+	sTotals.insert(*pTree, pTotals);
+}
+
+// size of a file which has no size in its metadata, still without reading content.
+static quint64 entrySize(git_repository *pRepository, const git_tree_entry *pEntry, bool pChunked) {
+	if(pChunked) {
+		return calculateChunkFileSize(git_tree_entry_id(pEntry), pRepository);
+	}
+	git_odb *lOdb;
+	if(0 != git_repository_odb(&lOdb, pRepository)) {
+		return 0;
+	}
+	size_t lSize = 0;
+	git_object_t lType;
+	if(0 != git_odb_read_header(&lSize, &lType, lOdb, git_tree_entry_id(pEntry))) {
+		lSize = 0;
+	}
+	git_odb_free(lOdb);
+	return lSize;
+}
+
+bool TreeTotals::calculate(git_repository *pRepository, const git_oid *pTree, TreeTotals &pTotals) {
+	if(lookUp(pTree, pTotals)) {
+		return true;
+	}
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, pRepository, pTree)) {
+		return false;
+	}
+	QVector<Metadata> lMetadataList;
+	int lMetadataIndex = 1; // the first entry is metadata for the directory itself
+	git_blob *lMetadataBlob;
+	const git_tree_entry *lMetadataEntry = git_tree_entry_byname(lTree, ".bupm");
+	if(lMetadataEntry != nullptr && 0 == git_blob_lookup(&lMetadataBlob, pRepository, git_tree_entry_id(lMetadataEntry))) {
+		readMetadataList(git_blob_rawcontent(lMetadataBlob), static_cast<size_t>(git_blob_rawsize(lMetadataBlob)), lMetadataList);
+		git_blob_free(lMetadataBlob);
+	}
+
+	TreeTotals lTotals;
+	bool lOk = true;
+	ulong lEntryCount = git_tree_entrycount(lTree);
+	for(ulong i = 0; i < lEntryCount && lOk; ++i) {
+		uint lMode;
+		const git_oid *lOid;
+		QString lName;
+		bool lChunked;
+		const git_tree_entry *lTreeEntry = git_tree_entry_byindex(lTree, i);
+		getEntryAttributes(lTreeEntry, lMode, lChunked, lOid, lName);
+		if(lTreeEntry == lMetadataEntry) {
+			continue;
+		}
+		if(S_ISDIR(lMode)) {
+			TreeTotals lSubTotals;
+			lOk = calculate(pRepository, lOid, lSubTotals);
+			lTotals.mSize += lSubTotals.mSize;
+			lTotals.mFileCount += lSubTotals.mFileCount;
+			lTotals.mDirectoryCount += lSubTotals.mDirectoryCount + 1;
+			continue;
+		}
+		qint64 lSize = -1;
+		if(lMetadataIndex < lMetadataList.count()) {
+			lSize = lMetadataList.at(lMetadataIndex++).mSize;
+		}
+		lTotals.mSize += lSize >= 0 ? static_cast<quint64>(lSize) : entrySize(pRepository, lTreeEntry, lChunked);
+		lTotals.mFileCount++;
+	}
+	git_tree_free(lTree);
+	if(lOk) {
+		remember(pTree, lTotals);
+		pTotals = lTotals;
+	}
+	return lOk;
+}
@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef TREETOTALS_H
+#define TREETOTALS_H
+
+#include <QtGlobal>
+
+#include <git2.h>
+
+// Size of all files in a tree and its sub trees, and how many files and
+// folders there are. Added up from the sizes in the .bupm metadata, file
+// content is never read. Results are remembered per tree id, the same sub
+// trees show up again in save after save.
+struct TreeTotals {
+	quint64 mSize = 0;
+	quint64 mFileCount = 0;
+	quint64 mDirectoryCount = 0; // not counting the tree itself
+
+	static bool calculate(git_repository *pRepository, const git_oid *pTree, TreeTotals &pTotals);
+};
+
+#endif // TREETOTALS_H
@@ -4,9 +4,16 @@
 
 #include "vfshelpers.h"
 
-#include <QBuffer>
 #include <QByteArray>
 #include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <cstring>
 
 #include <unistd.h>
 #include <sys/stat.h>
@@ -23,66 +30,6 @@ static const int cRecordSymlinkTarget = 3;
 static const int cRecordCommonV2 = 9; // times, user, group, type, perms, etc.
 static const int cRecordCommonV3 = 10; // times, user, group, type, perms, etc.
 
-VintStream::VintStream(const void *pData, int pSize, QObject *pParent)
-   : QObject(pParent)
-{
-	mByteArray = QByteArray::fromRawData(static_cast<const char *>(pData), pSize);
-	mBuffer = new QBuffer(&mByteArray, this);
-	mBuffer->open(QIODevice::ReadOnly);
-}
-
-VintStream &VintStream::operator>>(qint64 &pInt) {
-	char c;
-	if(!mBuffer->getChar(&c)) {
-		throw 1;
-	}
-	int lOffset = 6;
-	bool lNegative = (c & 0x40);
-	pInt = c & 0x3F;
-	while(c & 0x80) {
-		if(!mBuffer->getChar(&c)) {
-			throw 1;
-		}
-		pInt |= (c & 0x7F) << lOffset;
-		lOffset += 7;
-	}
-	if(lNegative) {
-		pInt = -pInt;
-	}
-	return *this;
-}
-
-VintStream &VintStream::operator >>(quint64 &pUint) {
-	char c;
-	int lOffset = 0;
-	pUint = 0;
-	do {
-		if(!mBuffer->getChar(&c)) {
-			throw 1;
-		}
-		pUint |= static_cast<quint64>((c & 0x7F) << lOffset);
-		lOffset += 7;
-	} while(c & 0x80);
-	return *this;
-}
-
-VintStream &VintStream::operator >>(QString &pString) {
-	QByteArray lBytes;
-	*this >> lBytes;
-	pString = QString::fromUtf8(lBytes);
-	return *this;
-}
-
-VintStream &VintStream::operator >>(QByteArray &pByteArray) {
-	quint64 lByteCount;
-	*this >> lByteCount;
-	pByteArray.resize(static_cast<int>(lByteCount));
-	if(mBuffer->read(pByteArray.data(), pByteArray.length()) < pByteArray.length()) {
-		throw 1;
-	}
-	return *this;
-}
-
 qint64 Metadata::mDefaultUid;
 qint64 Metadata::mDefaultGid;
 bool Metadata::mDefaultsResolved = false;
@@ -102,73 +49,85 @@ Metadata::Metadata(qint64 pMode) {
 }
 
 int readMetadata(VintStream &pMetadataStream, Metadata &pMetadata) {
-	try {
-		quint64 lTag;
-		do {
-			pMetadataStream >> lTag;
-			switch(lTag) {
-			case cRecordCommonV1: {
-				qint64 lNotUsedInt;
-				quint64 lNotUsedUint, lTempUint;
-				QString lNotUsedString;
-				pMetadataStream >> lNotUsedUint >> lTempUint;
-				pMetadata.mMode = static_cast<qint64>(lTempUint);
-				pMetadataStream >> lTempUint >> lNotUsedString; // user name
-				pMetadata.mUid = static_cast<qint64>(lTempUint);
-				pMetadataStream >> lTempUint >> lNotUsedString; // group name
-				pMetadata.mGid = static_cast<qint64>(lTempUint);
-				pMetadataStream >> lNotUsedUint; // device number
-				pMetadataStream >> pMetadata.mAtime >> lNotUsedUint; //nanoseconds
-				pMetadataStream >> pMetadata.mMtime >> lNotUsedUint; // nanoseconds
-				pMetadataStream >> lNotUsedInt >> lNotUsedUint; // status change time
-				break;
-			}
-			case cRecordCommonV2: {
-				qint64 lNotUsedInt;
-				quint64 lNotUsedUint;
-				QString lNotUsedString;
-				pMetadataStream >> lNotUsedUint >> pMetadata.mMode;
-				pMetadataStream >> pMetadata.mUid >> lNotUsedString; // user name
-				pMetadataStream >> pMetadata.mGid >> lNotUsedString; // group name
-				pMetadataStream >> lNotUsedInt; // device number
-				pMetadataStream >> pMetadata.mAtime >> lNotUsedUint; //nanoseconds
-				pMetadataStream >> pMetadata.mMtime >> lNotUsedUint; // nanoseconds
-				pMetadataStream >> lNotUsedInt >> lNotUsedUint; // status change time
-				break;
-			}
-			case cRecordCommonV3: {
-				qint64 lNotUsedInt;
-				quint64 lNotUsedUint;
-				QString lNotUsedString;
-				pMetadataStream >> lNotUsedUint >> pMetadata.mMode;
-				pMetadataStream >> pMetadata.mUid >> lNotUsedString; // user name
-				pMetadataStream >> pMetadata.mGid >> lNotUsedString; // group name
-				pMetadataStream >> lNotUsedInt; // device number
-				pMetadataStream >> pMetadata.mAtime >> lNotUsedUint; //nanoseconds
-				pMetadataStream >> pMetadata.mMtime >> lNotUsedUint; // nanoseconds
-				pMetadataStream >> lNotUsedInt >> lNotUsedUint; // status change time
-				pMetadataStream >> pMetadata.mSize;
-				break;
-			}
-			case cRecordSymlinkTarget: {
-				pMetadataStream >> pMetadata.mSymlinkTarget;
-				break;
-			}
-			default: {
-				if(lTag != cRecordEnd) {
-					QByteArray lNotUsed;
-					pMetadataStream >> lNotUsed;
-				}
-				break;
+	quint64 lTag;
+	while(pMetadataStream.readVuint(lTag)) {
+		if(lTag == cRecordEnd) {
+			return 0; // success
+		}
+		// every record is a byte vector, fields at the end that are not used are simply skipped.
+		const char *lData;
+		size_t lSize;
+		if(!pMetadataStream.readBytes(lData, lSize)) {
+			return 1;
+		}
+		VintStream lRecord(lData, lSize);
+		bool lOk = true;
+		switch(lTag) {
+		case cRecordCommonV1: {
+			quint64 lMode, lUid, lGid;
+			lOk = lRecord.readVuint(lMode) &&
+			      lRecord.readVuint(lUid) && lRecord.skipBytes() && // user name
+			      lRecord.readVuint(lGid) && lRecord.skipBytes() && // group name
+			      lRecord.skipVint() && // device number
+			      lRecord.readVint(pMetadata.mAtime) && lRecord.skipVint() && // nanoseconds
+			      lRecord.readVint(pMetadata.mMtime); // status change time is not used
+			if(lOk) {
+				pMetadata.mMode = static_cast<qint64>(lMode);
+				pMetadata.mUid = static_cast<qint64>(lUid);
+				pMetadata.mGid = static_cast<qint64>(lGid);
 			}
+			break;
+		}
+		case cRecordCommonV2:
+		case cRecordCommonV3: {
+			lOk = lRecord.readVint(pMetadata.mMode) &&
+			      lRecord.readVint(pMetadata.mUid) && lRecord.skipBytes() && // user name
+			      lRecord.readVint(pMetadata.mGid) && lRecord.skipBytes() && // group name
+			      lRecord.skipVint() && // device number
+			      lRecord.readVint(pMetadata.mAtime) && lRecord.skipVint() && // nanoseconds
+			      lRecord.readVint(pMetadata.mMtime) && lRecord.skipVint(); // nanoseconds
+			if(lOk && lTag == cRecordCommonV3) {
+				lOk = lRecord.skipVint() && lRecord.skipVint() && // status change time
+				      lRecord.readVint(pMetadata.mSize);
 			}
-		} while(lTag != cRecordEnd);
-	} catch(int) {
-		return 1;
+			break;
+		}
+		case cRecordSymlinkTarget:
+			pMetadata.mSymlinkTarget = QString::fromUtf8(lData, static_cast<int>(lSize));
+			break;
+		default:
+			break;
+		}
+		if(!lOk) {
+			return 1;
+		}
+	}
+	return 1;
+}
+
+int readMetadataList(const void *pData, size_t pSize, QVector<Metadata> &pMetadataList) {
+	VintStream lStream(pData, pSize);
+	pMetadataList.resize(0);
+	while(!lStream.atEnd()) {
+		pMetadataList.append(Metadata(0));
+		if(0 != readMetadata(lStream, pMetadataList.last())) {
+			pMetadataList.removeLast();
+			return 1;
+		}
 	}
 	return 0; // success
 }
 
+bool readBlob(git_repository *pRepository, const git_oid *pOid, QByteArray &pData) {
+	git_blob *lBlob;
+	if(0 != git_blob_lookup(&lBlob, pRepository, pOid)) {
+		return false;
+	}
+	pData = QByteArray(static_cast<const char *>(git_blob_rawcontent(lBlob)), static_cast<int>(git_blob_rawsize(lBlob)));
+	git_blob_free(lBlob);
+	return true;
+}
+
 quint64 calculateChunkFileSize(const git_oid *pOid, git_repository *pRepository) {
 	quint64 lLastChunkOffset = 0;
 	quint64 lLastChunkSize = 0;
@@ -191,19 +150,50 @@ quint64 calculateChunkFileSize(const git_oid *pOid, git_repository *pRepository)
 		git_tree_free(lTree);
 	} while(S_ISDIR(lMode));
 
-	git_blob *lBlob;
-	if(0 != git_blob_lookup(&lBlob, pRepository, pOid)) {
+	// only the header is needed, no reason to inflate the last chunk.
+	git_odb *lOdb;
+	if(0 != git_repository_odb(&lOdb, pRepository)) {
 		return 0;
 	}
-	lLastChunkSize = static_cast<quint64>(git_blob_rawsize(lBlob));
-	git_blob_free(lBlob);
+	size_t lSize;
+	git_object_t lType;
+	int lResult = git_odb_read_header(&lSize, &lType, lOdb, pOid);
+	git_odb_free(lOdb);
+	if(lResult != 0) {
+		return 0;
+	}
+	lLastChunkSize = lSize;
 	return lLastChunkOffset + lLastChunkSize;
 }
 
 bool offsetFromName(const git_tree_entry *pEntry, quint64 &pUint) {
-	bool lParsedOk;
-	pUint = QString::fromUtf8(git_tree_entry_name(pEntry)).toULongLong(&lParsedOk, 16);
-	return lParsedOk;
+	// hex digits only, parsed in place since this runs for every step of a chunk tree search
+	const char *lName = git_tree_entry_name(pEntry);
+	pUint = 0;
+	if(*lName == 0) {
+		return false;
+	}
+	int lDigits = 0;
+	for(; *lName != 0; ++lName) {
+		char c = *lName;
+		quint64 lValue;
+		if(c >= '0' && c <= '9') {
+			lValue = static_cast<quint64>(c - '0');
+		} else if(c >= 'a' && c <= 'f') {
+			lValue = static_cast<quint64>(c - 'a' + 10);
+		} else if(c >= 'A' && c <= 'F') {
+			lValue = static_cast<quint64>(c - 'A' + 10);
+		} else {
+			return false;
+		}
+		if(lValue != 0 || lDigits > 0) {
+			if(++lDigits > 16) {
+				return false;
+			}
+		}
+		pUint = (pUint << 4) | lValue;
+	}
+	return true;
 }
 
 
@@ -222,6 +212,45 @@ void getEntryAttributes(const git_tree_entry *pTreeEntry, uint &pMode, bool &pCh
 }
 
 
+uint qHash(git_oid pOid) {
+	return qHash(QByteArray::fromRawData(reinterpret_cast<const char *>(pOid.id), GIT_OID_RAWSZ));
+}
+
+bool operator ==(const git_oid &pOidA, const git_oid &pOidB) {
+	QByteArray a = QByteArray::fromRawData(reinterpret_cast<const char *>(pOidA.id), GIT_OID_RAWSZ);
+	QByteArray b = QByteArray::fromRawData(reinterpret_cast<const char *>(pOidB.id), GIT_OID_RAWSZ);
+	return a == b;
+}
+
+QString repositoryCachePath(git_repository *pRepository) {
+	return QString::fromLocal8Bit(git_repository_path(pRepository)) + QStringLiteral("kup-cache");
+}
+
+bool CacheFile::mWritable = true;
+
+QByteArray CacheFile::load(const QString &pPath, const char *pMagic, quint32 pVersion) {
+	QFile lFile(pPath);
+	if(!lFile.open(QIODevice::ReadOnly)) {
+		return QByteArray();
+	}
+	const QByteArray lData = lFile.readAll();
+	if(lData.size() < cHeaderSize || 0 != memcmp(lData.constData(), pMagic, 8) ||
+	      qFromLittleEndian<quint32>(lData.constData() + 8) != pVersion) {
+		return QByteArray();
+	}
+	return lData;
+}
+
+bool CacheFile::save(const QString &pPath, const char *pMagic, quint32 pVersion, QByteArray &pData) {
+	memcpy(pData.data(), pMagic, 8);
+	qToLittleEndian<quint32>(pVersion, pData.data() + 8);
+	if(!mWritable || !QDir().mkpath(QFileInfo(pPath).absolutePath())) {
+		return false;
+	}
+	QSaveFile lFile(pPath);
+	return lFile.open(QIODevice::WriteOnly) && lFile.write(pData) == pData.size() && lFile.commit();
+}
+
 QString vfsTimeToString(git_time_t pTime) {
 	QDateTime lDateTime;
 	lDateTime.setSecsSinceEpoch(pTime);
@@ -7,27 +7,93 @@
 
 #include <QObject>
 #include <QString>
-class QBuffer;
+#include <QVector>
 
 #include <git2.h>
+uint qHash(git_oid pOid);
+bool operator ==(const git_oid &pOidA, const git_oid &pOidB);
 
 #define DEFAULT_MODE_DIRECTORY 0040755
 #define DEFAULT_MODE_FILE 0100644
 
-class VintStream: public QObject {
-	Q_OBJECT
-
+// Decodes bup's vint, vuint and bvec encoding straight from a buffer, nothing
+// is copied. The read functions return false when running past the end.
+class VintStream {
 public:
-	VintStream(const void *pData, int pSize, QObject *pParent);
+	VintStream(const void *pData, size_t pSize)
+	   : mPosition(static_cast<const uchar *>(pData)), mEnd(mPosition + pSize)
+	{}
+
+	bool readVuint(quint64 &pUint) {
+		pUint = 0;
+		int lShift = 0;
+		uchar c;
+		do {
+			if(mPosition == mEnd || lShift > 63) {
+				return false;
+			}
+			c = *mPosition++;
+			pUint |= static_cast<quint64>(c & 0x7F) << lShift;
+			lShift += 7;
+		} while(c & 0x80);
+		return true;
+	}
+
+	bool readVint(qint64 &pInt) {
+		if(mPosition == mEnd) {
+			return false;
+		}
+		uchar c = *mPosition++;
+		bool lNegative = c & 0x40;
+		quint64 lValue = c & 0x3F;
+		int lShift = 6;
+		while(c & 0x80) {
+			if(mPosition == mEnd || lShift > 63) {
+				return false;
+			}
+			c = *mPosition++;
+			lValue |= static_cast<quint64>(c & 0x7F) << lShift;
+			lShift += 7;
+		}
+		pInt = lNegative ? -static_cast<qint64>(lValue) : static_cast<qint64>(lValue);
+		return true;
+	}
+
+	// works for both vint and vuint
+	bool skipVint() {
+		do {
+			if(mPosition == mEnd) {
+				return false;
+			}
+		} while(*mPosition++ & 0x80);
+		return true;
+	}
+
+	// pData points into the buffer given to the constructor.
+	bool readBytes(const char *&pData, size_t &pSize) {
+		quint64 lSize;
+		if(!readVuint(lSize) || lSize > static_cast<quint64>(mEnd - mPosition)) {
+			return false;
+		}
+		pData = reinterpret_cast<const char *>(mPosition);
+		pSize = static_cast<size_t>(lSize);
+		mPosition += lSize;
+		return true;
+	}
 
-	VintStream &operator>>(qint64 &pInt);
-	VintStream &operator>>(quint64 &pUint);
-	VintStream &operator>>(QString &pString);
-	VintStream &operator>>(QByteArray &pByteArray);
+	bool skipBytes() {
+		const char *lData;
+		size_t lSize;
+		return readBytes(lData, lSize);
+	}
+
+	bool atEnd() const {
+		return mPosition == mEnd;
+	}
 
 protected:
-	QByteArray mByteArray;
-	QBuffer *mBuffer;
+	const uchar *mPosition;
+	const uchar *mEnd;
 };
 
 struct Metadata {
@@ -47,9 +113,32 @@ struct Metadata {
 };
 
 int readMetadata(VintStream &pMetadataStream, Metadata &pMetadata);
+// Decodes all entries of a .bupm blob in one pass. The first entry is for the
+// directory itself, then there is one for each entry which is not a
+// directory. mMode is left at 0 for entries that had no common record.
+int readMetadataList(const void *pData, size_t pSize, QVector<Metadata> &pMetadataList);
+bool readBlob(git_repository *pRepository, const git_oid *pOid, QByteArray &pData);
 quint64 calculateChunkFileSize(const git_oid *pOid, git_repository *pRepository);
 bool offsetFromName(const git_tree_entry *pEntry, quint64 &pUint);
 void getEntryAttributes(const git_tree_entry *pTreeEntry, uint &pMode, bool &pChunked, const git_oid *&pOid, QString &pName);
 QString vfsTimeToString(git_time_t pTime);
+// Where kup keeps files derived from the repository, like indexes. Inside the
+// repository itself so they follow it around, no trailing slash.
+QString repositoryCachePath(git_repository *pRepository);
+
+// Files in repositoryCachePath(). Each starts with an 8 character magic and a
+// little endian format version, files with any other are not used.
+class CacheFile {
+public:
+	// The whole file, or nothing if it can not be read or is of another format.
+	static QByteArray load(const QString &pPath, const char *pMagic, quint32 pVersion);
+	// The first cHeaderSize bytes of pData are filled in with the header here,
+	// also if saving fails. That is normal, the repository may not be writable.
+	static bool save(const QString &pPath, const char *pMagic, quint32 pVersion, QByteArray &pData);
+
+	static const int cHeaderSize = 12;
+	// Off in processes that must leave the repository as it is, nothing is saved then.
+	static bool mWritable;
+};
 
 #endif // VFSHELPERS_H
@@ -0,0 +1,271 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "bupmount.h"
+#include "blobcache.h"
+#include "bupvfs.h"
+#include "chunkindex.h"
+#include "chunkwalker.h"
+#include "threadrepository.h"
+
+#include <QFile>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Same default as the kioslave, for the folders browsed through the mount.
+static const quint64 cNodeCacheBudget = 256 * 1024 * 1024;
+
+namespace {
+
+BupMount *mount() {
+	return static_cast<BupMount *>(fuse_get_context()->private_data);
+}
+
+int mountGetAttributes(const char *pPath, struct stat *pStat, fuse_file_info *pInfo) {
+	Q_UNUSED(pInfo)
+	return mount()->getAttributes(pPath, pStat);
+}
+
+int mountReadLink(const char *pPath, char *pBuffer, size_t pSize) {
+	return mount()->readLink(pPath, pBuffer, pSize);
+}
+
+int mountReadDirectory(const char *pPath, void *pBuffer, fuse_fill_dir_t pFiller, off_t pOffset,
+                       fuse_file_info *pInfo, fuse_readdir_flags pFlags) {
+	Q_UNUSED(pOffset)
+	Q_UNUSED(pInfo)
+	Q_UNUSED(pFlags)
+	return mount()->readDirectory(pPath, pBuffer, pFiller);
+}
+
+int mountOpen(const char *pPath, fuse_file_info *pInfo) {
+	if((pInfo->flags & O_ACCMODE) != O_RDONLY) {
+		return -EROFS;
+	}
+	return mount()->openFile(pPath, pInfo);
+}
+
+int mountRead(const char *pPath, char *pBuffer, size_t pSize, off_t pOffset, fuse_file_info *pInfo) {
+	Q_UNUSED(pPath)
+	return mount()->readFile(reinterpret_cast<BupMount::OpenFile *>(pInfo->fh), pBuffer, pSize, pOffset);
+}
+
+int mountRelease(const char *pPath, fuse_file_info *pInfo) {
+	Q_UNUSED(pPath)
+	delete reinterpret_cast<BupMount::OpenFile *>(pInfo->fh);
+	return 0;
+}
+
+void fillStat(struct stat *pStat, const Metadata &pMetadata, quint64 pSize) {
+	memset(pStat, 0, sizeof(struct stat));
+	pStat->st_mode = static_cast<mode_t>(pMetadata.mMode);
+	pStat->st_nlink = S_ISDIR(pMetadata.mMode) ? 2 : 1;
+	pStat->st_uid = static_cast<uid_t>(pMetadata.mUid);
+	pStat->st_gid = static_cast<gid_t>(pMetadata.mGid);
+	pStat->st_size = static_cast<off_t>(pSize);
+	pStat->st_blksize = 64 * 1024;
+	pStat->st_blocks = static_cast<blkcnt_t>((pSize + 511) / 512);
+	pStat->st_atime = static_cast<time_t>(pMetadata.mAtime);
+	pStat->st_mtime = static_cast<time_t>(pMetadata.mMtime);
+	pStat->st_ctime = static_cast<time_t>(pMetadata.mMtime);
+}
+
+} // namespace
+
+BupMount::BupMount(const QString &pRepositoryPath)
+   : mNodeThreadContext(new QObject), mRepository(nullptr), mRepositoryPath(QFile::encodeName(pRepositoryPath))
+{
+	mNodeThreadContext->moveToThread(&mNodeThread);
+	mNodeThread.start();
+	runOnNodeThread([this, pRepositoryPath] {
+		mRepository = new Repository(nullptr, pRepositoryPath, cNodeCacheBudget);
+		if(!mRepository->isValid()) {
+			delete mRepository;
+			mRepository = nullptr;
+		}
+	});
+}
+
+BupMount::~BupMount() {
+	runOnNodeThread([this] {
+		delete mRepository;
+	});
+	mNodeThread.quit();
+	mNodeThread.wait();
+	delete mNodeThreadContext;
+}
+
+const fuse_operations *BupMount::operations() {
+	static fuse_operations lOperations;
+	lOperations.getattr = mountGetAttributes;
+	lOperations.readlink = mountReadLink;
+	lOperations.readdir = mountReadDirectory;
+	lOperations.open = mountOpen;
+	lOperations.read = mountRead;
+	lOperations.release = mountRelease;
+	return &lOperations;
+}
+
+int BupMount::getAttributes(const char *pPath, struct stat *pStat) {
+	int lResult = 0;
+	runOnNodeThread([&] {
+		Node *lNode = resolve(pPath);
+		if(lNode == nullptr) {
+			lResult = -ENOENT;
+			return;
+		}
+		lNode->loadMetadata();
+		quint64 lSize = static_cast<quint64>(lNode->mSymlinkTarget.toUtf8().size());
+		auto lFile = qobject_cast<File *>(lNode);
+		if(lFile != nullptr && lNode->mSymlinkTarget.isEmpty()) {
+			lSize = lFile->size();
+		}
+		fillStat(pStat, *lNode, lSize);
+	});
+	return lResult;
+}
+
+int BupMount::readLink(const char *pPath, char *pBuffer, size_t pSize) {
+	int lResult = 0;
+	runOnNodeThread([&] {
+		Node *lNode = resolve(pPath);
+		if(lNode == nullptr) {
+			lResult = -ENOENT;
+		} else if(lNode->mSymlinkTarget.isEmpty()) {
+			lResult = -EINVAL;
+		} else if(pSize > 0) {
+			qstrncpy(pBuffer, lNode->mSymlinkTarget.toUtf8().constData(), static_cast<uint>(pSize));
+		}
+	});
+	return lResult;
+}
+
+int BupMount::readDirectory(const char *pPath, void *pBuffer, fuse_fill_dir_t pFiller) {
+	int lResult = 0;
+	runOnNodeThread([&] {
+		auto lDirectory = qobject_cast<Directory *>(resolve(pPath));
+		if(lDirectory == nullptr) {
+			lResult = -ENOTDIR;
+			return;
+		}
+		pFiller(pBuffer, ".", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+		pFiller(pBuffer, "..", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+		struct stat lStat;
+		memset(&lStat, 0, sizeof lStat);
+		auto lArchivedDirectory = qobject_cast<ArchivedDirectory *>(lDirectory);
+		if(lArchivedDirectory != nullptr) {
+			// straight from the records, without creating nodes for every entry
+			NodeRange lChildren = lArchivedDirectory->children();
+			for(quint32 i = lChildren.mFirst; i < lChildren.mFirst + lChildren.mCount; ++i) {
+				const NodeRecord &lRecord = lArchivedDirectory->record(i);
+				lStat.st_mode = static_cast<mode_t>(lRecord.mMode);
+				pFiller(pBuffer, QFile::encodeName(lArchivedDirectory->string(lRecord.mName)).constData(),
+				        &lStat, 0, static_cast<fuse_fill_dir_flags>(0));
+			}
+		} else {
+			// new saves show up in branches, without remounting
+			lDirectory->reload();
+			foreach(Node *lNode, lDirectory->subNodes()) {
+				lStat.st_mode = static_cast<mode_t>(lNode->mMode);
+				pFiller(pBuffer, QFile::encodeName(lNode->objectName()).constData(), &lStat, 0,
+				        static_cast<fuse_fill_dir_flags>(0));
+			}
+		}
+		mRepository->trimNodeCache(lDirectory);
+	});
+	return lResult;
+}
+
+int BupMount::openFile(const char *pPath, fuse_file_info *pInfo) {
+	int lResult = 0;
+	runOnNodeThread([&] {
+		Node *lNode = resolve(pPath);
+		if(lNode == nullptr) {
+			lResult = -ENOENT;
+			return;
+		}
+		auto lOpenFile = new OpenFile;
+		auto lChunkFile = qobject_cast<ChunkFile *>(lNode);
+		auto lBlobFile = qobject_cast<BlobFile *>(lNode);
+		if(lChunkFile != nullptr) {
+			lOpenFile->mOid = *lChunkFile->oid();
+			lOpenFile->mChunked = true;
+			lOpenFile->mSize = lChunkFile->size();
+		} else if(lBlobFile != nullptr) {
+			lOpenFile->mOid = *lBlobFile->oid();
+			lOpenFile->mChunked = false;
+			lOpenFile->mSize = lBlobFile->size();
+		} else {
+			delete lOpenFile;
+			lResult = -EISDIR;
+			return;
+		}
+		pInfo->fh = reinterpret_cast<uint64_t>(lOpenFile);
+	});
+	// content never changes, whatever the kernel has cached is still good.
+	pInfo->keep_cache = 1;
+	return lResult;
+}
+
+int BupMount::readFile(OpenFile *pFile, char *pBuffer, size_t pSize, off_t pOffset) {
+	auto lOffset = static_cast<quint64>(pOffset);
+	if(lOffset >= pFile->mSize) {
+		return 0;
+	}
+	pSize = static_cast<size_t>(qMin<quint64>(pSize, pFile->mSize - lOffset));
+	git_repository *lRepository = threadRepository(mRepositoryPath);
+	if(lRepository == nullptr) {
+		return -EIO;
+	}
+	QByteArray lData;
+	if(!pFile->mChunked) {
+		if(!BlobCache::read(lRepository, &pFile->mOid, lData) || lOffset >= static_cast<quint64>(lData.size())) {
+			return -EIO;
+		}
+		pSize = qMin<size_t>(pSize, static_cast<size_t>(lData.size()) - lOffset);
+		memcpy(pBuffer, lData.constData() + lOffset, pSize);
+		return static_cast<int>(pSize);
+	}
+
+	// No walker is kept between reads, they can come in any order and from
+	// any thread. Reading on from where the last read ended only walks down
+	// the chunk tree, the index is built once the file is read out of order.
+	const bool lSequential = lOffset == pFile->mNextOffset.load();
+	QSharedPointer<const ChunkIndex> lIndex = ChunkIndex::find(lRepository, &pFile->mOid, !lSequential);
+	ChunkWalker lWalker(lRepository, &pFile->mOid, lIndex);
+	quint64 lStart;
+	if(!lWalker.seek(lOffset, lStart)) {
+		return -EIO;
+	}
+	size_t lDone = 0;
+	while(lDone < pSize && lWalker.currentBlob() != nullptr) {
+		if(!BlobCache::read(lRepository, lWalker.currentBlob(), lData) || lStart >= static_cast<quint64>(lData.size())) {
+			break;
+		}
+		size_t lCount = qMin<size_t>(pSize - lDone, static_cast<size_t>(lData.size()) - lStart);
+		memcpy(pBuffer + lDone, lData.constData() + lStart, lCount);
+		lDone += lCount;
+		lStart = 0;
+		if(!lWalker.next()) {
+			break;
+		}
+	}
+	pFile->mNextOffset.store(lOffset + lDone);
+	return lDone > 0 ? static_cast<int>(lDone) : -EIO;
+}
+
+void BupMount::runOnNodeThread(const std::function<void()> &pFunction) {
+	if(QThread::currentThread() == &mNodeThread) {
+		pFunction();
+	} else {
+		QMetaObject::invokeMethod(mNodeThreadContext, pFunction, Qt::BlockingQueuedConnection);
+	}
+}
+
+Node *BupMount::resolve(const char *pPath) {
+	return mRepository->resolve(QFile::decodeName(pPath).split(QLatin1Char('/'), QString::SkipEmptyParts));
+}
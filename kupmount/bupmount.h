@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#ifndef BUPMOUNT_H
+#define BUPMOUNT_H
+
+#define FUSE_USE_VERSION 31
+#include <fuse.h>
+
+#include <QObject>
+#include <QThread>
+
+#include <atomic>
+#include <functional>
+
+#include <git2.h>
+
+class Node;
+class Repository;
+
+// Serves a bup repository over FUSE, laid out like the bup kioslave shows
+// it: branches, then one folder per commit.
+//
+// The node tree is not thread safe and its nodes are QObjects, so everything
+// that touches nodes runs on one thread of its own. Reading file content
+// does not need the nodes: an open file is only an object id, and reads are
+// served straight from the object database in whichever FUSE thread asked,
+// each of them with its own handle to the repository.
+class BupMount: public QObject {
+	Q_OBJECT
+public:
+	explicit BupMount(const QString &pRepositoryPath);
+	~BupMount() override;
+	bool isValid() {
+		return mRepository != nullptr;
+	}
+
+	// init is left for main(), it has to hand over the mount as private data.
+	static const fuse_operations *operations();
+
+	// What fuse_file_info::fh points to.
+	struct OpenFile {
+		git_oid mOid;
+		bool mChunked;
+		quint64 mSize;
+		std::atomic<quint64> mNextOffset{0}; // where a sequential read would go on
+	};
+
+	// These return 0 or a negative errno, like FUSE wants.
+	int getAttributes(const char *pPath, struct stat *pStat);
+	int readLink(const char *pPath, char *pBuffer, size_t pSize);
+	int readDirectory(const char *pPath, void *pBuffer, fuse_fill_dir_t pFiller);
+	int openFile(const char *pPath, fuse_file_info *pInfo);
+	// returns the number of bytes read
+	int readFile(OpenFile *pFile, char *pBuffer, size_t pSize, off_t pOffset);
+
+protected:
+	// runs pFunction on the node thread and waits for it to finish
+	void runOnNodeThread(const std::function<void()> &pFunction);
+	Node *resolve(const char *pPath);
+
+	QThread mNodeThread;
+	QObject *mNodeThreadContext;
+	Repository *mRepository; // lives in the node thread
+	QByteArray mRepositoryPath;
+};
+
+#endif // BUPMOUNT_H
@@ -0,0 +1,100 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "bupmount.h"
+#include "vfshelpers.h"
+
+#include <git2/global.h>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+
+#include <cstdio>
+#include <cstdlib>
+
+// Used unless given otherwise on the command line. Nothing in a repository
+// ever changes, so the kernel may keep attributes and file content around for
+// long. New saves only add new names, lookups that failed are not cached.
+static const char cDefaultOptions[] = "-oro,kernel_cache,entry_timeout=86400,attr_timeout=86400,negative_timeout=0,subtype=bup";
+
+struct MountOptions {
+	QString mRepositoryPath;
+};
+
+static int parseArgument(void *pData, const char *pArgument, int pKey, fuse_args *pArgs) {
+	Q_UNUSED(pArgs)
+	auto lOptions = static_cast<MountOptions *>(pData);
+	if(pKey == FUSE_OPT_KEY_NONOPT && lOptions->mRepositoryPath.isEmpty()) {
+		lOptions->mRepositoryPath = QDir(QFile::decodeName(pArgument)).absolutePath();
+		return 0; // the mount point is left for fuse
+	}
+	return 1;
+}
+
+static void *initMount(fuse_conn_info *pConnection, fuse_config *pConfig) {
+	Q_UNUSED(pConnection)
+	Q_UNUSED(pConfig)
+	// the mount is created after fuse_new(), this is where fuse gets to see it.
+	return *static_cast<BupMount **>(fuse_get_context()->private_data);
+}
+
+int main(int pArgCount, char **pArgArray) {
+	fuse_args lArgs = FUSE_ARGS_INIT(pArgCount, pArgArray);
+	MountOptions lOptions;
+	fuse_cmdline_opts lCommandLine{};
+	if(0 != fuse_opt_parse(&lArgs, &lOptions, nullptr, parseArgument) ||
+	      0 != fuse_opt_insert_arg(&lArgs, 1, cDefaultOptions) ||
+	      0 != fuse_parse_cmdline(&lArgs, &lCommandLine)) {
+		return 1;
+	}
+	if(lCommandLine.show_help || lOptions.mRepositoryPath.isEmpty() || lCommandLine.mountpoint == nullptr) {
+		printf("Usage: %s <repository path> <mount point> [options]\n\n", pArgArray[0]);
+		fuse_cmdline_help();
+		fuse_lib_help(&lArgs);
+		free(lCommandLine.mountpoint);
+		fuse_opt_free_args(&lArgs);
+		return lCommandLine.show_help ? 0 : 1;
+	}
+
+	// This needs to be called first thing, before any other calls to libgit2.
+	git_libgit2_init();
+	// The mount is read-only, the indexes that speed up later reads are not
+	// saved in the repository either.
+	CacheFile::mWritable = false;
+	int lResult = 1;
+	git_repository *lRepository;
+	if(0 != git_repository_open(&lRepository, QFile::encodeName(lOptions.mRepositoryPath).constData())) {
+		fprintf(stderr, "%s is not a bup repository\n", qPrintable(lOptions.mRepositoryPath));
+	} else {
+		git_repository_free(lRepository);
+		fuse_operations lOperations = *BupMount::operations();
+		lOperations.init = initMount;
+		BupMount *lMount = nullptr;
+		fuse *lFuse = fuse_new(&lArgs, &lOperations, sizeof(lOperations), &lMount);
+		if(lFuse != nullptr && 0 == fuse_mount(lFuse, lCommandLine.mountpoint)) {
+			// Going to the background forks, no threads may be started before this.
+			if(0 == fuse_daemonize(lCommandLine.foreground)) {
+				QCoreApplication lApp(pArgCount, pArgArray);
+				lMount = new BupMount(lOptions.mRepositoryPath);
+				fuse_session *lSession = fuse_get_session(lFuse);
+				if(lMount->isValid() && 0 == fuse_set_signal_handlers(lSession)) {
+					lResult = lCommandLine.singlethread ? fuse_loop(lFuse) : fuse_loop_mt(lFuse, lCommandLine.clone_fd);
+					fuse_remove_signal_handlers(lSession);
+				}
+				fuse_unmount(lFuse);
+				delete lMount;
+			} else {
+				fuse_unmount(lFuse);
+			}
+		}
+		if(lFuse != nullptr) {
+			fuse_destroy(lFuse);
+		}
+	}
+	git_libgit2_shutdown();
+	free(lCommandLine.mountpoint);
+	fuse_opt_free_args(&lArgs);
+	return lResult == 0 ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+// SPDX-FileCopyrightText: 2020 Simon Persson <simon.persson@mykolab.com>
+//
+// SPDX-License-Identifier: GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+
+#include "bupodb.h"
+#include "commitindex.h"
+#include "contentsearch.h"
+#include "filenameindex.h"
+#include "mergedhistory.h"
+
+#include <git2/global.h>
+
+#include <KLocalizedString>
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+
+#include <limits>
+
+static qint64 parseDate(const QString &pDate, bool pEndOfDay) {
+	QDate lDate = QDate::fromString(pDate, Qt::ISODate);
+	if(!lDate.isValid()) {
+		return 0;
+	}
+	if(pEndOfDay) {
+		return QDateTime(lDate.addDays(1)).toSecsSinceEpoch() - 1;
+	}
+	return QDateTime(lDate).toSecsSinceEpoch();
+}
+
+// Brings the filename index of the branch up to date, then prints the matching
+// versions. If pName is empty the merged history File Digger opens is brought
+// up to date instead.
+static bool findName(git_repository *pRepository, const QByteArray &pRefName, const QString &pName) {
+	FilenameIndex lIndex(pRefName);
+	if(!lIndex.update(pRepository)) {
+		return false;
+	}
+	if(pName.isEmpty()) {
+		MergedHistory lHistory(pRefName);
+		return lHistory.open(pRepository) || lHistory.update(pRepository, lIndex);
+	}
+	QTextStream lOut(stdout);
+	foreach(int lEntryIndex, lIndex.find(pName, std::numeric_limits<int>::max())) {
+		const FilenameIndex::Entry &lEntry = lIndex.mEntries.at(lEntryIndex);
+		lOut << vfsTimeToString(lEntry.mFirstSeen) << '\t';
+		if(lEntry.mLastSeen != 0) {
+			lOut << vfsTimeToString(lEntry.mLastSeen);
+		}
+		lOut << '\t' << lIndex.path(lEntry) << '\n';
+	}
+	return true;
+}
+
+int main(int pArgCount, char **pArgArray) {
+	QCoreApplication lApp(pArgCount, pArgArray);
+	QCoreApplication::setApplicationName(QStringLiteral("kup-search"));
+	KLocalizedString::setApplicationDomain("kup");
+
+	QCommandLineParser lParser;
+	lParser.setApplicationDescription(i18n("Lists the files in a bup archive that contain a text, in all saves, "
+	                                       "or the files with a name containing a text."));
+	lParser.addHelpOption();
+	lParser.addOption(QCommandLineOption(QStringList() << QStringLiteral("b") << QStringLiteral("branch"),
+	                                     i18n("Name of the branch to search."),
+	                                     QStringLiteral("branch name"), QStringLiteral("kup")));
+	lParser.addOption(QCommandLineOption(QStringList() << QStringLiteral("p") << QStringLiteral("path"),
+	                                     i18n("Only search in this folder of each save."), QStringLiteral("path")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("since"), i18n("Only search saves made on or after this date."),
+	                                     QStringLiteral("yyyy-mm-dd")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("until"), i18n("Only search saves made on or before this date."),
+	                                     QStringLiteral("yyyy-mm-dd")));
+	lParser.addOption(QCommandLineOption(QStringList() << QStringLiteral("n") << QStringLiteral("name"),
+	                                     i18n("List every version of the files and folders with a name containing "
+	                                          "this text, instead of searching file content."),
+	                                     QStringLiteral("text")));
+	lParser.addOption(QCommandLineOption(QStringLiteral("update-index"),
+	                                     i18n("Only bring the index of file names and the history shown by "
+	                                          "File Digger up to date.")));
+	lParser.addPositionalArgument(QStringLiteral("<repository path>"), i18n("Path to the bup repository to search."));
+	lParser.addPositionalArgument(QStringLiteral("<text>"), i18n("The text to look for."));
+	lParser.process(lApp);
+
+	const bool lFindName = lParser.isSet(QStringLiteral("name")) || lParser.isSet(QStringLiteral("update-index"));
+	const QStringList lPosArgs = lParser.positionalArguments();
+	if(lPosArgs.count() != (lFindName ? 1 : 2)) {
+		lParser.showHelp(1);
+	}
+	const QByteArray lRepoPath = QFile::encodeName(QDir(lPosArgs.at(0)).absolutePath());
+	const qint64 lFirstTime = parseDate(lParser.value(QStringLiteral("since")), false);
+	const qint64 lLastTime = parseDate(lParser.value(QStringLiteral("until")), true);
+	QString lPath = lParser.value(QStringLiteral("path"));
+	while(lPath.startsWith(QLatin1Char('/'))) {
+		lPath.remove(0, 1);
+	}
+
+	// This needs to be called first thing, before any other calls to libgit2.
+	git_libgit2_init();
+	int lRetVal = 1;
+	{
+		git_repository *lRepository = nullptr;
+		git_revwalk *lRevisionWalker;
+		const QByteArray lRefName = QByteArray("refs/heads/") + lParser.value(QStringLiteral("branch")).toUtf8();
+		CommitIndex lCommitIndex(lRefName);
+		int lAdded;
+		if(0 != git_repository_open(&lRepository, lRepoPath.constData()) ||
+		      0 != git_revwalk_new(&lRevisionWalker, lRepository)) {
+			QTextStream(stderr) << i18n("No bup repository found.\n%1", lPosArgs.at(0)) << '\n';
+		} else {
+			addBupOdbBackend(lRepository);
+			if(lFindName) {
+				if(findName(lRepository, lRefName, lParser.value(QStringLiteral("name")))) {
+					lRetVal = 0;
+				} else {
+					QTextStream(stderr) << i18n("Branch %1 not found.", lParser.value(QStringLiteral("branch"))) << '\n';
+				}
+			} else if(!lCommitIndex.update(lRepository, lRevisionWalker, lAdded)) {
+				QTextStream(stderr) << i18n("Branch %1 not found.", lParser.value(QStringLiteral("branch"))) << '\n';
+			} else {
+				QVector<ContentSearch::Root> lRoots;
+				foreach(const CommitIndex::Entry &lCommit, lCommitIndex.mEntries) {
+					if((lFirstTime <= 0 || lCommit.mTime >= lFirstTime) && (lLastTime <= 0 || lCommit.mTime <= lLastTime)) {
+						lRoots.append(ContentSearch::Root{vfsTimeToString(lCommit.mTime), lCommit.mTree});
+					}
+				}
+				QTextStream lOut(stdout);
+				ContentSearch lSearch(lRepoPath, lPosArgs.at(1).toUtf8());
+				if(lSearch.search(lRoots, lPath, [&lOut](const QStringList &pMatches) {
+					foreach(const QString &lMatch, pMatches) {
+						lOut << lMatch << '\n';
+					}
+					lOut.flush();
+				})) {
+					lRetVal = 0;
+				}
+			}
+			git_revwalk_free(lRevisionWalker);
+		}
+		git_repository_free(lRepository);
+	}
+	git_libgit2_shutdown();
+	return lRetVal;
+}